@@ -6,140 +6,84 @@
 #include "Symbol.h"
 #include "utils.h"
 #include "DataVal.h"
+#include "FlatAST.h"
 
 /*
  * Define node types
  */
 
 enum NodeType {
-	       none = 0,
-	       binOp,
-	       num,
-	       stringLiteral,
-	       unaryOp,
-	       assign,
-	       var,
-	       compound,
+	       var = 0,
 	       program,
 	       block,
 	       varDecl,
 	       varType,
 	       procedureDecl,
 	       param,
-	       procedureCall,
-	       ifStatement,
-	       whileStatement,
-	       recordDecl,
-	       returnStatement
+	       recordDecl
 };
 
+/*
+ * Each node type with the class that carries it, for passes that dispatch
+ * on NodeType (see ASTVisitor.h).
+ */
+#define AST_NODE_TYPES(X)			\
+    X(var, Var)					\
+    X(program, Program)				\
+    X(block, Block)				\
+    X(varDecl, VarDecl)				\
+    X(varType, Type)				\
+    X(procedureDecl, ProcedureDecl)		\
+    X(param, Param)				\
+    X(recordDecl, RecordDecl)
+
 class ScopedSymbolTable;
+class Block;
 
 
 //Pure abstract class AST
 class AST {
 public:
     virtual NodeType type() const = 0;
-    virtual bool isLiteral();
     int line = -2;
 };
 
-//Binary operation node
-class BinOp: public AST {
-public:
-    AST* left;
-    AST* right;
-    Token* op;
-    BinOp(AST* left, Token* op, AST* right);
-    NodeType type() const;
-};
-
-//Number leaf node
-class Num: public AST {
-public:
-    DataVal value;
-    Token* token;
-    Num(Token* token);
-    virtual NodeType type() const;
-};
-
-class StringLiteral: public AST {
-public:
-    DataVal value;
-    Token* token;
-    StringLiteral(Token* token);
-    virtual NodeType type() const;
-};
-
-//Unary operation node
-class UnaryOp: public AST {
-public:
-    Token* op;
-    Token* token;
-    AST* expr;
-    UnaryOp(Token* op, AST* expr);
-    virtual NodeType type() const;
-};
-
-//Compound statement node
-class Compound: public AST {
-public:
-    std::vector<AST*> children;
-    Compound();
-    virtual NodeType type() const;
-};
-
-//Assignment statement node
-class Assign: public AST {
-public:
-    AST* left;
-    AST* right;
-    Token* token;
-    Token* op;
-    Assign(AST* left, Token* op, AST* right);
-    virtual NodeType type() const;
-};
-
-//Variable node
+//Variable name, as declared
 class Var: public AST {
 public:
-    Token* token;
-    TokenVal value;
-    Var(Token* token);
+    Token token;
+    intern::Id id;
+    const std::string& name;
+    Var(const Token& token);
     virtual NodeType type() const;
 };
 
-//Empty statement node
-class NoOp: public AST {
-public:
-    NodeType type() const;
-};
-
 
 //Program node
 class Program: public AST {
 public:
     std::string name;
-    AST* block;
-    Program(std::string name, AST* block);
+    Block* block;
+    Program(std::string name, Block* block);
     ScopedSymbolTable* table;
     virtual NodeType type() const;
 };
 
-//Block node
+//Block node: its declarations, and its statements in the flat tree
 class Block: public AST {
 public:
     std::vector<AST*> declarations;
-    AST* compoundStatement;
-    Block(std::vector<AST*>& declarations, AST* compoundStatement);
+    flat::Ref body;
+    Block(std::vector<AST*>& declarations, flat::Ref body);
     virtual NodeType type() const;
 };
 
 class Type: public AST {
 public:
-    Token* token;
-    TokenVal value;
-    Type(Token* token);
+    Token token;
+    intern::Id id;
+    const std::string& name;
+    Type(const Token& token);
     virtual NodeType type() const;
 };
 
@@ -162,54 +106,22 @@ public:
 
 class ProcedureDecl: public AST {
 public:
-    std::string procName;
-    AST* blockNode;
+    intern::Id procId;
+    const std::string& procName;
+    Block* blockNode;
     Type* returnTypeNode;
     std::vector<Param*>* params;
     ScopedSymbolTable* table;
-    ProcedureDecl(std::string procName, std::vector<Param*>* params, AST* blockNode, Type* returnType);
+    ProcedureDecl(intern::Id procId, std::vector<Param*>* params, Block* blockNode, Type* returnType);
     virtual NodeType type() const;
 };
 
 class RecordDecl: public AST {
  public:
-    std::string recordName;
-    std::unordered_map<std::string, std::pair<Type*, int> > memberIndex;
-    RecordDecl(std::string recordName, std::vector<AST*>* memberDecls);
-    virtual NodeType type() const;
-};
-
-class ProcedureCall: public AST {
-public:
-    ProcedureCall(std::string procName, std::vector<AST*>* paramVals);
-    std::string procName;
-    std::vector<AST*>* paramVals;
-    AST* procDeclNode;
-    virtual NodeType type() const;
-};
-
-class IfStatement: public AST {
-public:
-    IfStatement(AST* conditionNode, AST* blockNode, AST* elseBranch);
-    AST* conditionNode;
-    AST* blockNode;
-    AST* elseBranch;
-    virtual NodeType type() const;
-};
-
-class WhileStatement: public AST {
-public:
-    WhileStatement(AST* conditionNode, AST* blockNode);
-    AST* conditionNode;
-    AST* blockNode;
-    virtual NodeType type() const;
-};
-
-class ReturnStatement: public AST {
-public:
-    ReturnStatement(AST* expr, ProcedureDecl* procDecl);
-    AST* expr;
-    ProcedureDecl* procDecl;
+    intern::Id recordId;
+    const std::string& recordName;
+    std::unordered_map<intern::Id, std::pair<Type*, int> > memberIndex;
+    RecordDecl(intern::Id recordId, std::vector<AST*>* memberDecls);
     virtual NodeType type() const;
 };
 
@@ -0,0 +1,41 @@
+#ifndef AST_VISITOR_H
+#define AST_VISITOR_H
+
+#include <string>
+#include "ASTNodes.h"
+#include "utils.h"
+
+/****************************************
+ AST Visitor
+
+ Static dispatch for passes over the declarations of the program tree,
+ whose statements and expressions are in the flat tree instead (see
+ FlatAST.h). A pass derives from
+ ASTVisitor<Pass, Result> and defines visitX(X* node) for each node class X
+ it handles; the rest fall through to the pass's visitUnhandled(AST*).
+ visit() is a single switch on the node's type, with no RTTI.
+***************************************/
+
+template<typename Derived, typename Result>
+class ASTVisitor {
+public:
+    Result visit(AST* node) {
+	if (node == nullptr) utils::fatalError(std::string("Parse tree is null"));
+	Derived* self = static_cast<Derived*>(this);
+	switch (node->type()) {
+#define DISPATCH_NODE(TYPE, CLASS)					\
+	case NodeType::TYPE: return self->visit##CLASS(static_cast<CLASS*>(node));
+	    AST_NODE_TYPES(DISPATCH_NODE)
+#undef DISPATCH_NODE
+	}
+	return self->visitUnhandled(node);
+    }
+protected:
+    // Passes hide these with their own visitX to handle node type X.
+#define DEFAULT_VISIT(TYPE, CLASS)					\
+    Result visit##CLASS(CLASS* node) { return static_cast<Derived*>(this)->visitUnhandled(node); }
+    AST_NODE_TYPES(DEFAULT_VISIT)
+#undef DEFAULT_VISIT
+};
+
+#endif
@@ -2,51 +2,11 @@
 #include "options.h"
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 
 using namespace std;
 
 
-template <typename T>
-std::pair<size_t, T*> pool<T>::alloc() {
-    size_t lastIdx = 0;
-    auto itr = useList.begin();
-    if (itr != useList.end()) {
-	while (itr != useList.end()) {
-	    if (lastIdx < *itr) {
-		break;
-	    }
-	    lastIdx = *itr + 1;
-	    itr++;
-	}
-    }
-    if (lastIdx > POOL_SIZE - 1) {
-	utils::fatalError("Allocator out of memory");
-    }
-    useList.push_back(lastIdx);
-    ctr++;	    
-    return {lastIdx, &poolBuf[lastIdx]};
-}
-
-template <typename T>
-bool pool<T>::free(size_t listIdx) {
-    for (auto itr = useList.begin(); itr != useList.end(); itr++) {
-	if (*itr == listIdx) {
-	    useList.erase(itr);
-	    ctr--;
-	    return true;
-	}
-	if (*itr > listIdx) {
-	    return false;
-	}
-    }
-    return false;
-}
-
-template <typename T>
-double pool<T>::percentFull() const {
-    return ((double) useList.size() * 100 / POOL_SIZE);
-}
-
 Allocator::Allocator() {
     
 }
@@ -65,83 +25,84 @@ DataVal Allocator::allocCommon(int type, pool<T>& pool, T val) {
     return dval;
 }
 
-DataVal Allocator::allocate(double val) {
-    return allocCommon<double>(DataVal::D_REAL, doublePool, val);
+DataVal Allocator::allocate(string val) {
+    if (++allocsSinceGC >= gcTrigger || maxMemoryThreshold() > GC_THRESHOLD) {
+	gcPending = true;
+    }
+    return allocCommon<string>(DataVal::D_STRING, stringPool, val);
 }
 
-DataVal Allocator::allocate(int val) {
-    return allocCommon<int>(DataVal::D_INT, intPool, val);
+void Allocator::mark(const DataVal& val) {
+    if (val.type == DataVal::D_STRING) {
+	stringPool.mark(val.listIdx);
+    }
 }
 
-DataVal Allocator::allocate(string val) {
-    return allocCommon<string>(DataVal::D_STRING, stringPool, val);
+void Allocator::addRootSet(const RootSet* rootSet) {
+    rootSets.push_back(rootSet);
 }
 
-void Allocator::incRefCount(DataVal val) {
-    auto itr = refCounts.find(val.data);
-    if (itr == refCounts.end()) {
-	refCounts.insert({val.data, {1, val}});
-    } else {
-	itr->second.first++;
-    }
+void Allocator::removeRootSet(const RootSet* rootSet) {
+    rootSets.erase(std::remove(rootSets.begin(), rootSets.end(), rootSet), rootSets.end());
 }
 
-void Allocator::decRefCount(DataVal val) {
-    auto itr = refCounts.find(val.data);
-    if (itr == refCounts.end()) {
-	utils::fatalError("Couldn't decrement ref count for \"" + val.toString());
-    } else {
-	itr->second.first--;
-    }
+Allocator::TempRoot::TempRoot(const DataVal* vals, size_t count) {
+    DataVal::allocator.tempRoots.push_back({vals, count});
 }
 
+Allocator::TempRoot::~TempRoot() {
+    DataVal::allocator.tempRoots.pop_back();
+}
 
+/*
+ * Fraction of the --max-heap limit currently mapped.
+ */
 double Allocator::maxMemoryThreshold() {
-    return std::max(std::max(doublePool.percentFull(), intPool.percentFull()), stringPool.percentFull());
+    if (!options::maxHeapBytes) {
+	return 0;
+    }
+    return (double) slabHeap::mappedBytes / options::maxHeapBytes;
 }
 
-
 void Allocator::gc() {
+    auto start = chrono::steady_clock::now();
 
-    if (maxMemoryThreshold() < GC_THRESHOLD) {
-	return;
+    for (const RootSet* rootSet : rootSets) {
+	rootSet->markRoots(this);
     }
-    
-    for (auto itr = refCounts.cbegin(); itr != refCounts.cend(); ) {
-	if (itr->second.first == 0) {
-	    free(itr->second.second, false);
-	    itr = refCounts.erase(itr);
-	} else {
-	    itr++;
+    for (auto& tempRoot : tempRoots) {
+	for (size_t i = 0; i < tempRoot.second; i++) {
+	    mark(tempRoot.first[i]);
 	}
     }
-}
-
-void Allocator::free(DataVal val, bool removeRefCount) {
+    size_t reclaimedBytes = 0;
+    size_t reclaimed = stringPool.sweep(reclaimedBytes);
+
+    // Let the heap double before collecting again.
+    gcTrigger = std::max(GC_MIN_ALLOCS, (size_t) stringPool.ctr);
+    allocsSinceGC = 0;
+    gcPending = false;
+
+    double pauseUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    stats.collections++;
+    stats.totalPauseUs += pauseUs;
+    stats.maxPauseUs = std::max(stats.maxPauseUs, pauseUs);
+    stats.reclaimedBytes += reclaimedBytes;
+    stats.reclaimedObjects += reclaimed;
     if (options::showAllocations) {
-	cout << "freeing " << val << endl;
-    }
-
-    if (removeRefCount) {
-	if (refCounts.find(val.data) != refCounts.end()) {
-	    refCounts.erase(val.data);
-	}
-    }
-    
-    bool res = true;
-    switch(val.type) {
-    case DataVal::D_STRING: res = stringPool.free(val.listIdx);
-	break;
-    case DataVal::D_INT: res = intPool.free(val.listIdx);
-	break;
-    case DataVal::D_REAL: res = doublePool.free(val.listIdx);
-	break;
-    case DataVal::D_NONE: utils::fatalError("trying to free empty value");
-	break;
-    default: utils::fatalError("trying to free unsupported DataVal type ");
+	cout << "gc: reclaimed " << reclaimed << " objects (" << reclaimedBytes << " bytes) in "
+	     << pauseUs << "us, " << stringPool.ctr << " live" << endl;
     }
+}
 
-    if (!res) {
-	utils::fatalError("Value \"" + val.toString() + "\" could not be freed");
-    }
+void Allocator::printStats() const {
+    cerr << "GC stats:" << endl;
+    cerr << "  collections:       " << stats.collections << endl;
+    cerr << "  total pause:       " << stats.totalPauseUs << " us" << endl;
+    cerr << "  max pause:         " << stats.maxPauseUs << " us" << endl;
+    cerr << "  mean pause:        " << (stats.collections ? stats.totalPauseUs / stats.collections : 0) << " us" << endl;
+    cerr << "  objects reclaimed: " << stats.reclaimedObjects << endl;
+    cerr << "  bytes reclaimed:   " << stats.reclaimedBytes << endl;
+    cerr << "  live objects:      " << stringPool.ctr << endl;
+    cerr << "  mapped heap bytes: " << slabHeap::mappedBytes << endl;
 }
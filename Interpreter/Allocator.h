@@ -1,44 +1,383 @@
 
-#include <list>
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <vector>
 #include <utility>
 #include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
 #include "utils.h"
 
 struct DataVal;
 
+/*
+ * Slabs are mapped straight from the OS, so untouched pages cost nothing
+ * and empty slabs can be handed back. mappedBytes is shared by every pool
+ * and checked against options::maxHeapBytes (0 for no limit).
+ */
+struct slabHeap {
+    static inline size_t mappedBytes = 0;
+
+    static void* map(size_t bytes) {
+	if (options::maxHeapBytes && mappedBytes + bytes > options::maxHeapBytes) {
+	    utils::fatalError("Allocator out of memory: heap limit of " + std::to_string(options::maxHeapBytes) + " bytes reached");
+	}
+	void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+	    utils::fatalError("Allocator out of memory: could not map a new slab");
+	}
+	mappedBytes += bytes;
+	return mem;
+    }
+
+    static void unmap(void* mem, size_t bytes) {
+	munmap(mem, bytes);
+	mappedBytes -= bytes;
+    }
+};
+
+/*
+ * Growable slot pool built from fixed-size slabs. A slot's index is its
+ * slab number times SLAB_SLOTS plus its position in the slab. Each slab
+ * keeps an intrusive free list threaded through its dead slots, and the
+ * pool keeps a stack of slabs that still have room, so alloc and free are
+ * both O(1). usedBits records which slots are live so a double free is
+ * caught. One empty slab is kept around as a spare; any further slab that
+ * empties out is unmapped. markBits is only used by the collector: sweep
+ * frees every live slot that wasn't marked since the last sweep.
+ *
+ * free parks a slot in a small pool-wide cache of recent slots rather than
+ * handing it straight back to its slab, and alloc takes from that cache
+ * first. A free followed by an alloc then only touches the slot and its
+ * used bit, not a slab header that is likely cold. The cache is flushed
+ * to the slabs when it fills up and after every sweep.
+ *
+ * A slab's header and bitmaps sit at the start of its own mapping, just
+ * ahead of its slots, so a slot's address follows from the slab's alone
+ * and reaching a slot never waits on a load from somewhere else.
+ */
 template <typename T>
 struct pool {
+    static const size_t SLAB_BYTES = 64 * 1024;
+    // Each slot takes sizeof(T) bytes and a bit in each bitmap; the
+    // header's other fields fit in its first cache line.
+    static const size_t SLAB_SLOTS = std::max<size_t>(64, (SLAB_BYTES - 64) * 8 / (sizeof(T) * 8 + 2) / 64 * 64);
+    static const uint32_t NO_SLOT = UINT32_MAX;
+    static_assert(sizeof(T) >= sizeof(uint32_t), "free slots must be able to hold a free list link");
+
+    struct Slab {
+	uint32_t freeHead = NO_SLOT;
+	uint32_t bump = 0;
+	uint32_t live = 0;
+	uint64_t usedBits[SLAB_SLOTS / 64] = {};
+	uint64_t markBits[SLAB_SLOTS / 64] = {};
+	bool full() const { return freeHead == NO_SLOT && bump == SLAB_SLOTS; }
+	T* slots() { return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + SLOTS_OFFSET); }
+    };
+    static const size_t SLOTS_OFFSET = (sizeof(Slab) + std::max<size_t>(64, alignof(T)) - 1) & ~(std::max<size_t>(64, alignof(T)) - 1);
+
+    ~pool();
     std::pair<size_t, T*> alloc();
     bool free(size_t listIdx);
+    void mark(size_t listIdx);
+    size_t sweep(size_t& reclaimedBytes);
     double percentFull() const;
 
-    static const int POOL_SIZE = 10000;
-    T poolBuf[POOL_SIZE];
-    std::list<size_t> useList;
+    std::vector<Slab*> slabs;
+    // Slabs with at least one free slot; allocation always uses the last.
+    std::vector<uint32_t> available;
+    // Entries of slabs whose slab has been unmapped.
+    std::vector<uint32_t> releasedIdx;
+    size_t numMapped = 0;
+    size_t emptySlabs = 0;
     int ctr = 0;
+    // Slots freed most recently, still counted live by their slabs. alloc
+    // hands these out first, so a free followed by an alloc never touches
+    // a slab's free list or live count.
+    static const uint32_t RECENT_SLOTS = 64;
+    uint32_t recent[RECENT_SLOTS];
+    uint32_t numRecent = 0;
+private:
+    static size_t slabBytes() {
+	return (SLOTS_OFFSET + SLAB_SLOTS * sizeof(T) + 4095) & ~(size_t) 4095;
+    }
+    void newSlab();
+    void releaseSlab(uint32_t slabIdx);
+    bool destroy(size_t listIdx);
+    void release(uint32_t slabIdx, uint32_t idx);
+    void flushRecent(uint32_t count);
 };
 
+template <typename T>
+pool<T>::~pool() {
+    for (Slab* slab : slabs) {
+	if (!slab) continue;
+	for (uint32_t i = 0; i < slab->bump; i++) {
+	    if (slab->usedBits[i / 64] & ((uint64_t) 1 << (i % 64))) {
+		slab->slots()[i].~T();
+	    }
+	}
+	slabHeap::unmap(slab, slabBytes());
+    }
+}
+
+template <typename T>
+void pool<T>::newSlab() {
+    Slab* slab = new (slabHeap::map(slabBytes())) Slab();
+    uint32_t slabIdx;
+    if (!releasedIdx.empty()) {
+	slabIdx = releasedIdx.back();
+	releasedIdx.pop_back();
+	slabs[slabIdx] = slab;
+    }
+    else {
+	if ((uint64_t) (slabs.size() + 1) * SLAB_SLOTS > UINT32_MAX) {
+	    utils::fatalError("Allocator out of memory: too many slabs");
+	}
+	slabIdx = slabs.size();
+	slabs.push_back(slab);
+    }
+    available.push_back(slabIdx);
+    numMapped++;
+    emptySlabs++;
+}
+
+template <typename T>
+void pool<T>::releaseSlab(uint32_t slabIdx) {
+    available.erase(std::find(available.begin(), available.end(), slabIdx));
+    slabHeap::unmap(slabs[slabIdx], slabBytes());
+    slabs[slabIdx] = nullptr;
+    releasedIdx.push_back(slabIdx);
+    numMapped--;
+}
+
+template <typename T>
+std::pair<size_t, T*> pool<T>::alloc() {
+    if (numRecent > 0) {
+	uint32_t listIdx = recent[--numRecent];
+	Slab* slab = slabs[listIdx / SLAB_SLOTS];
+	uint32_t idx = listIdx % SLAB_SLOTS;
+	slab->usedBits[idx / 64] |= (uint64_t) 1 << (idx % 64);
+	ctr++;
+	return {listIdx, new (&slab->slots()[idx]) T()};
+    }
+    if (available.empty()) {
+	newSlab();
+    }
+    uint32_t slabIdx = available.back();
+    Slab* slab = slabs[slabIdx];
+    uint32_t idx;
+    if (slab->freeHead != NO_SLOT) {
+	idx = slab->freeHead;
+	slab->freeHead = *reinterpret_cast<uint32_t*>(&slab->slots()[idx]);
+    }
+    else {
+	idx = slab->bump++;
+    }
+    if (slab->live++ == 0) {
+	emptySlabs--;
+    }
+    if (slab->full()) {
+	available.pop_back();
+    }
+    slab->usedBits[idx / 64] |= (uint64_t) 1 << (idx % 64);
+    ctr++;
+    T* slot = new (&slab->slots()[idx]) T();
+    return {slabIdx * SLAB_SLOTS + idx, slot};
+}
+
+/*
+ * Destroys a live slot's value and clears its used bit, leaving the slot
+ * counted live by its slab.
+ */
+template <typename T>
+bool pool<T>::destroy(size_t listIdx) {
+    size_t slabIdx = listIdx / SLAB_SLOTS;
+    uint32_t idx = listIdx % SLAB_SLOTS;
+    if (slabIdx >= slabs.size() || !slabs[slabIdx]) {
+	return false;
+    }
+    Slab* slab = slabs[slabIdx];
+    uint64_t bit = (uint64_t) 1 << (idx % 64);
+    if (!(slab->usedBits[idx / 64] & bit)) {
+	return false;
+    }
+    slab->usedBits[idx / 64] &= ~bit;
+    slab->slots()[idx].~T();
+    ctr--;
+    return true;
+}
 
+/*
+ * Returns a destroyed slot to its slab's free list.
+ */
+template <typename T>
+void pool<T>::release(uint32_t slabIdx, uint32_t idx) {
+    Slab* slab = slabs[slabIdx];
+    bool wasFull = slab->full();
+    *reinterpret_cast<uint32_t*>(&slab->slots()[idx]) = slab->freeHead;
+    slab->freeHead = idx;
+    if (wasFull) {
+	available.push_back(slabIdx);
+    }
+    if (--slab->live == 0) {
+	if (emptySlabs > 0) {
+	    releaseSlab(slabIdx);
+	}
+	else {
+	    emptySlabs++;
+	}
+    }
+}
+
+/*
+ * Returns the oldest count recently freed slots to their slabs.
+ */
+template <typename T>
+void pool<T>::flushRecent(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+	release(recent[i] / SLAB_SLOTS, recent[i] % SLAB_SLOTS);
+    }
+    std::copy(recent + count, recent + numRecent, recent);
+    numRecent -= count;
+}
+
+template <typename T>
+bool pool<T>::free(size_t listIdx) {
+    if (!destroy(listIdx)) {
+	return false;
+    }
+    if (numRecent == RECENT_SLOTS) {
+	flushRecent(RECENT_SLOTS / 2);
+    }
+    recent[numRecent++] = listIdx;
+    return true;
+}
+
+template <typename T>
+void pool<T>::mark(size_t listIdx) {
+    Slab* slab = slabs[listIdx / SLAB_SLOTS];
+    uint32_t idx = listIdx % SLAB_SLOTS;
+    slab->markBits[idx / 64] |= (uint64_t) 1 << (idx % 64);
+}
+
+/*
+ * Heap bytes owned by a slot beyond sizeof(T).
+ */
+template <typename T>
+inline size_t payloadBytes(const T& val) {
+    return 0;
+}
+
+template <>
+inline size_t payloadBytes(const std::string& val) {
+    // Short strings live inside the std::string itself.
+    return val.capacity() > 15 ? val.capacity() + 1 : 0;
+}
+
+template <typename T>
+size_t pool<T>::sweep(size_t& reclaimedBytes) {
+    size_t reclaimed = 0;
+    for (size_t slabIdx = 0; slabIdx < slabs.size(); slabIdx++) {
+	Slab* slab = slabs[slabIdx];
+	if (!slab) continue;
+	for (size_t word = 0; word < SLAB_SLOTS / 64; word++) {
+	    uint64_t garbage = slab->usedBits[word] & ~slab->markBits[word];
+	    slab->markBits[word] = 0;
+	    while (garbage) {
+		uint32_t idx = word * 64 + __builtin_ctzll(garbage);
+		garbage &= garbage - 1;
+		reclaimedBytes += sizeof(T) + payloadBytes(slab->slots()[idx]);
+		reclaimed++;
+		destroy(slabIdx * SLAB_SLOTS + idx);
+		// Releasing the last live slot can unmap the slab.
+		release(slabIdx, idx);
+		if (!slabs[slabIdx]) {
+		    break;
+		}
+	    }
+	    if (!slabs[slabIdx]) break;
+	}
+    }
+    // Let slabs emptied by this collection be unmapped too.
+    flushRecent(numRecent);
+    return reclaimed;
+}
+
+template <typename T>
+double pool<T>::percentFull() const {
+    return numMapped ? ((double) ctr * 100 / (numMapped * SLAB_SLOTS)) : 0;
+}
+
+
+class Allocator;
+
+/*
+ * Anything that holds DataVals outside the allocator (the call stack, the
+ * VM's registers, the flat tree's string constants) registers itself as a root
+ * set for the collector, and removes itself before those values go away.
+ */
+class RootSet {
+public:
+    virtual void markRoots(Allocator* allocator) const = 0;
+};
+
+/*
+ * Mark-sweep collector over the string pool. Allocation only ever requests
+ * a collection; it runs at the next safepoint, where every live value is
+ * reachable from a root set or a temporary root (values in flight in the
+ * tree walker).
+ */
 class Allocator {
 public:
     Allocator();
-    DataVal allocate(double val);
-    DataVal allocate(int val);
+    // INTEGER and REAL values are stored inline in DataVal, so only
+    // heap-backed payloads are allocated here.
     DataVal allocate(std::string val);
-    void incRefCount(DataVal val);
-    void decRefCount(DataVal val);
-    void free(DataVal val, bool removeRefCount=true);
+    void mark(const DataVal& val);
+    void addRootSet(const RootSet* roots);
+    void removeRootSet(const RootSet* roots);
+    void safepoint() {
+	if (gcPending) gc();
+    }
+    void gc();
+    void printStats() const;
+    // Strings currently allocated, live or awaiting a collection.
+    size_t liveObjects() const { return stringPool.ctr; }
+
+    /*
+     * Roots values held in C++ locals for as long as the guard lives.
+     */
+    struct TempRoot {
+	TempRoot(const DataVal* vals, size_t count = 1);
+	~TempRoot();
+    };
 private:
     static constexpr double GC_THRESHOLD = 0.8;
-    
+    static constexpr size_t GC_MIN_ALLOCS = 10000;
+
     double maxMemoryThreshold();
-    void gc();
 
     template <typename T>
     DataVal allocCommon(int type, pool<T>& pool, T val);
 
-    pool<double> doublePool;
-    pool<int> intPool;
     pool<std::string> stringPool;
-    std::unordered_map<void*, std::pair<int, DataVal> > refCounts;
+    std::vector<const RootSet*> rootSets;
+    std::vector<std::pair<const DataVal*, size_t> > tempRoots;
+    bool gcPending = false;
+    size_t allocsSinceGC = 0;
+    size_t gcTrigger = GC_MIN_ALLOCS;
+
+    struct Stats {
+	size_t collections = 0;
+	double totalPauseUs = 0;
+	double maxPauseUs = 0;
+	size_t reclaimedBytes = 0;
+	size_t reclaimedObjects = 0;
+    } stats;
 };
+
+#endif
@@ -0,0 +1,46 @@
+#include "Arena.h"
+
+using namespace std;
+
+Arena::Arena() : next(nullptr), end(nullptr), used(0) {
+}
+
+Arena::~Arena() {
+    release();
+}
+
+/*
+ * Starts a new block when the current one is out of room. An object too
+ * big to share a block gets one of its own, and the current block stays
+ * in use for the small objects that follow.
+ */
+void* Arena::newBlock(size_t bytes, size_t align) {
+    if (bytes + align > BLOCK_BYTES / 4) {
+	char* block = static_cast<char*>(::operator new(bytes + align));
+	blocks.push_back(block);
+	used += bytes;
+	return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(block) + align - 1) & ~(uintptr_t) (align - 1));
+    }
+    char* block = static_cast<char*>(::operator new(BLOCK_BYTES));
+    blocks.push_back(block);
+    next = block;
+    end = block + BLOCK_BYTES;
+    return alloc(bytes, align);
+}
+
+void Arena::release() {
+    for (auto itr = finalizers.rbegin(); itr != finalizers.rend(); itr++) {
+	itr->destroy(itr->obj);
+    }
+    finalizers.clear();
+    for (char* block : blocks) {
+	::operator delete(block);
+    }
+    blocks.clear();
+    next = end = nullptr;
+    used = 0;
+}
+
+size_t Arena::bytesUsed() const {
+    return used;
+}
@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Bump-pointer arena for objects that all die together, like the nodes of
+ * a syntax tree. Objects are carved out of large blocks one after another
+ * and are never freed on their own: destroying the arena releases every
+ * block at once. Objects that own memory of their own (a node holding a
+ * vector, say) are recorded as they are made and destroyed, newest first,
+ * just before the blocks go.
+ */
+class Arena {
+public:
+    static const size_t BLOCK_BYTES = 64 * 1024;
+    Arena();
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    void* alloc(size_t bytes, size_t align);
+    template <typename T, typename... Args>
+    T* make(Args&&... args);
+    // Destroys everything made so far and frees all blocks.
+    void release();
+    size_t bytesUsed() const;
+private:
+    struct Finalizer {
+	void (*destroy)(void*);
+	void* obj;
+    };
+    std::vector<char*> blocks;
+    char* next;
+    char* end;
+    size_t used;
+    std::vector<Finalizer> finalizers;
+    void* newBlock(size_t bytes, size_t align);
+};
+
+template <typename T, typename... Args>
+T* Arena::make(Args&&... args) {
+    T* obj = new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+	finalizers.push_back({ [](void* p) { static_cast<T*>(p)->~T(); }, obj });
+    }
+    return obj;
+}
+
+inline void* Arena::alloc(size_t bytes, size_t align) {
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(next) + align - 1) & ~(uintptr_t) (align - 1);
+    if (aligned + bytes > reinterpret_cast<uintptr_t>(end)) {
+	return newBlock(bytes, align);
+    }
+    next = reinterpret_cast<char*>(aligned + bytes);
+    used += bytes;
+    return reinterpret_cast<void*>(aligned);
+}
+
+#endif
@@ -0,0 +1,47 @@
+#include "Bytecode.h"
+#include "builtins.h"
+
+using namespace std;
+
+#define BYTECODE_NAME(name) #name,
+
+const char* bytecode::opName(Op op) {
+    static const char* names[] = { BYTECODE_OPS(BYTECODE_NAME) };
+    return names[(int) op];
+}
+
+#undef BYTECODE_NAME
+
+string Chunk::toString() const {
+    string result = "Chunk " + name + ", level " + to_string(level) + ", " + to_string(numParams)
+	+ " params, " + to_string(numRegs) + " registers\n";
+    for (size_t i = 0; i < code.size(); i++) {
+	const Instr& instr = code[i];
+	result += "  " + to_string(i) + "\t" + bytecode::opName(instr.op) + "\t"
+	    + to_string(instr.a) + " " + to_string(instr.b) + " " + to_string(instr.c);
+	if (instr.op == Op::LOADK) {
+	    result += "\t; " + constants[instr.b].toString();
+	}
+	result += "\n";
+    }
+    return result;
+}
+
+uint16_t Module::maxRegs() const {
+    uint16_t result = 0;
+    for (const Chunk& chunk : chunks) {
+	result = std::max(result, chunk.numRegs);
+    }
+    return result;
+}
+
+string Module::toString() const {
+    string result;
+    for (size_t i = 0; i < chunks.size(); i++) {
+	result += "[" + to_string(i) + "] " + chunks[i].toString();
+    }
+    for (size_t i = 0; i < builtins.size(); i++) {
+	result += "builtin " + to_string(i) + ": " + builtins[i]->name + "\n";
+    }
+    return result;
+}
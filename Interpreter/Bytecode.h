@@ -0,0 +1,111 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include "DataVal.h"
+
+namespace builtin {
+    struct Fn;
+}
+
+/*
+ * Register bytecode opcodes. R[x] is a register of the current frame,
+ * K[x] an entry of the chunk's constant table.
+ */
+#define BYTECODE_OPS(X)							\
+    X(MOVE)		/* R[a] = R[b] */				\
+    X(LOADK)		/* R[a] = K[b] */				\
+    X(GETOUTER)		/* R[a] = R[c] of the frame b static links up */ \
+    X(SETOUTER)		/* R[c] of the frame b static links up = R[a] */ \
+    X(ADD)		/* R[a] = R[b] + R[c] */			\
+    X(SUB)		/* R[a] = R[b] - R[c] */			\
+    X(MUL)		/* R[a] = R[b] * R[c] */			\
+    X(DIV)		/* R[a] = R[b] / R[c] */			\
+    X(EQ)		/* R[a] = R[b] = R[c] */			\
+    X(NE)		/* R[a] = R[b] != R[c] */			\
+    X(LT)		/* R[a] = R[b] < R[c] */			\
+    X(GT)		/* R[a] = R[b] > R[c] */			\
+    X(LE)		/* R[a] = R[b] <= R[c] */			\
+    X(GE)		/* R[a] = R[b] >= R[c] */			\
+    X(NEG)		/* R[a] = -R[b] */				\
+    X(JMP)		/* pc = b */					\
+    X(JMPF)		/* if (!R[a]) pc = b */				\
+    X(CALL)		/* R[a] = chunk b called with args R[c]... */	\
+    X(CALLB)		/* R[a] = builtin b called with args R[c]... */ \
+    X(RET)		/* return R[a] */				\
+    X(RETNONE)		/* return from a void procedure */		\
+    X(NORET)		/* non-void procedure fell off its end */	\
+    X(PANIC)		/* dump the frames and exit */			\
+    X(TRACECMP)		/* print R[b] and R[c] (-sc) */			\
+    X(TRACECOND)	/* print R[a] as an if condition (-sc) */	\
+    X(LOAD)		/* compile chunk b, then run it from the start */
+
+#define BYTECODE_ENUM(name) name,
+
+enum class Op : uint8_t {
+    BYTECODE_OPS(BYTECODE_ENUM)
+    NUM_OPS
+};
+
+#undef BYTECODE_ENUM
+
+/*
+ * Every instruction is a fixed 8 byte record. Jump targets are absolute
+ * instruction indices within the chunk.
+ */
+struct Instr {
+    Op op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+/*
+ * One compiled procedure (or the program body). Registers are laid out as
+ * [params][locals][temporaries], so a caller passes arguments by placing
+ * them in consecutive registers that become the bottom of the callee's frame.
+ */
+struct Chunk {
+    std::string name;
+    std::vector<Instr> code;
+    std::vector<int> lines;
+    std::vector<DataVal> constants;
+    // Register name for each local slot, used by panic() and -db.
+    std::vector<std::string> slotNames;
+    uint16_t numParams = 0;
+    uint16_t numRegs = 0;
+    int level = 0;
+    bool returnsValue = false;
+    std::string toString() const;
+};
+
+/*
+ * Compiles a chunk whose procedure body was not yet parsed when the
+ * module was built. Until then the chunk is a single LOAD.
+ */
+class ChunkLoader {
+public:
+    virtual ~ChunkLoader() {}
+    virtual void load(uint16_t chunkIdx) = 0;
+};
+
+/*
+ * A whole compiled program. Chunk 0 is always the program body. Chunks are
+ * kept in a deque so that loading one never moves the others.
+ */
+struct Module {
+    std::deque<Chunk> chunks;
+    std::vector<const builtin::Fn*> builtins;
+    ChunkLoader* loader = nullptr;
+    uint16_t maxRegs() const;
+    std::string toString() const;
+};
+
+namespace bytecode {
+    const char* opName(Op op);
+}
+
+#endif
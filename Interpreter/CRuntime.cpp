@@ -0,0 +1,315 @@
+#include "CTranslator.h"
+
+/*
+ * The runtime every translated program starts with. It mirrors DataVal,
+ * CallStack and the built-ins closely enough that a translated program
+ * prints, fails and overflows exactly where the interpreter would, error
+ * messages included. Strings are shared between the values that refer to
+ * them, as with the collector, so STRMODIFY is seen through every copy.
+ * The translator defines RT_MAX_DEPTH ahead of it.
+ */
+extern const char* const C_RUNTIME = R"runtime(#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rt {
+
+    bool dumpVars = false;
+    bool showConditions = false;
+    // Defined by the translator from the interpreter's own limit.
+    const int MAX_DEPTH = RT_MAX_DEPTH;
+
+    [[noreturn]] void fatal(const std::string& err) {
+        std::cerr << "FATAL: " << err << std::endl;
+        exit(1);
+    }
+
+    struct Val {
+        enum Type : uint32_t {
+            D_STRING,
+            D_INT,
+            D_REAL,
+            D_COMP,
+            D_NONE,
+        };
+        union {
+            int intVal;
+            double realVal;
+        };
+        Type type;
+        std::shared_ptr<std::string> str;
+
+        Val() : realVal(0), type(D_NONE) {}
+        explicit Val(int val) : intVal(val), type(D_INT) {}
+        explicit Val(double val) : realVal(val), type(D_REAL) {}
+        explicit Val(std::string val) : realVal(0), type(D_STRING), str(std::make_shared<std::string>(std::move(val))) {}
+
+        std::string toString() const {
+            switch (type) {
+            case D_STRING: return *str;
+            case D_INT: return std::to_string(intVal);
+            case D_REAL: return std::to_string(realVal);
+            case D_NONE: return "NONE";
+            default: return "";
+            }
+        }
+        bool toBool() const {
+            switch (type) {
+            case D_INT: return intVal;
+            case D_REAL: return realVal != 0;
+            default: return false;
+            }
+        }
+        bool isNumeric() const { return type == D_INT || type == D_REAL; }
+    };
+
+#define RT_COMPARISON(NAME, OPERATOR)                                   \
+    inline Val NAME(const Val& lhs, const Val& rhs) {                   \
+        if (showConditions) {                                           \
+            std::cout << "left: " << lhs.toString() << " right: " << rhs.toString() << std::endl; \
+        }                                                               \
+        if (lhs.type != rhs.type) fatal("Cannot use binary operator " #OPERATOR " to compare types " + std::to_string(lhs.type) + " and " + std::to_string(rhs.type)); \
+        switch (lhs.type) {                                             \
+        case Val::D_STRING: return Val((int) (*lhs.str OPERATOR *rhs.str)); \
+        case Val::D_INT: return Val((int) (lhs.intVal OPERATOR rhs.intVal)); \
+        case Val::D_REAL: return Val((int) (lhs.realVal OPERATOR rhs.realVal)); \
+        default: return Val(0);                                         \
+        }                                                               \
+    }
+
+    RT_COMPARISON(eq, ==)
+    RT_COMPARISON(ne, !=)
+    RT_COMPARISON(lt, <)
+    RT_COMPARISON(gt, >)
+    RT_COMPARISON(le, <=)
+    RT_COMPARISON(ge, >=)
+
+#define RT_OPERATION(NAME, OPERATOR, STRINGS)                           \
+    inline Val NAME(const Val& lhs, const Val& rhs) {                   \
+        if (lhs.type != rhs.type) fatal("Cannot use numeric operation " #OPERATOR " on types " + std::to_string(lhs.type) + " and " + std::to_string(rhs.type)); \
+        switch (lhs.type) {                                             \
+        case Val::D_INT: return Val(lhs.intVal OPERATOR rhs.intVal);    \
+        case Val::D_REAL: return Val(lhs.realVal OPERATOR rhs.realVal); \
+        case Val::D_STRING: if (STRINGS) return Val(*lhs.str + *rhs.str); \
+        default: fatal("Cannot use binary operator " #OPERATOR " on non-numeric type " + std::to_string(lhs.type)); \
+        }                                                               \
+    }
+
+    RT_OPERATION(add, +, true)
+    RT_OPERATION(sub, -, false)
+    RT_OPERATION(mul, *, false)
+    RT_OPERATION(div, /, false)
+
+    [[noreturn]] void unknownOperation(const Val& lhs, const Val& rhs, const std::string& err) {
+        if (showConditions) {
+            std::cout << "left: " << lhs.toString() << " right: " << rhs.toString() << std::endl;
+        }
+        fatal(err);
+    }
+
+    inline Val unary(const Val& val, bool minus, const char* op, int line) {
+        if (!val.isNumeric()) {
+            fatal(std::string(op) + " on line " + std::to_string(line) + " is not a known unary operation for value of type " + std::to_string(val.type));
+        }
+        if (!minus) {
+            return Val();
+        }
+        return val.type == Val::D_INT ? Val(-val.intVal) : Val(-val.realVal);
+    }
+
+    inline bool test(const Val& condition) {
+        if (showConditions) {
+            std::cout << "If Condition result: " << condition.toString() << std::endl;
+        }
+        return condition.toBool();
+    }
+
+    /*
+     * Frames live on the native stack. Each has the frame of its
+     * enclosing scope, for variables declared further out, and its
+     * caller, for the built-ins that walk every frame.
+     */
+    struct FrameInfo {
+        const char* name;
+        int numSlots;
+        const char* const* slotNames;
+    };
+
+    struct Frame;
+    Frame* top = nullptr;
+    int depth = 0;
+
+    struct Frame {
+        Frame* link;
+        Frame* caller;
+        const FrameInfo* info;
+        Val* slots;
+        Frame(Frame* link, const FrameInfo* info, Val* slots) : link(link), caller(top), info(info), slots(slots) {
+            if (depth > MAX_DEPTH) {
+                fatal("Stack error: call stack max depth exceeded; stack overflow");
+            }
+            top = this;
+            depth++;
+        }
+        ~Frame();
+    };
+
+    void popFrame() {
+        if (dumpVars) {
+            std::cout << "popping frame" << std::endl;
+        }
+        top = top->caller;
+        depth--;
+        if (!top && dumpVars) {
+            std::cout << "Stack base frame popped" << std::endl;
+        }
+    }
+
+    Frame::~Frame() {
+        popFrame();
+    }
+
+    void dump(const Frame* frame) {
+        std::cout << "______________________________" << std::endl;
+        std::cout << "Frame: " << frame->info->name << std::endl;
+        for (int i = 0; i < frame->info->numSlots; i++) {
+            if (frame->slots[i].type != Val::D_NONE) {
+                std::cout << frame->info->slotNames[i] << " : " << frame->slots[i].toString() << std::endl;
+            }
+        }
+        std::cout << "______________________________" << std::endl;
+    }
+
+    inline Frame* frameAt(Frame* frame, int depth) {
+        for (; depth; depth--) {
+            frame = frame->link;
+        }
+        return frame;
+    }
+
+    inline Val lookup(Frame* current, int depth, int slot, const char* name, int line) {
+        Frame* frame = frameAt(current, depth);
+        if (dumpVars) {
+            std::cout << "******************************" << std::endl;
+            dump(frame);
+            std::cout << "******************************" << std::endl;
+        }
+        const Val& val = frame->slots[slot];
+        if (val.type == Val::D_NONE) {
+            fatal("Could not find value for variable reference '" + std::string(name) + "' on line " + std::to_string(line));
+        }
+        return val;
+    }
+
+    inline void assign(Frame* current, int depth, int slot, const Val& value) {
+        frameAt(current, depth)->slots[slot] = value;
+    }
+
+    [[noreturn]] void missingReturn(const char* procName) {
+        fatal("Reached end of non-void procedure " + std::string(procName) + " without returning a value");
+    }
+
+    // Finds a variable by name from the innermost frame out, for bind().
+    bool resolve(const std::string& key, Frame*& frame, int& slot) {
+        for (frame = top; frame; frame = frame->link) {
+            for (slot = 0; slot < frame->info->numSlots; slot++) {
+                if (key == frame->info->slotNames[slot]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Built-ins
+     */
+
+    void builtinError(const std::string& err, const std::string& name) {
+        fatal("Error in built-in function " + name + ": " + err);
+    }
+
+    Val builtin_DUMP(const Val* args) {
+        std::cout << args[0].toString();
+        return Val();
+    }
+
+    Val builtin_PRINT(const Val* args) {
+        std::cout << args[0].toString();
+        return Val();
+    }
+
+    Val builtin_PRINTLN(const Val* args) {
+        std::cout << args[0].toString() << std::endl;
+        return Val();
+    }
+
+    Val builtin_SLEEP(const Val* args) {
+        std::this_thread::sleep_for(std::chrono::milliseconds((int) args[0].realVal));
+        return Val();
+    }
+
+    Val builtin_STRMODIFY(const Val* args) {
+        std::string* str = args[0].str.get();
+        std::string other_str = *args[1].str;
+        int index = (int) args[2].realVal;
+        std::cout << *str << " " << other_str << " " << index << std::endl;
+        if (other_str.size() != 1) {
+            builtinError("expected second string \"" + other_str + "\" to be of length 1", "STRMODIFY");
+        }
+        if ((unsigned long) index > str->size() - 1) {
+            builtinError("index must be within the bounds of the first string", "STRMODIFY");
+        }
+        (*str)[index] = other_str[0];
+        return Val();
+    }
+
+    Val builtin_PANIC(const Val* args) {
+        std::cout << "Panicking! Stack trace:" << std::endl;
+        while (top) {
+            dump(top);
+            popFrame();
+        }
+        exit(1);
+    }
+
+    Val builtin_BIND(const Val* args) {
+        const std::string& varname = *args[0].str;
+        Frame* frame;
+        int slot;
+        if (!resolve(varname, frame, slot)) {
+            fatal("Failed assignment to undeclared variable \"" + varname + "\" on line -1");
+        }
+        frame->slots[slot] = args[1];
+        int depth = 0;
+        for (Frame* f = top; f != frame; f = f->link) {
+            depth++;
+        }
+        lookup(top, depth, slot, varname.c_str(), -1);
+        return Val();
+    }
+
+    Val builtin_PARSEINT(const Val* args) {
+        return Val(std::stoi(*args[0].str));
+    }
+
+    Val builtin_INPUT(const Val* args) {
+        std::string res;
+        getline(std::cin, res);
+        return Val(res);
+    }
+
+    Val builtin_INT_TO_REAL(const Val* args) {
+        return Val((double) args[0].intVal);
+    }
+
+    Val builtin_REAL_TO_INT(const Val* args) {
+        return Val((int) args[0].realVal);
+    }
+}
+)runtime";
@@ -0,0 +1,300 @@
+#include <cstdlib>
+#include <fstream>
+#include "CTranslator.h"
+#include "ScopedSymbolTable.h"
+#include "builtins.h"
+#include "constants.h"
+
+using namespace std;
+
+CTranslator::CTranslator(const FlatAST& flatTree, function<void(ProcedureDecl*)> expand) : flatTree(flatTree), expand(expand), numLiterals(0), level(0), temps(0) {
+}
+
+// Numbers are written in hexadecimal so they come back bit for bit.
+static string cppReal(double value) {
+    ostringstream out;
+    out << "rt::Val(" << hexfloat << value << ")";
+    return out.str();
+}
+
+static string cppString(const string& value) {
+    ostringstream out;
+    out << "std::string(\"";
+    for (unsigned char c : value) {
+	if (c == '"' || c == '\\') {
+	    out << '\\' << c;
+	}
+	else if (c >= ' ' && c <= '~') {
+	    out << c;
+	}
+	else {
+	    out << '\\' << oct << (c >> 6) << ((c >> 3) & 7) << (c & 7) << dec;
+	}
+    }
+    out << "\", " << value.size() << ")";
+    return out.str();
+}
+
+// Quotes a path for the shell.
+static string quote(const string& path) {
+    string quoted = "'";
+    for (char c : path) {
+	quoted += c == '\'' ? string("'\\''") : string(1, c);
+    }
+    return quoted + "'";
+}
+
+void CTranslator::collect(Block* block) {
+    for (AST* declaration : block->declarations) {
+	if (declaration->type() != NodeType::procedureDecl) {
+	    continue;
+	}
+	ProcedureDecl* decl = static_cast<ProcedureDecl*>(declaration);
+	procIndex[decl] = procedures.size() + 1;
+	procedures.push_back(decl);
+	expand(decl);
+	collect(decl->blockNode);
+    }
+}
+
+void CTranslator::frameInfo(ostream& out, const string& suffix, ScopedSymbolTable* table) {
+    const vector<VarSymbol*>& slots = table->slotSymbols;
+    if (slots.empty()) {
+	out << "static const rt::FrameInfo info" << suffix << " = { \"" << table->name() << "\", 0, nullptr };\n";
+	return;
+    }
+    out << "static const char* const slotNames" << suffix << "[] = {";
+    for (size_t i = 0; i < slots.size(); i++) {
+	out << (i ? ", \"" : " \"") << slots[i]->name << "\"";
+    }
+    out << " };\n";
+    out << "static const rt::FrameInfo info" << suffix << " = { \"" << table->name() << "\", " << slots.size() << ", slotNames" << suffix << " };\n";
+}
+
+void CTranslator::write(AST* tree, const string& path) {
+    Program* progNode = static_cast<Program*>(tree);
+    collect(progNode->block);
+
+    ostringstream infos, declarations, functions;
+    frameInfo(infos, "0", progNode->table);
+    for (ProcedureDecl* decl : procedures) {
+	int idx = procIndex[decl];
+	frameInfo(infos, to_string(idx), decl->table);
+	declarations << "static rt::Val proc" << idx << "(rt::Frame* link, rt::Val* args);\n";
+    }
+    for (ProcedureDecl* decl : procedures) {
+	procedure(decl);
+	functions << code.str() << "\n";
+    }
+
+    level = progNode->table->scopeLevel;
+    temps = 0;
+    code.str("");
+    code << "int main() {\n";
+    code << "    rt::dumpVars = " << (options::dumpVars ? "true" : "false") << ";\n";
+    code << "    rt::showConditions = " << (options::showConditions ? "true" : "false") << ";\n";
+    code << "    rt::Val slots[" << max(1, progNode->table->numSlots()) << "];\n";
+    code << "    {\n";
+    code << "        rt::Frame frame(nullptr, &info0, slots);\n";
+    statement(progNode->block->body, 2);
+    code << "    }\n";
+    code << "    return 0;\n";
+    code << "}\n";
+
+    ofstream out(path);
+    out << "#define RT_MAX_DEPTH " << CALL_STACK_MAX_DEPTH << "\n"
+	<< C_RUNTIME << "\n"
+	<< "// Translated from program " << progNode->name << ".\n\n"
+	<< infos.str() << "\n"
+	<< literals.str() << "\n"
+	<< declarations.str() << "\n"
+	<< functions.str()
+	<< code.str();
+    out.close();
+    if (!out) {
+	utils::fatalError("Could not write translated program to " + path);
+    }
+}
+
+void CTranslator::compile(const string& source, const string& executable) {
+    const char* cxx = getenv("CXX");
+    string command = string(cxx && *cxx ? cxx : "c++") + " -O2 -std=c++17 -o " + quote(executable) + " " + quote(source);
+    if (system(command.c_str()) != 0) {
+	utils::fatalError("Could not build " + executable + " with: " + command);
+    }
+}
+
+void CTranslator::procedure(ProcedureDecl* decl) {
+    int idx = procIndex[decl];
+    level = decl->table->scopeLevel;
+    temps = 0;
+    code.str("");
+    code << "// " << decl->procName << "\n";
+    code << "static rt::Val proc" << idx << "(rt::Frame* link, rt::Val* args) {\n";
+    code << "    rt::Val slots[" << max(1, decl->table->numSlots()) << "];\n";
+    // The frame is popped before a missing return is reported.
+    code << "    {\n";
+    code << "        rt::Frame frame(link, &info" << idx << ", slots);\n";
+    // The params fill the first slots.
+    for (size_t i = 0; i < decl->params->size(); i++) {
+	code << "        slots[" << i << "] = args[" << i << "];\n";
+    }
+    statement(decl->blockNode->body, 2);
+    code << "    }\n";
+    if (decl->returnTypeNode) {
+	code << "    rt::missingReturn(\"" << decl->procName << "\");\n";
+    }
+    else {
+	code << "    return rt::Val();\n";
+    }
+    code << "}\n";
+}
+
+void CTranslator::statement(flat::Ref node, int indent) {
+    const string pad(4 * indent, ' ');
+    switch (flatTree.kinds[node]) {
+    case FlatKind::NOOP:
+	break;
+    case FlatKind::BLOCK:
+	// Declarations have no effect at run time.
+	statement(flatTree.b[node], indent);
+	break;
+    case FlatKind::COMPOUND:
+	for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	    statement(flatTree.lists[flatTree.b[node] + i], indent);
+	}
+	break;
+    case FlatKind::ASSIGN: {
+	string value = expr(flatTree.c[node], indent);
+	code << pad << "rt::assign(&frame, " << flatTree.a[node] << ", " << flatTree.b[node] << ", " << value << ");\n";
+	break;
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	code << pad << call(node, indent) << ";\n";
+	break;
+    case FlatKind::IF: {
+	string condition = expr(flatTree.a[node], indent);
+	code << pad << "if (rt::test(" << condition << ")) {\n";
+	statement(flatTree.b[node], indent + 1);
+	code << pad << "}\n";
+	if (flatTree.c[node] != flat::NONE) {
+	    code << pad << "else {\n";
+	    statement(flatTree.c[node], indent + 1);
+	    code << pad << "}\n";
+	}
+	break;
+    }
+    case FlatKind::WHILE: {
+	code << pad << "for (;;) {\n";
+	string condition = expr(flatTree.a[node], indent + 1);
+	code << pad << "    if (!" << condition << ".toBool()) {\n";
+	code << pad << "        break;\n";
+	code << pad << "    }\n";
+	statement(flatTree.b[node], indent + 1);
+	code << pad << "}\n";
+	break;
+    }
+    case FlatKind::RETURN: {
+	string value = expr(flatTree.a[node], indent);
+	code << pad << "return " << value << ";\n";
+	break;
+    }
+    default:
+	utils::fatalError("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " on line " + to_string(flatTree.lines[node]) + " cannot be translated");
+    }
+}
+
+string CTranslator::temp(const string& value, int indent) {
+    string name = "t" + to_string(temps++);
+    code << string(4 * indent, ' ') << "rt::Val " << name << " = " << value << ";\n";
+    return name;
+}
+
+/*
+ * Writes out whatever must run before the expression's value is known,
+ * and returns C++ for the value itself.
+ */
+string CTranslator::expr(flat::Ref node, int indent) {
+    int line = flatTree.lines[node];
+    switch (flatTree.kinds[node]) {
+    case FlatKind::CONST: {
+	const DataVal& value = flatTree.constants[flatTree.a[node]];
+	if (value.type != DataVal::D_STRING) {
+	    return cppReal(value.realVal);
+	}
+	// One string per literal, shared by every evaluation of it.
+	string name = "literal" + to_string(numLiterals++);
+	literals << "static rt::Val " << name << "(" << cppString(value.toString()) << ");\n";
+	return name;
+    }
+    case FlatKind::VAR:
+	return temp("rt::lookup(&frame, " + to_string(flatTree.a[node]) + ", " + to_string(flatTree.b[node]) + ", \"" + intern::name(flatTree.c[node]) + "\", " + to_string(line) + ")", indent);
+    case FlatKind::BINOP: {
+	ttype::Kind opType = (ttype::Kind) flatTree.a[node];
+	string left = expr(flatTree.b[node], indent);
+	string right = expr(flatTree.c[node], indent);
+	const char* fn;
+	switch (opType) {
+	case ttype::plus: fn = "rt::add"; break;
+	case ttype::minus: fn = "rt::sub"; break;
+	case ttype::mul: fn = "rt::mul"; break;
+	case ttype::float_div: fn = "rt::div"; break;
+	case ttype::equals: fn = "rt::eq"; break;
+	case ttype::not_equals: fn = "rt::ne"; break;
+	case ttype::less_than: fn = "rt::lt"; break;
+	case ttype::greater_than: fn = "rt::gt"; break;
+	case ttype::lt_or_equals: fn = "rt::le"; break;
+	case ttype::gt_or_equals: fn = "rt::ge"; break;
+	default:
+	    code << string(4 * indent, ' ') << "rt::unknownOperation(" << left << ", " << right << ", \"" << ttype::name(opType) << " on line " << line << " is not a known binary operation\");\n";
+	    return "rt::Val()";
+	}
+	return temp(string(fn) + "(" + left + ", " + right + ")", indent);
+    }
+    case FlatKind::UNARY: {
+	ttype::Kind opType = (ttype::Kind) flatTree.a[node];
+	string operand = expr(flatTree.b[node], indent);
+	bool minus = opType == ttype::minus;
+	return temp("rt::unary(" + operand + ", " + (minus ? "true" : "false") + ", \"" + ttype::name(opType) + "\", " + to_string(line) + ")", indent);
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	return temp(call(node, indent), indent);
+    default:
+	utils::fatalError("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " on line " + to_string(line) + " cannot be translated");
+    }
+    return "";
+}
+
+string CTranslator::call(flat::Ref node, int indent) {
+    uint32_t first = flatTree.b[node], numArgs = flatTree.c[node];
+    string args = "nullptr";
+    if (numArgs > 0) {
+	vector<string> values;
+	for (uint32_t i = 0; i < numArgs; i++) {
+	    values.push_back(expr(flatTree.lists[first + i], indent));
+	}
+	args = "a" + to_string(temps++);
+	code << string(4 * indent, ' ') << "rt::Val " << args << "[] = {";
+	for (size_t i = 0; i < values.size(); i++) {
+	    code << (i ? ", " : " ") << values[i];
+	}
+	code << " };\n";
+    }
+    if (flatTree.kinds[node] == FlatKind::CALLB) {
+	return "rt::builtin_" + flatTree.builtins[flatTree.a[node]].fn->name + "(" + args + ")";
+    }
+    ProcedureDecl* decl = flatTree.procedures[flatTree.a[node]].decl;
+    // The callee's frame links to the caller's frame, or to one the
+    // caller's links to, for a procedure declared further out.
+    string link = "&frame";
+    int hops = level - decl->table->scopeLevel + 1;
+    if (hops > 0) {
+	link = "frame.link";
+	for (int i = 1; i < hops; i++) {
+	    link += "->link";
+	}
+    }
+    return "proc" + to_string(procIndex[decl]) + "(" + link + ", " + args + ")";
+}
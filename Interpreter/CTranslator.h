@@ -0,0 +1,57 @@
+#ifndef C_TRANSLATOR_H
+#define C_TRANSLATOR_H
+
+#include <functional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ASTNodes.h"
+
+// The source of the runtime that translated programs are built with.
+extern const char* const C_RUNTIME;
+
+/****************************************
+ C Translator
+
+ Translates an analyzed program into a standalone C++ program, for
+ --emit-c and --native. Every procedure becomes a function and every
+ expression a run of temporaries, so operands are still evaluated left to
+ right. Values keep their dynamic types, and frames their names, so the
+ program behaves as it would in the interpreter: the same output, the
+ same errors, and the same -dv and -sc tracing if those were given when
+ it was translated.
+***************************************/
+
+class CTranslator {
+public:
+    /*
+     * expand is called to parse and analyze the body of a procedure that
+     * was declared without one, since every body is translated.
+     */
+    CTranslator(const FlatAST& flatTree, std::function<void(ProcedureDecl*)> expand);
+    void write(AST* tree, const std::string& path);
+    // Builds an executable with the system C++ compiler ($CXX, or c++).
+    static void compile(const std::string& source, const std::string& executable);
+private:
+    const FlatAST& flatTree;
+    std::function<void(ProcedureDecl*)> expand;
+    std::vector<ProcedureDecl*> procedures;
+    std::unordered_map<ProcedureDecl*, int> procIndex;
+    std::ostringstream literals;
+    int numLiterals;
+    // The function being written.
+    std::ostringstream code;
+    int level;
+    int temps;
+
+    void collect(Block* block);
+    void frameInfo(std::ostream& out, const std::string& name, ScopedSymbolTable* table);
+    void procedure(ProcedureDecl* decl);
+    void statement(flat::Ref node, int indent);
+    std::string expr(flat::Ref node, int indent);
+    std::string call(flat::Ref node, int indent);
+    std::string temp(const std::string& value, int indent);
+};
+
+#endif
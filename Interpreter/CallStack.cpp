@@ -4,106 +4,150 @@
 
 using namespace std;
 
+void CallStack::dump(const StackFrame& frame) const {
+    cout << "______________________________" << endl;
+    cout << "Frame: " << frame.symbolTable->name() << endl;
+    for (int i = 0; i < frame.symbolTable->numSlots(); i++) {
+	const DataVal& val = values[frame.base + i];
+	if (val.type != DataVal::D_NONE) {
+	    cout << frame.symbolTable->slotSymbols[i]->name << " : " << val << endl;
+	}
+    }
+    cout << "______________________________" << endl;
+}
+
 void CallStack::printCurrentFrame() const {
-    currentFrame->dump();
+    dump(frames.back());
 }
 
 bool CallStack::empty() const {
-    return callStackDepth == 0;
+    return frames.empty();
+}
+
+CallStack::CallStack() {
+    // Frames never move, so pushing one never allocates. The value stack
+    // grows geometrically and is only indexed by offset.
+    frames.reserve(CALL_STACK_MAX_DEPTH + 2);
+    values.reserve(1024);
+    DataVal::allocator.addRootSet(this);
+}
+
+CallStack::~CallStack() {
+    DataVal::allocator.removeRootSet(this);
 }
 
-CallStack::CallStack() : currentFrame(nullptr), callStackDepth(0) {
+void CallStack::markRoots(Allocator* allocator) const {
+    for (const DataVal& val : values) {
+	allocator->mark(val);
+    }
+}
+
+CallStack::StackFrame& CallStack::frameAt(int depth) {
+    int idx = frames.size() - 1;
+    for (; depth; depth--) {
+	idx = frames[idx].link;
+    }
+    return frames[idx];
+}
+
+bool CallStack::resolve(const string& key, int& depth, int& slot) const {
+    const StackFrame& current = frames.back();
+    intern::Id id = intern::find(key);
+    if (id == intern::NONE) {
+	return false;
+    }
+    Symbol* symbol = current.symbolTable->lookup(id);
+    if (!symbol || symbol->stype() != Symbol::S_VAR) {
+	return false;
+    }
+    VarSymbol* varSymbol = static_cast<VarSymbol*>(symbol);
+    depth = current.symbolTable->scopeLevel - varSymbol->scopeLevel;
+    slot = varSymbol->slot;
+    return true;
 }
 
-CallStack::StackFrame* CallStack::findFrame(string key) {
-    StackFrame* frame = currentFrame;
+const DataVal& CallStack::slotAt(int depth, int slot) {
+    const StackFrame& frame = frameAt(depth);
     if (options::dumpVars) {
         cout << "******************************" << endl;
+	dump(frame);
+        cout << "******************************" << endl;
+    }
+    return values[frame.base + slot];
+}
+
+DataVal CallStack::lookup(int depth, int slot, const string& name, int line) {
+    const DataVal& val = slotAt(depth, slot);
+    if (val.type == DataVal::D_NONE) {
+	utils::fatalError("Could not find value for variable reference '" + name + "' on line " + to_string(line));
+    }
+    return val;
+}
+
+DataVal CallStack::lookup(int depth, int slot, intern::Id name, int line) {
+    const DataVal& val = slotAt(depth, slot);
+    if (val.type == DataVal::D_NONE) {
+	lookup(depth, slot, intern::name(name), line);
     }
-    while(frame) {
-        if (options::dumpVars) {
-            frame->dump();
-        }
-        auto it = frame->valTable.find(key);
-        if (it == frame->valTable.end()) {
-            frame = frame->parent;
-        }
-        else {
-            if (options::dumpVars) {
-                cout << "******************************" << endl;
-            }
-            foundVal = it->second;
-            return frame;
-        }
-    }
-    return nullptr;
+    return val;
+}
+
+void CallStack::assign(int depth, int slot, DataVal value) {
+    values[frameAt(depth).base + slot] = value;
 }
 
 DataVal CallStack::lookup(string key, int line = -1) {
-    if (findFrame(key)) {
-        return foundVal;
+    int depth, slot;
+    if (frames.empty() || !resolve(key, depth, slot)) {
+	utils::fatalError("Could not find value for variable reference '" + key + "' on line " + to_string(line));
     }
-    utils::fatalError("Could not find value for variable reference '" + key + "' on line " + to_string(line));
-    return DataVal();
+    return lookup(depth, slot, key, line);
 }
 
 void CallStack::assign(string key, DataVal value, int line = -1) {
-    StackFrame* frame;
-    if (!currentFrame) {
+    int depth, slot;
+    if (frames.empty()) {
         utils::fatalError("Stack error: no initial frame pushed to call stack");
     }
-    if (!currentFrame->symbolTable->lookup(key)) {
+    if (!resolve(key, depth, slot)) {
         utils::fatalError("Failed assignment to undeclared variable \"" + key + "\" on line " + to_string(line));
     }
-    if (!(frame = this->findFrame(key))) {
-        frame = currentFrame;
-    }
-    frame->valTable[key] = value;
-    DataVal::allocator.incRefCount(value);
+    assign(depth, slot, value);
 }
 
 void CallStack::pushFrame(ScopedSymbolTable* symbolTable) {
-    if (callStackDepth > CALL_STACK_MAX_DEPTH) {
+    if (frames.size() > CALL_STACK_MAX_DEPTH) {
         utils::fatalError("Stack error: call stack max depth exceeded; stack overflow");
     }
-    StackFrame* newFrame = new StackFrame(symbolTable, currentFrame);
-    currentFrame = newFrame;
-    callStackDepth++;
+    // The enclosing scope's frame is the nearest one on the static chain
+    // with a lower scope level.
+    int link = frames.size() - 1;
+    while (link >= 0 && frames[link].symbolTable->scopeLevel >= symbolTable->scopeLevel) {
+	link = frames[link].link;
+    }
+    size_t base = values.size();
+    values.resize(base + symbolTable->numSlots());
+    frames.push_back({ base, link, symbolTable });
 }
 
-void CallStack::pushFrame(ScopedSymbolTable *symbolTable, string *formalParams, DataVal *actualParams, ssize_t numParams) {
-    // Since this is for procedure calls, we can always assign to the new frame.
+void CallStack::pushFrame(ScopedSymbolTable *symbolTable, DataVal *actualParams, size_t numParams) {
     this->pushFrame(symbolTable);
-    // Populate stack value table.
-    for (unsigned int i = 0;i<numParams;i++) {
-	currentFrame->paramNames.insert(formalParams[i]);
-	currentFrame->valTable[formalParams[i]] = actualParams[i];
-	DataVal::allocator.incRefCount(actualParams[i]);
+    // Parameters occupy the first slots of the frame.
+    DataVal* params = &values[frames.back().base];
+    for (size_t i = 0; i < numParams; i++) {
+	params[i] = actualParams[i];
     }
 }
 
-void CallStack::popFrame(void* retValPtr) {
+void CallStack::popFrame() {
     if (options::dumpVars) {	
 	cout << "popping frame" << endl;
     }
-    StackFrame* oldFrame = currentFrame;
-    currentFrame = currentFrame->parent;
     // Can't delete the symbol table, because we might need it for other
-    // frames.
-
-    for (auto oldBinding : oldFrame->valTable) {
-	if ((oldBinding.second.data != retValPtr) &&
-	    oldFrame->paramNames.find(oldBinding.first) == oldFrame->paramNames.end()) {
-	    DataVal::allocator.free(oldBinding.second);
-	} else {
-	    DataVal::allocator.decRefCount(oldBinding.second);
-	}
-    }
-    
-    delete oldFrame;
-    if (!currentFrame && options::dumpVars) {
+    // frames. The frame's values are left to the collector.
+    values.resize(frames.back().base);
+    frames.pop_back();
+    if (frames.empty() && options::dumpVars) {
         cout << "Stack base frame popped" << endl;
     }
-
-    callStackDepth--;
 }
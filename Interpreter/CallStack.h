@@ -1,8 +1,6 @@
 /****************************************
  Call Stack
 ***************************************/
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include "ScopedSymbolTable.h"
 #include "DataVal.h"
@@ -11,37 +9,48 @@
 #ifndef CALLSTACK_H
 #define CALLSTACK_H
 
-class CallStack {
+class CallStack : public RootSet {
 public:
     CallStack();
+    ~CallStack();
     void pushFrame(ScopedSymbolTable* symbolTable);
-    void pushFrame(ScopedSymbolTable* symbolTable, std::string* formalParams, DataVal* actualParams, ssize_t numParams);
-    void popFrame(void* retValPtr = nullptr);
+    void pushFrame(ScopedSymbolTable* symbolTable, DataVal* actualParams, size_t numParams);
+    void popFrame();
+    void assign(int depth, int slot, DataVal value);
+    DataVal lookup(int depth, int slot, const std::string& name, int line);
+    // The same, naming the variable by its interned id only on an error.
+    DataVal lookup(int depth, int slot, intern::Id name, int line);
+    // A slot of the innermost frame, unchecked, for callers that resolved
+    // it ahead of time.
+    DataVal& local(int slot) { return values[frames.back().base + slot]; }
+    // The slots of the innermost frame, which stay put until the next push.
+    DataVal* locals() { return values.data() + frames.back().base; }
+    // Name-based access for built-ins like bind().
     void assign(std::string key, DataVal value, int line);
     DataVal lookup(std::string key, int line);
     void printCurrentFrame() const;
     bool empty() const;
+    size_t depth() const { return frames.size(); }
+    void markRoots(Allocator* allocator) const;
 private:
+    /*
+     * Frames are laid out back to back: a frame is a window of `values`
+     * holding one slot per variable of its scope, in the order the semantic
+     * analyzer assigned them, so its params come first and locals follow.
+     * The caller is always the previous entry in `frames`.
+     */
     struct StackFrame {
-	std::unordered_map<std::string, DataVal> valTable;
-	std::unordered_set<std::string> paramNames;
-        StackFrame* parent;
+	size_t base;
+	// Index of the frame of the lexically enclosing scope, or -1.
+	int link;
         ScopedSymbolTable* symbolTable;
-        StackFrame(ScopedSymbolTable* symbolTable, StackFrame* parent = nullptr) : parent(parent), symbolTable(symbolTable) {}
-	void dump() const {
-	    std::cout << "______________________________" << std::endl;
-	    std::cout << "Frame: " << symbolTable->name() << std::endl;
-	    for(auto elem : valTable) {
-		std::cout << elem.first  << " : " << elem.second << std::endl;
-	    }
-	    std::cout << "______________________________" << std::endl;
-	}
-	
     };
-    DataVal foundVal;
-    StackFrame* findFrame(std::string key);
-    StackFrame* currentFrame;
-    int callStackDepth;
+    std::vector<StackFrame> frames;
+    std::vector<DataVal> values;
+    StackFrame& frameAt(int depth);
+    const DataVal& slotAt(int depth, int slot);
+    void dump(const StackFrame& frame) const;
+    bool resolve(const std::string& key, int& depth, int& slot) const;
 };
 
 #endif
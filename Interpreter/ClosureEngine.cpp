@@ -0,0 +1,415 @@
+#include "ClosureEngine.h"
+#include "builtins.h"
+
+using namespace std;
+
+typedef ClosureEngine::Expr Expr;
+typedef ClosureEngine::Stmt Stmt;
+
+/****************************************
+ Expression closures
+***************************************/
+
+namespace {
+
+    struct ConstExpr : Expr {
+	// String values stay reachable through the flat tree's constants,
+	// which are roots of the collector.
+	DataVal value;
+	ConstExpr(DataVal value) : value(value) {}
+	DataVal eval() const { return value; }
+    };
+
+    // A variable of the innermost frame.
+    struct LocalExpr : Expr {
+	CallStack& stack;
+	int slot;
+	const string& name;
+	int line;
+	LocalExpr(CallStack& stack, int slot, const string& name, int line) : stack(stack), slot(slot), name(name), line(line) {}
+	DataVal eval() const {
+	    const DataVal& val = stack.local(slot);
+	    if (val.type == DataVal::D_NONE) {
+		utils::fatalError("Could not find value for variable reference '" + name + "' on line " + to_string(line));
+	    }
+	    return val;
+	}
+    };
+
+    // Any variable, through the general lookup, which also dumps frames.
+    struct LookupExpr : Expr {
+	CallStack& stack;
+	int depth;
+	int slot;
+	const string& name;
+	int line;
+	LookupExpr(CallStack& stack, int depth, int slot, const string& name, int line) : stack(stack), depth(depth), slot(slot), name(name), line(line) {}
+	DataVal eval() const { return stack.lookup(depth, slot, name, line); }
+    };
+
+    /*
+     * The left value is kept as a root while the right one runs, since
+     * that may call a procedure and reach a safepoint.
+     */
+    template <typename Op>
+    struct BinaryExpr : Expr {
+	const Expr* left;
+	const Expr* right;
+	BinaryExpr(const Expr* left, const Expr* right) : left(left), right(right) {}
+	DataVal eval() const {
+	    DataVal leftVal = left->eval();
+	    Allocator::TempRoot leftRoot(&leftVal);
+	    return Op::apply(leftVal, right->eval());
+	}
+    };
+
+    struct Add { static DataVal apply(const DataVal& l, const DataVal& r) { return l + r; } };
+    struct Sub { static DataVal apply(const DataVal& l, const DataVal& r) { return l - r; } };
+    struct Mul { static DataVal apply(const DataVal& l, const DataVal& r) { return l * r; } };
+    struct Div { static DataVal apply(const DataVal& l, const DataVal& r) { return l / r; } };
+    struct Eq { static DataVal apply(const DataVal& l, const DataVal& r) { return DataVal((int) (l == r)); } };
+    struct Ne { static DataVal apply(const DataVal& l, const DataVal& r) { return DataVal((int) (l != r)); } };
+    struct Lt { static DataVal apply(const DataVal& l, const DataVal& r) { return DataVal((int) (l < r)); } };
+    struct Gt { static DataVal apply(const DataVal& l, const DataVal& r) { return DataVal((int) (l > r)); } };
+    struct Le { static DataVal apply(const DataVal& l, const DataVal& r) { return DataVal((int) (l <= r)); } };
+    struct Ge { static DataVal apply(const DataVal& l, const DataVal& r) { return DataVal((int) (l >= r)); } };
+
+    // A comparison that prints its operands (-sc).
+    template <typename Op>
+    struct Traced {
+	static DataVal apply(const DataVal& l, const DataVal& r) {
+	    cout << "left: " << l.toString() << " right: " << r.toString() << endl;
+	    return Op::apply(l, r);
+	}
+    };
+
+    struct UnaryExpr : Expr {
+	const Expr* operand;
+	ttype::Kind opType;
+	int line;
+	UnaryExpr(const Expr* operand, ttype::Kind opType, int line) : operand(operand), opType(opType), line(line) {}
+	DataVal eval() const {
+	    DataVal val = operand->eval();
+	    if (!val.isNumeric()) {
+		utils::fatalError(string(ttype::name(opType)) + " on line " + to_string(line) + " is not a known unary operation for value of type " + to_string(val.type));
+	    }
+	    // As in the tree walker, unary plus has no value.
+	    if (opType != ttype::minus) {
+		return DataVal();
+	    }
+	    return val.type == DataVal::D_INT ? DataVal(-val.intVal) : DataVal(-val.realVal);
+	}
+    };
+
+    /*
+     * Arguments are evaluated into a root array, since a later argument
+     * may reach a safepoint.
+     */
+    struct BuiltinCallExpr : Expr {
+	CallStack& stack;
+	const builtin::Fn* fn;
+	vector<const Expr*> args;
+	BuiltinCallExpr(CallStack& stack, const builtin::Fn* fn, vector<const Expr*>&& args) : stack(stack), fn(fn), args(args) {}
+	DataVal eval() const {
+	    size_t numParams = args.size();
+	    DataVal finalParamVals[numParams];
+	    Allocator::TempRoot paramRoots(finalParamVals, numParams);
+	    for (size_t i = 0; i < numParams; i++) {
+		finalParamVals[i] = args[i]->eval();
+	    }
+	    return fn->fn(&stack, vector<DataVal>(finalParamVals, finalParamVals + numParams));
+	}
+    };
+
+    struct CallExpr : Expr {
+	ClosureEngine& engine;
+	ClosureEngine::Procedure* callee;
+	vector<const Expr*> args;
+	CallExpr(ClosureEngine& engine, ClosureEngine::Procedure* callee, vector<const Expr*>&& args) : engine(engine), callee(callee), args(args) {}
+	DataVal eval() const {
+	    size_t numParams = args.size();
+	    DataVal finalParamVals[numParams];
+	    Allocator::TempRoot paramRoots(finalParamVals, numParams);
+	    for (size_t i = 0; i < numParams; i++) {
+		finalParamVals[i] = args[i]->eval();
+	    }
+	    if (!callee->body) {
+		engine.load(callee);
+	    }
+	    ProcedureDecl* decl = callee->decl;
+	    engine.stack.pushFrame(decl->table, finalParamVals, numParams);
+	    bool returned = callee->body->exec();
+	    engine.stack.popFrame();
+	    if (returned) {
+		return engine.returnVal;
+	    }
+	    if (decl->returnTypeNode != nullptr) {
+		utils::fatalError("Reached end of non-void procedure " + decl->procName + " without returning a value");
+	    }
+	    return DataVal();
+	}
+    };
+
+}
+
+/****************************************
+ Statement closures
+***************************************/
+
+namespace {
+
+    struct NoOpStmt : Stmt {
+	bool exec() const { return false; }
+    };
+
+    struct CompoundStmt : Stmt {
+	vector<const Stmt*> children;
+	CompoundStmt(vector<const Stmt*>&& children) : children(children) {}
+	bool exec() const {
+	    for (const Stmt* child : children) {
+		DataVal::allocator.safepoint();
+		if (child->exec()) {
+		    return true;
+		}
+	    }
+	    return false;
+	}
+    };
+
+    struct AssignLocalStmt : Stmt {
+	CallStack& stack;
+	int slot;
+	const Expr* value;
+	AssignLocalStmt(CallStack& stack, int slot, const Expr* value) : stack(stack), slot(slot), value(value) {}
+	bool exec() const {
+	    // The value may push frames, so the slot is found after it.
+	    DataVal result = value->eval();
+	    stack.local(slot) = result;
+	    return false;
+	}
+    };
+
+    struct AssignStmt : Stmt {
+	CallStack& stack;
+	int depth;
+	int slot;
+	const Expr* value;
+	AssignStmt(CallStack& stack, int depth, int slot, const Expr* value) : stack(stack), depth(depth), slot(slot), value(value) {}
+	bool exec() const {
+	    stack.assign(depth, slot, value->eval());
+	    return false;
+	}
+    };
+
+    // A procedure call run for its effect.
+    struct ExprStmt : Stmt {
+	const Expr* expr;
+	ExprStmt(const Expr* expr) : expr(expr) {}
+	bool exec() const {
+	    expr->eval();
+	    return false;
+	}
+    };
+
+    template <bool traced>
+    struct IfStmt : Stmt {
+	const Expr* condition;
+	const Stmt* thenBranch;
+	const Stmt* elseBranch;
+	IfStmt(const Expr* condition, const Stmt* thenBranch, const Stmt* elseBranch) : condition(condition), thenBranch(thenBranch), elseBranch(elseBranch) {}
+	bool exec() const {
+	    DataVal result = condition->eval();
+	    if (traced) {
+		cout << "If Condition result: " << result.toString() << endl;
+	    }
+	    if (result.toBool()) {
+		return thenBranch->exec();
+	    }
+	    return elseBranch && elseBranch->exec();
+	}
+    };
+
+    struct WhileStmt : Stmt {
+	const Expr* condition;
+	const Stmt* body;
+	WhileStmt(const Expr* condition, const Stmt* body) : condition(condition), body(body) {}
+	bool exec() const {
+	    while (condition->eval().toBool()) {
+		if (body->exec()) {
+		    return true;
+		}
+		DataVal::allocator.safepoint();
+	    }
+	    return false;
+	}
+    };
+
+    struct ReturnStmt : Stmt {
+	DataVal& returnVal;
+	const Expr* value;
+	ReturnStmt(DataVal& returnVal, const Expr* value) : returnVal(returnVal), value(value) {}
+	bool exec() const {
+	    returnVal = value->eval();
+	    return true;
+	}
+    };
+
+}
+
+/****************************************
+ Building closures
+***************************************/
+
+ClosureEngine::ClosureEngine(const FlatAST& flatTree, function<void(ProcedureDecl*)> expand) : flatTree(flatTree), expand(expand) {
+}
+
+DataVal ClosureEngine::run(AST* tree) {
+    Program* progNode = static_cast<Program*>(tree);
+    const Stmt* body = statement(progNode->block->body);
+    stack.pushFrame(progNode->table);
+    body->exec();
+    stack.popFrame();
+    return DataVal();
+}
+
+void ClosureEngine::load(Procedure* procedure) {
+    expand(procedure->decl);
+    procedure->body = statement(procedure->decl->blockNode->body);
+}
+
+ClosureEngine::Procedure* ClosureEngine::procedureFor(ProcedureDecl* decl) {
+    auto itr = procIndex.find(decl);
+    if (itr != procIndex.end()) {
+	return itr->second;
+    }
+    procedures.push_back({ decl, nullptr });
+    procIndex[decl] = &procedures.back();
+    return &procedures.back();
+}
+
+const Stmt* ClosureEngine::statement(flat::Ref node) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::NOOP:
+	return arena.make<NoOpStmt>();
+    case FlatKind::BLOCK:
+	// Declarations have no effect at run time; procedures are built
+	// when they are first called.
+	return statement(flatTree.b[node]);
+    case FlatKind::COMPOUND: {
+	vector<const Stmt*> children;
+	for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	    children.push_back(statement(flatTree.lists[flatTree.b[node] + i]));
+	}
+	return arena.make<CompoundStmt>(move(children));
+    }
+    case FlatKind::ASSIGN: {
+	int depth = flatTree.a[node], slot = flatTree.b[node];
+	const Expr* value = expr(flatTree.c[node]);
+	if (depth == 0) {
+	    return arena.make<AssignLocalStmt>(stack, slot, value);
+	}
+	return arena.make<AssignStmt>(stack, depth, slot, value);
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	return arena.make<ExprStmt>(call(node));
+    case FlatKind::IF: {
+	const Expr* condition = expr(flatTree.a[node]);
+	const Stmt* thenBranch = statement(flatTree.b[node]);
+	const Stmt* elseBranch = flatTree.c[node] != flat::NONE ? statement(flatTree.c[node]) : nullptr;
+	if (options::showConditions) {
+	    return arena.make<IfStmt<true>>(condition, thenBranch, elseBranch);
+	}
+	return arena.make<IfStmt<false>>(condition, thenBranch, elseBranch);
+    }
+    case FlatKind::WHILE: {
+	const Expr* condition = expr(flatTree.a[node]);
+	return arena.make<WhileStmt>(condition, statement(flatTree.b[node]));
+    }
+    case FlatKind::RETURN:
+	return arena.make<ReturnStmt>(returnVal, expr(flatTree.a[node]));
+    default:
+	utils::fatalError("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " on line " + to_string(flatTree.lines[node]) + " cannot be run as a statement");
+    }
+    return nullptr;
+}
+
+const Expr* ClosureEngine::expr(flat::Ref node) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::CONST:
+	return arena.make<ConstExpr>(flatTree.constants[flatTree.a[node]]);
+    case FlatKind::VAR:
+	return variable(node);
+    case FlatKind::BINOP:
+	return binOp(node);
+    case FlatKind::UNARY:
+	return arena.make<UnaryExpr>(expr(flatTree.b[node]), (ttype::Kind) flatTree.a[node], flatTree.lines[node]);
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	return call(node);
+    default:
+	utils::fatalError("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " on line " + to_string(flatTree.lines[node]) + " cannot be run as an expression");
+    }
+    return nullptr;
+}
+
+const Expr* ClosureEngine::variable(flat::Ref node) {
+    int depth = flatTree.a[node], slot = flatTree.b[node];
+    const string& name = intern::name(flatTree.c[node]);
+    // Frame dumps go through the general lookup.
+    if (depth == 0 && !options::dumpVars) {
+	return arena.make<LocalExpr>(stack, slot, name, flatTree.lines[node]);
+    }
+    return arena.make<LookupExpr>(stack, depth, slot, name, flatTree.lines[node]);
+}
+
+template <typename Op>
+const Expr* ClosureEngine::comparison(const Expr* left, const Expr* right) {
+    if (options::showConditions) {
+	return arena.make<BinaryExpr<Traced<Op>>>(left, right);
+    }
+    return arena.make<BinaryExpr<Op>>(left, right);
+}
+
+const Expr* ClosureEngine::binOp(flat::Ref node) {
+    ttype::Kind opType = (ttype::Kind) flatTree.a[node];
+    const Expr* left = expr(flatTree.b[node]);
+    const Expr* right = expr(flatTree.c[node]);
+    switch (opType) {
+    case ttype::plus:
+	return arena.make<BinaryExpr<Add>>(left, right);
+    case ttype::minus:
+	return arena.make<BinaryExpr<Sub>>(left, right);
+    case ttype::mul:
+	return arena.make<BinaryExpr<Mul>>(left, right);
+    case ttype::float_div:
+	return arena.make<BinaryExpr<Div>>(left, right);
+    case ttype::equals:
+	return comparison<Eq>(left, right);
+    case ttype::not_equals:
+	return comparison<Ne>(left, right);
+    case ttype::less_than:
+	return comparison<Lt>(left, right);
+    case ttype::greater_than:
+	return comparison<Gt>(left, right);
+    case ttype::lt_or_equals:
+	return comparison<Le>(left, right);
+    case ttype::gt_or_equals:
+	return comparison<Ge>(left, right);
+    default:
+	utils::fatalError(string(ttype::name(opType)) + " on line " + to_string(flatTree.lines[node]) + " is not a known binary operation");
+    }
+    return nullptr;
+}
+
+const Expr* ClosureEngine::call(flat::Ref node) {
+    vector<const Expr*> args;
+    for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	args.push_back(expr(flatTree.lists[flatTree.b[node] + i]));
+    }
+    if (flatTree.kinds[node] == FlatKind::CALLB) {
+	return arena.make<BuiltinCallExpr>(stack, flatTree.builtins[flatTree.a[node]].fn, move(args));
+    }
+    Procedure* callee = procedureFor(flatTree.procedures[flatTree.a[node]].decl);
+    return arena.make<CallExpr>(*this, callee, move(args));
+}
@@ -0,0 +1,65 @@
+#ifndef CLOSURE_ENGINE_H
+#define CLOSURE_ENGINE_H
+
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include "ASTNodes.h"
+#include "Arena.h"
+#include "CallStack.h"
+
+/****************************************
+ Closure Engine
+
+ Runs an analyzed program by first turning every node of the flat tree
+ into a closure: a
+ small object bound to just what that node needs, whose one virtual call
+ does its work. Operators, variable slots, callees and debug options are
+ all picked while the closures are built, so running one never looks at
+ a node type, an operator or a name. Frames live on a CallStack, the
+ same as for the tree walker, so built-ins see the same state.
+***************************************/
+
+class ClosureEngine {
+public:
+    struct Expr {
+	virtual DataVal eval() const = 0;
+    };
+    struct Stmt {
+	// Returns whether a return statement ran.
+	virtual bool exec() const = 0;
+    };
+    // A procedure's body is only built on its first call.
+    struct Procedure {
+	ProcedureDecl* decl;
+	const Stmt* body;
+    };
+    /*
+     * expand is called to parse and analyze the body of a procedure that
+     * was declared without one, before its closures are first built.
+     */
+    ClosureEngine(const FlatAST& flatTree, std::function<void(ProcedureDecl*)> expand);
+    DataVal run(AST* tree);
+    // Builds the body of a procedure on its first call.
+    void load(Procedure* procedure);
+    CallStack stack;
+    DataVal returnVal;
+private:
+    const FlatAST& flatTree;
+    // Every closure, released with the engine.
+    Arena arena;
+    std::function<void(ProcedureDecl*)> expand;
+    std::deque<Procedure> procedures;
+    std::unordered_map<ProcedureDecl*, Procedure*> procIndex;
+
+    Procedure* procedureFor(ProcedureDecl* decl);
+    const Stmt* statement(flat::Ref node);
+    const Expr* expr(flat::Ref node);
+    const Expr* variable(flat::Ref node);
+    const Expr* binOp(flat::Ref node);
+    const Expr* call(flat::Ref node);
+    template <typename Op>
+    const Expr* comparison(const Expr* left, const Expr* right);
+};
+
+#endif
@@ -0,0 +1,371 @@
+#include "Compiler.h"
+#include "builtins.h"
+#include "options.h"
+
+using namespace std;
+
+static const int MAX_OPERAND = UINT16_MAX;
+
+Compiler::Compiler(const FlatAST& flatTree, function<void(ProcedureDecl*)> expand) : flatTree(flatTree), module(nullptr), scope(nullptr), expand(expand) {
+}
+
+void Compiler::error(const string& msg, int line) {
+    utils::fatalError("Compile error on line " + to_string(line) + ": " + msg);
+}
+
+Chunk& Compiler::chunk() {
+    // Chunks are only ever referred to by index, since compiling a nested
+    // procedure can grow the chunk vector.
+    return module->chunks[scope->chunkIdx];
+}
+
+size_t Compiler::emit(Op op, int a, int b, int c, int line) {
+    Chunk& current = chunk();
+    if (current.code.size() >= MAX_OPERAND) {
+	this->error("procedure " + current.name + " is too large to compile", line);
+    }
+    current.code.push_back({op, (uint16_t) a, (uint16_t) b, (uint16_t) c});
+    current.lines.push_back(line);
+    return current.code.size() - 1;
+}
+
+void Compiler::patch(size_t jump) {
+    // Point a forward jump at the next instruction to be emitted.
+    chunk().code[jump].b = chunk().code.size();
+}
+
+uint16_t Compiler::allocReg(int line) {
+    if (scope->top >= MAX_OPERAND) {
+	this->error("expression needs too many registers", line);
+    }
+    uint16_t reg = scope->top++;
+    if (scope->top > chunk().numRegs) {
+	chunk().numRegs = scope->top;
+    }
+    return reg;
+}
+
+uint16_t Compiler::constant(DataVal value, int line) {
+    vector<DataVal>& constants = chunk().constants;
+    if (constants.size() >= MAX_OPERAND) {
+	this->error("too many constants in procedure " + chunk().name, line);
+    }
+    constants.push_back(value);
+    return constants.size() - 1;
+}
+
+void Compiler::enter(Scope* newScope, ScopedSymbolTable* table, int line) {
+    scope = newScope;
+    scope->table = table;
+    if (table->numSlots() >= MAX_OPERAND) {
+	this->error("too many variables in procedure " + chunk().name, line);
+    }
+    // The scope's variables own the low registers; temporaries go above.
+    scope->locals = scope->top = table->numSlots();
+    chunk().numRegs = scope->locals;
+    for (VarSymbol* symbol : table->slotSymbols) {
+	chunk().slotNames.push_back(symbol->name);
+    }
+}
+
+uint16_t Compiler::procIndexFor(ProcedureDecl* node) {
+    auto itr = procIndex.find(node);
+    if (itr != procIndex.end()) {
+	return itr->second;
+    }
+    if (module->chunks.size() >= MAX_OPERAND) {
+	this->error("too many procedures", node->line);
+    }
+    uint16_t idx = module->chunks.size();
+    module->chunks.emplace_back();
+    procIndex[node] = idx;
+    return idx;
+}
+
+uint16_t Compiler::builtinIndexFor(intern::Id id) {
+    auto itr = builtinIndex.find(id);
+    if (itr != builtinIndex.end()) {
+	return itr->second;
+    }
+    uint16_t idx = module->builtins.size();
+    module->builtins.push_back(&builtin::FUNCTIONS.at(id));
+    builtinIndex[id] = idx;
+    return idx;
+}
+
+Module* Compiler::compile(AST* tree) {
+    Program* progNode = dynamic_cast<Program*>(tree);
+    module = new Module();
+    module->loader = this;
+    module->chunks.emplace_back();
+    Scope global = { 0, nullptr, nullptr, 0, 0 };
+    enter(&global, progNode->table, progNode->line);
+    chunk().name = progNode->name;
+    chunk().level = 1;
+    this->block(progNode->block);
+    emit(Op::RETNONE, 0, 0, 0, progNode->line);
+    scope = nullptr;
+    if (options::dumpBytecode) {
+	cout << module->toString();
+    }
+    return module;
+}
+
+void Compiler::procedure(ProcedureDecl* node) {
+    uint16_t idx = procIndexFor(node);
+    Chunk& procChunk = module->chunks[idx];
+    procChunk.name = node->procName;
+    procChunk.level = chunk().level + 1;
+    procChunk.returnsValue = node->returnTypeNode != nullptr;
+    procChunk.numParams = node->params->size();
+    if (node->blockNode) {
+	this->body(node);
+	return;
+    }
+    // The body is still unparsed; the first call loads it.
+    procChunk.numRegs = procChunk.numParams;
+    procChunk.code.push_back({ Op::LOAD, 0, idx, 0 });
+    procChunk.lines.push_back(node->line);
+    unloaded[idx] = node;
+}
+
+void Compiler::body(ProcedureDecl* node) {
+    Scope procScope = { procIndexFor(node), scope, nullptr, 0, 0 };
+    enter(&procScope, node->table, node->line);
+    this->block(node->blockNode);
+    if (chunk().returnsValue) {
+	emit(Op::NORET, 0, 0, 0, node->line);
+    }
+    else {
+	emit(Op::RETNONE, 0, 0, 0, node->line);
+    }
+    scope = procScope.enclosing;
+}
+
+void Compiler::load(uint16_t chunkIdx) {
+    auto itr = unloaded.find(chunkIdx);
+    if (itr == unloaded.end()) {
+	return;
+    }
+    ProcedureDecl* node = itr->second;
+    unloaded.erase(itr);
+    expand(node);
+    Chunk& procChunk = module->chunks[chunkIdx];
+    procChunk.code.clear();
+    procChunk.lines.clear();
+    this->body(node);
+    if (options::dumpBytecode) {
+	cout << "[" << chunkIdx << "] " << procChunk.toString();
+    }
+}
+
+void Compiler::loadAll() {
+    // Loading a body may add the chunks of procedures declared in it.
+    for (size_t i = 0; i < module->chunks.size(); i++) {
+	load(i);
+    }
+}
+
+void Compiler::block(Block* blockNode) {
+    for (AST* decl : blockNode->declarations) {
+	if (decl->type() == NodeType::procedureDecl) {
+	    this->procedure(static_cast<ProcedureDecl*>(decl));
+	}
+    }
+    this->statement(blockNode->body);
+}
+
+void Compiler::store(int depth, int slot, flat::Ref value, int line) {
+    if (depth == 0) {
+	// Evaluate straight into the variable's register.
+	expr(value, slot);
+    }
+    else {
+	emit(Op::SETOUTER, expr(value), depth, slot, line);
+    }
+}
+
+void Compiler::statement(flat::Ref node) {
+    int line = flatTree.lines[node];
+    switch (flatTree.kinds[node]) {
+    case FlatKind::NOOP:
+	break;
+    case FlatKind::COMPOUND: {
+	for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	    this->statement(flatTree.lists[flatTree.b[node] + i]);
+	}
+	break;
+    }
+    case FlatKind::BLOCK:
+	this->block(flatTree.blocks[flatTree.a[node]]);
+	break;
+    case FlatKind::ASSIGN:
+	store(flatTree.a[node], flatTree.b[node], flatTree.c[node], line);
+	break;
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	call(node, -1);
+	break;
+    case FlatKind::RETURN:
+	emit(Op::RET, expr(flatTree.a[node]), 0, 0, line);
+	break;
+    case FlatKind::IF: {
+	int condition = expr(flatTree.a[node]);
+	if (options::showConditions) {
+	    emit(Op::TRACECOND, condition, 0, 0, line);
+	}
+	size_t skipThen = emit(Op::JMPF, condition, 0, 0, line);
+	scope->top = scope->locals;
+	this->statement(flatTree.b[node]);
+	if (flatTree.c[node] != flat::NONE) {
+	    size_t skipElse = emit(Op::JMP, 0, 0, 0, line);
+	    patch(skipThen);
+	    this->statement(flatTree.c[node]);
+	    patch(skipElse);
+	}
+	else {
+	    patch(skipThen);
+	}
+	break;
+    }
+    case FlatKind::WHILE: {
+	size_t loopStart = chunk().code.size();
+	size_t exitLoop = emit(Op::JMPF, expr(flatTree.a[node]), 0, 0, line);
+	scope->top = scope->locals;
+	this->statement(flatTree.b[node]);
+	emit(Op::JMP, 0, loopStart, 0, line);
+	patch(exitLoop);
+	break;
+    }
+    default:
+	this->error("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " cannot be compiled as a statement", line);
+    }
+    // Statements never leave temporaries behind.
+    scope->top = scope->locals;
+}
+
+/*
+ * Compiles an expression and returns the register holding its value. If a
+ * target register is given the value is always placed there.
+ */
+int Compiler::expr(flat::Ref node, int target) {
+    int line = flatTree.lines[node];
+    switch (flatTree.kinds[node]) {
+    case FlatKind::CONST: {
+	int dst = target >= 0 ? target : allocReg(line);
+	emit(Op::LOADK, dst, constant(flatTree.constants[flatTree.a[node]], line), 0, line);
+	return dst;
+    }
+    case FlatKind::VAR: {
+	int depth = flatTree.a[node], slot = flatTree.b[node];
+	if (depth == 0) {
+	    if (target >= 0 && target != slot) {
+		emit(Op::MOVE, target, slot, 0, line);
+		return target;
+	    }
+	    return slot;
+	}
+	int dst = target >= 0 ? target : allocReg(line);
+	emit(Op::GETOUTER, dst, depth, slot, line);
+	return dst;
+    }
+    case FlatKind::BINOP:
+	return binOp(node, target);
+    case FlatKind::UNARY: {
+	int top = scope->top;
+	int operand = expr(flatTree.b[node]);
+	scope->top = top;
+	int dst = target >= 0 ? target : allocReg(line);
+	if (flatTree.a[node] == ttype::minus) {
+	    emit(Op::NEG, dst, operand, 0, line);
+	}
+	else if (dst != operand) {
+	    emit(Op::MOVE, dst, operand, 0, line);
+	}
+	return dst;
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	return call(node, target);
+    default:
+	this->error("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " cannot be compiled as an expression", line);
+    }
+    return -1;
+}
+
+int Compiler::binOp(flat::Ref node, int target) {
+    ttype::Kind opType = (ttype::Kind) flatTree.a[node];
+    int line = flatTree.lines[node];
+    Op op;
+    switch (opType) {
+    case ttype::plus: op = Op::ADD; break;
+    case ttype::minus: op = Op::SUB; break;
+    case ttype::mul: op = Op::MUL; break;
+    case ttype::float_div: op = Op::DIV; break;
+    case ttype::equals: op = Op::EQ; break;
+    case ttype::not_equals: op = Op::NE; break;
+    case ttype::less_than: op = Op::LT; break;
+    case ttype::greater_than: op = Op::GT; break;
+    case ttype::lt_or_equals: op = Op::LE; break;
+    case ttype::gt_or_equals: op = Op::GE; break;
+    default:
+	this->error(string(ttype::name(opType)) + " is not a known binary operation", line);
+	return -1;
+    }
+    int top = scope->top;
+    int left = expr(flatTree.b[node]);
+    int right = expr(flatTree.c[node]);
+    if (options::showConditions && op >= Op::EQ && op <= Op::GE) {
+	emit(Op::TRACECMP, 0, left, right, line);
+    }
+    // Operands are read before the result is written, so the result may
+    // reuse an operand's temporary.
+    scope->top = top;
+    int dst = target >= 0 ? target : allocReg(line);
+    emit(op, dst, left, right, line);
+    return dst;
+}
+
+int Compiler::call(flat::Ref node, int target) {
+    int top = scope->top;
+    int line = flatTree.lines[node];
+    bool isBuiltin = flatTree.kinds[node] == FlatKind::CALLB;
+    uint32_t args = flatTree.b[node], numArgs = flatTree.c[node];
+    intern::Id builtinId = isBuiltin ? flatTree.builtins[flatTree.a[node]].id : intern::NONE;
+    if (isBuiltin) {
+	// These two built-ins inspect the interpreter's call stack, so the VM
+	// implements them directly.
+	if (builtinId == builtin::BIND_ID) {
+	    flat::Ref nameNode = flatTree.lists[args];
+	    if (flatTree.kinds[nameNode] != FlatKind::CONST || flatTree.constants[flatTree.a[nameNode]].type != DataVal::D_STRING) {
+		this->error("bind() needs a string literal variable name in compiled code", line);
+	    }
+	    string name = flatTree.constants[flatTree.a[nameNode]].toString();
+	    intern::Id id = intern::find(name);
+	    Symbol* symbol = id == intern::NONE ? nullptr : scope->table->lookup(id);
+	    if (!symbol || symbol->stype() != Symbol::S_VAR) {
+		this->error("Failed assignment to undeclared variable \"" + name + "\"", line);
+	    }
+	    VarSymbol* varSymbol = static_cast<VarSymbol*>(symbol);
+	    store(scope->table->scopeLevel - varSymbol->scopeLevel, varSymbol->slot, flatTree.lists[args + 1], line);
+	    return target >= 0 ? target : allocReg(line);
+	}
+	if (builtinId == builtin::PANIC_ID) {
+	    emit(Op::PANIC, 0, 0, 0, line);
+	    return target >= 0 ? target : allocReg(line);
+	}
+    }
+    // Arguments go in consecutive registers at the top of the frame.
+    for (uint32_t i = 0; i < numArgs; i++) {
+	expr(flatTree.lists[args + i], allocReg(line));
+    }
+    scope->top = top;
+    int dst = target >= 0 ? target : allocReg(line);
+    if (isBuiltin) {
+	emit(Op::CALLB, dst, builtinIndexFor(builtinId), top, line);
+    }
+    else {
+	emit(Op::CALL, dst, procIndexFor(flatTree.procedures[flatTree.a[node]].decl), top, line);
+    }
+    return dst;
+}
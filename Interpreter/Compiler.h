@@ -0,0 +1,66 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include "ASTNodes.h"
+#include "Bytecode.h"
+
+/****************************************
+ Bytecode Compiler
+
+ Lowers an analyzed program into register bytecode for the VM, from its
+ declarations and the flat tree of its bodies. The semantic analyzer has
+ already resolved every variable to a (static link depth, frame slot)
+ pair; slot i of a scope is register i of its chunk, so nothing is looked
+ up by name at run time.
+***************************************/
+
+class Compiler : public ChunkLoader {
+public:
+    /*
+     * expand is called to parse and analyze the body of a procedure that
+     * was declared without one, before that procedure is first compiled.
+     */
+    Compiler(const FlatAST& flatTree, std::function<void(ProcedureDecl*)> expand);
+    Module* compile(AST* tree);
+    void load(uint16_t chunkIdx);
+    // Compiles every body still waiting for its first call.
+    void loadAll();
+private:
+    struct Scope {
+	size_t chunkIdx;
+	Scope* enclosing;
+	ScopedSymbolTable* table;
+	int top;
+	int locals;
+    };
+    const FlatAST& flatTree;
+    Module* module;
+    Scope* scope;
+    std::unordered_map<ProcedureDecl*, uint16_t> procIndex;
+    std::unordered_map<intern::Id, uint16_t> builtinIndex;
+    std::unordered_map<uint16_t, ProcedureDecl*> unloaded;
+    std::function<void(ProcedureDecl*)> expand;
+
+    void error(const std::string& msg, int line);
+    Chunk& chunk();
+    size_t emit(Op op, int a, int b, int c, int line);
+    void patch(size_t jump);
+    uint16_t allocReg(int line);
+    uint16_t constant(DataVal value, int line);
+    void enter(Scope* newScope, ScopedSymbolTable* table, int line);
+    uint16_t procIndexFor(ProcedureDecl* node);
+    uint16_t builtinIndexFor(intern::Id id);
+    void procedure(ProcedureDecl* node);
+    void body(ProcedureDecl* node);
+    void block(Block* node);
+    void statement(flat::Ref node);
+    void store(int depth, int slot, flat::Ref value, int line);
+    int expr(flat::Ref node, int target = -1);
+    int binOp(flat::Ref node, int target);
+    int call(flat::Ref node, int target);
+};
+
+#endif
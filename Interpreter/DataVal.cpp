@@ -5,7 +5,7 @@ using namespace std;
 
 Allocator DataVal::allocator;
 
-DataVal::DataVal() : data(nullptr), type(D_NONE) {
+DataVal::DataVal() : data(nullptr), type(D_NONE), listIdx(0) {
 }
 
 
@@ -14,9 +14,9 @@ string DataVal::toString() const {
     case D_STRING:
 	return DATAVAL_GET_VAL(string, data);
     case D_INT:
-	return to_string(DATAVAL_GET_VAL(int, data));
+	return to_string(intVal);
     case D_REAL:
-	return to_string(DATAVAL_GET_VAL(double, data));
+	return to_string(realVal);
     case D_NONE:
 	return "NONE";
     default:
@@ -28,9 +28,9 @@ string DataVal::toString() const {
 bool DataVal::toBool() const {
     switch(type) {
     case D_INT:
-	return DATAVAL_GET_VAL(int, data);
+	return intVal;
     case D_REAL:
-	return DATAVAL_GET_VAL(double, data) != 0;
+	return realVal != 0;
     default:
 	break;
     }
@@ -62,6 +62,14 @@ bool operator>(const DataVal& lhs, const DataVal& rhs) {
     DATAVAL_COMPARISON_BODY(>)
 }
 
+bool operator<=(const DataVal& lhs, const DataVal& rhs) {
+    DATAVAL_COMPARISON_BODY(<=)
+}
+
+bool operator>=(const DataVal& lhs, const DataVal& rhs) {
+    DATAVAL_COMPARISON_BODY(>=)
+}
+
 DataVal operator+(const DataVal& lhs, const DataVal& rhs) {
     DATAVAL_OPERATION_BODY(+)
 }
@@ -5,16 +5,13 @@
 #include <cstdint>
 #include "Allocator.h"
 
-class RecordDecl;
-
-
 #define DATAVAL_COMPARISON_BODY(OPERATOR)				\
     if (lhs.type != rhs.type) utils::fatalError				\
 				  ("Cannot use binary operator " #OPERATOR " to compare types " + to_string(lhs.type) + " and " + to_string(rhs.type)); \
     switch(lhs.type) {							\
     case DataVal::D_STRING: return *((std::string*) lhs.data) OPERATOR *((std::string*) rhs.data); \
-    case DataVal::D_INT: return *((int*) lhs.data) OPERATOR *((int*) rhs.data); \
-    case DataVal::D_REAL: return *((double*) lhs.data) OPERATOR *((double*) rhs.data); \
+    case DataVal::D_INT: return lhs.intVal OPERATOR rhs.intVal;		\
+    case DataVal::D_REAL: return lhs.realVal OPERATOR rhs.realVal;	\
     default: return false;		\
     }
 
@@ -24,8 +21,8 @@ class RecordDecl;
     switch(lhs.type) {		           				\
     case DataVal::D_STRING: return DataVal::allocator.allocate( \
 							       *((std::string*) lhs.data) OPERATOR *((std::string*) rhs.data)); \
-    case DataVal::D_INT: return DataVal::allocator.allocate(*((int*) lhs.data) OPERATOR *((int*) rhs.data)); \
-    case DataVal::D_REAL: return DataVal::allocator.allocate(*((double*) lhs.data) OPERATOR *((double*) rhs.data)); \
+    case DataVal::D_INT: return DataVal(lhs.intVal OPERATOR rhs.intVal); \
+    case DataVal::D_REAL: return DataVal(lhs.realVal OPERATOR rhs.realVal); \
     default: { utils::fatalError("Cannot use binary operator " \
 				 #OPERATOR " on non-numeric type " + to_string(lhs.type)); return DataVal(); } \
     }
@@ -34,8 +31,8 @@ class RecordDecl;
     if (lhs.type != rhs.type) utils::fatalError				\
 				  ("Cannot use numeric operation " #OPERATOR " on types " + to_string(lhs.type) + " and " + to_string(rhs.type)); \
     switch(lhs.type) {							\
-    case DataVal::D_INT: return DataVal::allocator.allocate(*((int*) lhs.data) OPERATOR *((int*) rhs.data)); \
-    case DataVal::D_REAL: return DataVal::allocator.allocate(*((double*) lhs.data) OPERATOR *((double*) rhs.data)); \
+    case DataVal::D_INT: return DataVal(lhs.intVal OPERATOR rhs.intVal); \
+    case DataVal::D_REAL: return DataVal(lhs.realVal OPERATOR rhs.realVal); \
     default: { utils::fatalError("Cannot use binary operator " \
 				 #OPERATOR " on non-numeric type " + to_string(lhs.type)); return DataVal(); } \
     }
@@ -46,13 +43,21 @@ class RecordDecl;
 #define DATAVAL_GET_PTR(TYPE, VALUE) \
     (( TYPE * ) VALUE.data)
 
+/*
+ * A tagged 16 byte value. INTEGER and REAL payloads are stored inline and
+ * never touch the allocator; only strings live in an allocator pool, in
+ * which case data points at the pool slot and listIdx is its index.
+ */
 struct DataVal {
     static Allocator allocator;
-    
-    void* data;
-    size_t listIdx;
-    
-    enum Type {
+
+    union {
+	int intVal;
+	double realVal;
+	void* data;
+    };
+
+    enum Type : uint32_t {
         D_STRING,
         D_INT,
         D_REAL,
@@ -60,12 +65,15 @@ struct DataVal {
 	D_NONE,
     };
     Type type;
-    
-    RecordDecl* recordDecl = nullptr;
+    uint32_t listIdx;
+
     DataVal();
+    explicit DataVal(int val) : intVal(val), type(D_INT), listIdx(0) {}
+    explicit DataVal(double val) : realVal(val), type(D_REAL), listIdx(0) {}
     std::string toString() const;
     bool toBool() const;
     bool isNumeric() const;
+    bool isHeap() const { return type == D_STRING || type == D_COMP; }
     void freeData();
     void memoryCheck(DataVal::Type type);
     friend std::ostream &operator<< (std::ostream& os, DataVal const& token);
@@ -73,10 +81,14 @@ struct DataVal {
     friend bool operator!=(const DataVal& lhs, const DataVal& rhs);
     friend bool operator<(const DataVal& lhs, const DataVal& rhs);
     friend bool operator>(const DataVal& lhs, const DataVal& rhs);
+    friend bool operator<=(const DataVal& lhs, const DataVal& rhs);
+    friend bool operator>=(const DataVal& lhs, const DataVal& rhs);
     friend DataVal operator+(const DataVal& lhs, const DataVal& rhs);
     friend DataVal operator-(const DataVal& lhs, const DataVal& rhs);
     friend DataVal operator*(const DataVal& lhs, const DataVal& rhs);
     friend DataVal operator/(const DataVal& lhs, const DataVal& rhs);
 };
 
+static_assert(sizeof(DataVal) == 16, "DataVal should stay two words wide");
+
 #endif
@@ -0,0 +1,177 @@
+#include <mutex>
+#include "FlatAST.h"
+#include "ASTNodes.h"
+#include "builtins.h"
+
+using namespace std;
+
+FlatAST::FlatAST() {
+    DataVal::allocator.addRootSet(this);
+}
+
+FlatAST::~FlatAST() {
+    DataVal::allocator.removeRootSet(this);
+}
+
+void FlatAST::markRoots(Allocator* allocator) const {
+    for (const DataVal& value : constants) {
+	allocator->mark(value);
+    }
+}
+
+flat::Ref FlatAST::add(FlatKind kind, uint32_t a, uint32_t b, uint32_t c, int line) {
+    if (kinds.size() >= flat::NONE) {
+	utils::fatalError("Program on line " + to_string(line) + " has too many syntax tree nodes");
+    }
+    kinds.push_back(kind);
+    this->a.push_back(a);
+    this->b.push_back(b);
+    this->c.push_back(c);
+    lines.push_back(line);
+    return kinds.size() - 1;
+}
+
+flat::Ref FlatAST::constant(DataVal value, int line) {
+    constants.push_back(value);
+    return add(FlatKind::CONST, constants.size() - 1, 0, 0, line);
+}
+
+// Bodies may be parsed on several threads at once, and the allocator
+// isn't locked.
+static mutex stringLock;
+
+flat::Ref FlatAST::stringConstant(string_view text, int line) {
+    DataVal value;
+    {
+	lock_guard<mutex> guard(stringLock);
+	value = DataVal::allocator.allocate(string(text));
+    }
+    return constant(value, line);
+}
+
+uint32_t FlatAST::list(const vector<flat::Ref>& nodes) {
+    uint32_t start = lists.size();
+    lists.insert(lists.end(), nodes.begin(), nodes.end());
+    return start;
+}
+
+uint32_t FlatAST::procedureIndex(ProcedureDecl* decl) {
+    auto itr = procIndex.find(decl);
+    if (itr != procIndex.end()) {
+	return itr->second;
+    }
+    uint32_t idx = procedures.size();
+    procedures.push_back({ decl, flat::NONE, 0 });
+    procIndex[decl] = idx;
+    return idx;
+}
+
+uint32_t FlatAST::builtinIndex(intern::Id id) {
+    auto itr = builtinIdx.find(id);
+    if (itr != builtinIdx.end()) {
+	return itr->second;
+    }
+    uint32_t idx = builtins.size();
+    builtins.push_back({ id, &builtin::FUNCTIONS.at(id) });
+    builtinIdx[id] = idx;
+    return idx;
+}
+
+uint32_t FlatAST::loop(ProcedureDecl* owner) {
+    loops.push_back({ owner, 0 });
+    return loops.size() - 1;
+}
+
+uint32_t FlatAST::block(Block* block) {
+    blocks.push_back(block);
+    return blocks.size() - 1;
+}
+
+void FlatAST::append(FlatAST& other) {
+    uint32_t nodes = kinds.size();
+    uint32_t listStart = lists.size();
+    uint32_t constStart = constants.size();
+    uint32_t loopStart = loops.size();
+    uint32_t blockStart = blocks.size();
+    if ((uint64_t) nodes + other.kinds.size() >= flat::NONE) {
+	utils::fatalError("Program has too many syntax tree nodes");
+    }
+    for (size_t i = 0; i < other.kinds.size(); i++) {
+	uint32_t a = other.a[i], b = other.b[i], c = other.c[i];
+	switch (other.kinds[i]) {
+	case FlatKind::NOOP:
+	case FlatKind::VAR:
+	    break;
+	case FlatKind::CONST:
+	    a += constStart;
+	    break;
+	case FlatKind::ASSIGN:
+	    c += nodes;
+	    break;
+	case FlatKind::BINOP:
+	    b += nodes;
+	    c += nodes;
+	    break;
+	case FlatKind::UNARY:
+	    b += nodes;
+	    break;
+	case FlatKind::COMPOUND:
+	    b += listStart;
+	    break;
+	case FlatKind::BLOCK:
+	    a += blockStart;
+	    b += nodes;
+	    break;
+	case FlatKind::IF:
+	    a += nodes;
+	    b += nodes;
+	    if (c != flat::NONE) {
+		c += nodes;
+	    }
+	    break;
+	case FlatKind::WHILE:
+	    a += nodes;
+	    b += nodes;
+	    c += loopStart;
+	    break;
+	case FlatKind::CALL:
+	    a = procedureIndex(other.procedures[a].decl);
+	    b += listStart;
+	    break;
+	case FlatKind::CALLB:
+	    a = builtinIndex(other.builtins[a].id);
+	    b += listStart;
+	    break;
+	case FlatKind::RETURN:
+	    a += nodes;
+	    break;
+	}
+	kinds.push_back(other.kinds[i]);
+	this->a.push_back(a);
+	this->b.push_back(b);
+	this->c.push_back(c);
+    }
+    lines.insert(lines.end(), other.lines.begin(), other.lines.end());
+    for (flat::Ref node : other.lists) {
+	lists.push_back(node + nodes);
+    }
+    constants.insert(constants.end(), other.constants.begin(), other.constants.end());
+    loops.insert(loops.end(), other.loops.begin(), other.loops.end());
+    for (Block* block : other.blocks) {
+	block->body += nodes;
+	blocks.push_back(block);
+    }
+    other.kinds.clear();
+    other.a.clear();
+    other.b.clear();
+    other.c.clear();
+    other.lines.clear();
+    other.lists.clear();
+    other.constants.clear();
+    other.procedures.clear();
+    other.loops.clear();
+    other.builtins.clear();
+    other.blocks.clear();
+    other.procIndex.clear();
+    other.builtinIdx.clear();
+}
@@ -0,0 +1,120 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "DataVal.h"
+#include "Intern.h"
+
+class Block;
+class ProcedureDecl;
+
+namespace builtin {
+    struct Fn;
+}
+
+/****************************************
+ Flat AST
+
+ The statements and expressions of every body, in parallel arrays. The
+ parser builds them straight into this form, leaving only declarations
+ as nodes. A node is a 32-bit index; its kind, three operands and source
+ line sit at that index of each array. Operands are child nodes or small
+ immediates, and child lists of any length are runs of the shared lists
+ array. Until the semantic analyzer resolves them in place, variables
+ and calls carry only the names they use.
+***************************************/
+
+namespace flat {
+    typedef uint32_t Ref;
+    const Ref NONE = UINT32_MAX;
+}
+
+#define FLAT_NODE_KINDS(X)						\
+    X(NOOP)		/* does nothing */				\
+    X(CONST)		/* constants[a] */				\
+    X(VAR)		/* slot b of the frame a static links up, named c */ \
+    X(ASSIGN)		/* slot b of the frame a links up = node c */	\
+    X(BINOP)		/* node b <operator a> node c */		\
+    X(UNARY)		/* <operator a> node b */			\
+    X(COMPOUND)		/* nodes lists[b] .. lists[b + c - 1] in turn */ \
+    X(BLOCK)		/* node b, under the declarations of blocks[a] */ \
+    X(IF)		/* if node a then node b, else node c if any */	\
+    X(WHILE)		/* while node a do node b, as loop c */		\
+    X(CALL)		/* procedure a with arguments lists[b], c of them */ \
+    X(CALLB)		/* built-in a with arguments lists[b], c of them */ \
+    X(RETURN)		/* return node a */
+
+#define FLAT_NODE_ENUM(name) name,
+
+enum class FlatKind : uint8_t {
+    FLAT_NODE_KINDS(FLAT_NODE_ENUM)
+};
+
+#undef FLAT_NODE_ENUM
+
+/*
+ * Before analysis, a VAR has no depth or slot (both are NONE), an ASSIGN
+ * has no depth and names its variable in b, and a CALL names its
+ * procedure in a.
+ */
+class FlatAST : public RootSet {
+public:
+    // A procedure that calls refer to, with its body once it has run.
+    struct Procedure {
+	ProcedureDecl* decl;
+	flat::Ref body;
+	// Calls run by the interpreter, counted for --jit.
+	uint32_t calls;
+    };
+    // A while loop, with the procedure whose body it is in, if any.
+    struct Loop {
+	ProcedureDecl* owner;
+	// Iterations run by the interpreter, counted for --jit.
+	uint32_t iterations;
+    };
+    struct Builtin {
+	intern::Id id;
+	const builtin::Fn* fn;
+    };
+    std::vector<FlatKind> kinds;
+    std::vector<uint32_t> a;
+    std::vector<uint32_t> b;
+    std::vector<uint32_t> c;
+    std::vector<int> lines;
+    std::vector<flat::Ref> lists;
+    // Literal values, roots of the collector while the tree is alive.
+    std::vector<DataVal> constants;
+    std::vector<Procedure> procedures;
+    std::vector<Loop> loops;
+    std::vector<Builtin> builtins;
+    // Every block built into the tree, program and procedure bodies too.
+    std::vector<Block*> blocks;
+    FlatAST();
+    ~FlatAST();
+    FlatAST(const FlatAST&) = delete;
+    FlatAST& operator=(const FlatAST&) = delete;
+    flat::Ref add(FlatKind kind, uint32_t a, uint32_t b, uint32_t c, int line);
+    flat::Ref constant(DataVal value, int line);
+    // A string constant, allocated in the collector here.
+    flat::Ref stringConstant(std::string_view text, int line);
+    // Stores a run of nodes in lists, returning where it starts.
+    uint32_t list(const std::vector<flat::Ref>& nodes);
+    uint32_t procedureIndex(ProcedureDecl* decl);
+    uint32_t builtinIndex(intern::Id id);
+    uint32_t loop(ProcedureDecl* owner);
+    uint32_t block(Block* block);
+    /*
+     * Moves every node of other, analyzed and built on another thread,
+     * to the end of this tree, leaving other empty.
+     */
+    void append(FlatAST& other);
+    void markRoots(Allocator* allocator) const;
+private:
+    std::unordered_map<ProcedureDecl*, uint32_t> procIndex;
+    std::unordered_map<intern::Id, uint32_t> builtinIdx;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "utils.h"
+#include "Intern.h"
+
+using namespace std;
+
+intern::Id intern::Table::id(string_view word) {
+    auto itr = ids.find(word);
+    if (itr != ids.end()) {
+	return itr->second;
+    }
+    if (names.size() == NONE) {
+	utils::fatalError("Too many distinct identifiers");
+    }
+    Id newId = names.size();
+    names.emplace_back(word);
+    ids.emplace(names.back(), newId);
+    return newId;
+}
+
+intern::Id intern::Table::find(string_view word) const {
+    auto itr = ids.find(word);
+    return itr == ids.end() ? NONE : itr->second;
+}
+
+const string& intern::Table::name(Id id) const {
+    static const string none;
+    return id == NONE ? none : names[id];
+}
+
+size_t intern::Table::size() const {
+    return names.size();
+}
+
+intern::Table& intern::global() {
+    static Table table;
+    return table;
+}
+
+intern::Id intern::id(string_view word) {
+    return global().id(word);
+}
+
+intern::Id intern::find(string_view word) {
+    return global().find(word);
+}
+
+const string& intern::name(Id id) {
+    return global().name(id);
+}
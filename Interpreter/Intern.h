@@ -0,0 +1,51 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/****************************************
+ Intern
+
+ Each identifier spelling is stored once and is otherwise known by a
+ dense 32-bit id, so symbol tables key on integers and comparing names
+ is comparing ids. Identifiers are interned uppercased by the lexer;
+ the table itself is case-sensitive.
+***************************************/
+
+namespace intern {
+    typedef uint32_t Id;
+    // No spelling; names the empty string.
+    const Id NONE = UINT32_MAX;
+
+    class Table {
+    public:
+	Table() = default;
+	Table(const Table&) = delete;
+	Table& operator=(const Table&) = delete;
+	Table(Table&&) = default;
+	// Id of word, interning it if it is new.
+	Id id(std::string_view word);
+	// Id of word, or NONE if it was never interned.
+	Id find(std::string_view word) const;
+	const std::string& name(Id id) const;
+	size_t size() const;
+    private:
+	// A deque never moves its elements, so the map can key on views of
+	// them.
+	std::deque<std::string> names;
+	std::unordered_map<std::string_view, Id> ids;
+    };
+
+    // The program-wide table. It isn't locked; parallel lexing interns
+    // into per-chunk tables and merges them afterwards.
+    Table& global();
+    Id id(std::string_view word);
+    Id find(std::string_view word);
+    const std::string& name(Id id);
+}
+
+#endif
@@ -11,220 +11,282 @@
 #include "Interpreter.h"
 #include "options.h"
 #include "builtins.h"
+#include "Compiler.h"
+#include "VM.h"
+#include "ClosureEngine.h"
+#include "CTranslator.h"
+#include "ProgramCache.h"
 
 using namespace std;
 
-Interpreter::Interpreter(Parser* parser) : parser(parser) {}
+Interpreter::Interpreter(Parser* parser, ProgramCache* cache) : parser(parser), analyzer(parser->flatTree), cache(cache), returning(false), flatTree(parser->flatTree), jit(flatTree, stack, [this](ProcedureDecl* node) { expand(node); }), globals(nullptr) {}
 
-DataVal Interpreter::visit(AST* node) {
-    if (node == nullptr) utils::fatalError(string("Parse tree is null"));
-    switch(node->type()) {
-    case NodeType::binOp: {
-	BinOp binNode = dynamic_cast<BinOp&>(*node);
-	string opType = binNode.op->type;
-	
-	if (opType == ttype::plus) {
-	    return visit(binNode.left) + visit(binNode.right);
-	}
-	else if (opType == ttype::minus) {
-	    return visit(binNode.left) - visit(binNode.right);
-	}
-	else if (opType == ttype::mul) {
-	    return visit(binNode.left) * visit(binNode.right);
+/*
+ * Counts one more run of a procedure or loop, and says whether it has
+ * run often enough for --jit to compile it.
+ */
+static bool isHot(uint32_t& runs) {
+    if (runs < options::jitThreshold) {
+	runs++;
+	return false;
+    }
+    return true;
+}
+
+DataVal Interpreter::eval(flat::Ref node) {
+    // Each case reads only the operands it uses, before evaluating
+    // anything, since a first call may parse more of the program and grow
+    // the arrays.
+    switch (flatTree.kinds[node]) {
+    case FlatKind::NOOP:
+	return DataVal();
+    case FlatKind::CONST:
+	return flatTree.constants[flatTree.a[node]];
+    case FlatKind::VAR:
+	return stack.lookup(flatTree.a[node], flatTree.b[node], flatTree.c[node], flatTree.lines[node]);
+    case FlatKind::ASSIGN: {
+	int depth = flatTree.a[node], slot = flatTree.b[node];
+	stack.assign(depth, slot, eval(flatTree.c[node]));
+	return DataVal();
+    }
+    case FlatKind::BINOP:
+	return evalBinOp((ttype::Kind) flatTree.a[node], flatTree.b[node], flatTree.c[node], flatTree.lines[node]);
+    case FlatKind::UNARY:
+	return evalUnaryOp((ttype::Kind) flatTree.a[node], flatTree.b[node], flatTree.lines[node]);
+    case FlatKind::BLOCK:
+	return eval(flatTree.b[node]);
+    case FlatKind::COMPOUND: {
+	uint32_t first = flatTree.b[node], count = flatTree.c[node];
+	for (uint32_t i = 0; i < count; i++) {
+	    DataVal::allocator.safepoint();
+	    eval(flatTree.lists[first + i]);
+	    if (returning) {
+		break;
+	    }
 	}
-	/*
-	else if (opType == ttype::int_div) {
-	    return (int(visit(binNode.left)) / int(visit(binNode.right)));
+	return DataVal();
+    }
+    case FlatKind::IF: {
+	flat::Ref thenNode = flatTree.b[node], elseNode = flatTree.c[node];
+	// Well isn't this code convenient...
+	DataVal condition = eval(flatTree.a[node]);
+	if (options::showConditions) {
+	    cout << "If Condition result: " << condition.toString() << endl;
 	}
-	*/
-	else if (opType == ttype::float_div) {
-	    return visit(binNode.left) / visit(binNode.right);
+	if (condition.toBool()) {
+	    eval(thenNode);
 	}
-	if (opType == ttype::equals) {
-	    DataVal left = visit(binNode.left);
-	    DataVal right = visit(binNode.right);
-	    if (options::showConditions) {
-		cout << "left: " << left.toString() << " right: " << right.toString() << endl;
-	    }
-	    return DataVal::allocator.allocate(left == right);
+	else if (elseNode != flat::NONE) {
+	    eval(elseNode);
 	}
-	else if (opType == ttype::not_equals) {
-	    DataVal left = visit(binNode.left);
-	    DataVal right = visit(binNode.right);
-	    if (options::showConditions) {
-		cout << "left: " << left.toString() << " right: " << right.toString() << endl;
+	return DataVal();
+    }
+    case FlatKind::WHILE: {
+	flat::Ref condition = flatTree.a[node], body = flatTree.b[node];
+	uint32_t loop = flatTree.c[node];
+	while (eval(condition).toBool()) {
+	    eval(body);
+	    if (returning) {
+		break;
 	    }
-	    return DataVal::allocator.allocate(left != right);
-	}
-	else if (opType == ttype::less_than) {
-	    DataVal left = visit(binNode.left);
-	    DataVal right = visit(binNode.right);
-	    if (options::showConditions) {
-		cout << "left: " << left.toString() << " right: " << right.toString() << endl;
+	    DataVal::allocator.safepoint();
+	    // A hot loop goes on as compiled code from its next iteration,
+	    // rather than waiting for the procedure it is in to be called again.
+	    if (options::jit && isHot(flatTree.loops[loop].iterations) && enterLoop(node, loop)) {
+		break;
 	    }
-	    return DataVal::allocator.allocate(left < right);
 	}
-	else {
-	    utils::fatalError(opType + " on line " + to_string(binNode.line) + " is not a known binary operation");
-	}
-	break;
+	return DataVal();
     }
-    case NodeType::num: {
-	Num num = dynamic_cast<Num&>(*node);
-	return num.value;
-	break;
+    case FlatKind::CALL:
+	return call(flatTree.a[node], flatTree.b[node], flatTree.c[node]);
+    case FlatKind::CALLB:
+	return callBuiltin(flatTree.a[node], flatTree.b[node], flatTree.c[node]);
+    case FlatKind::RETURN:
+	returnVal = eval(flatTree.a[node]);
+	returning = true;
+	return DataVal();
     }
-    case NodeType::stringLiteral: {
-	StringLiteral str = dynamic_cast<StringLiteral&>(*node);
-	return str.value;
+    utils::fatalError("Flat syntax tree node of kind " + to_string((int) flatTree.kinds[node]) + " cannot be evaluated");
+    return DataVal();
+}
+
+DataVal Interpreter::evalBinOp(ttype::Kind opType, flat::Ref leftNode, flat::Ref rightNode, int line) {
+    DataVal left = eval(leftNode);
+    // The right operand may call a procedure, which can reach a safepoint.
+    Allocator::TempRoot leftRoot(&left);
+    DataVal right = eval(rightNode);
+
+    switch (opType) {
+    case ttype::plus:
+	return left + right;
+    case ttype::minus:
+	return left - right;
+    case ttype::mul:
+	return left * right;
+    /*
+    case ttype::int_div:
+	return (int(left) / int(right));
+    */
+    case ttype::float_div:
+	return left / right;
+    default:
 	break;
     }
-    case NodeType::unaryOp: {
-	UnaryOp unaryNode = dynamic_cast<UnaryOp&>(*node);
-	string opType = unaryNode.op->type;
-	DataVal exprResult = visit(unaryNode.expr);
-	if (exprResult.isNumeric()) {
-	    if (opType == ttype::minus) {
-		switch(exprResult.type) {
-		case DataVal::D_INT: {
-		    return DataVal::allocator.allocate(-1 * DATAVAL_GET_VAL(int, exprResult.data));
-		}
-		case DataVal::D_REAL:
-		    return DataVal::allocator.allocate(-1 * DATAVAL_GET_VAL(double, exprResult.data));
-		}
+    if (options::showConditions) {
+	cout << "left: " << left.toString() << " right: " << right.toString() << endl;
+    }
+    switch (opType) {
+    case ttype::equals:
+	return DataVal((int) (left == right));
+    case ttype::not_equals:
+	return DataVal((int) (left != right));
+    case ttype::less_than:
+	return DataVal((int) (left < right));
+    case ttype::greater_than:
+	return DataVal((int) (left > right));
+    case ttype::lt_or_equals:
+	return DataVal((int) (left <= right));
+    case ttype::gt_or_equals:
+	return DataVal((int) (left >= right));
+    default:
+	utils::fatalError(string(ttype::name(opType)) + " on line " + to_string(line) + " is not a known binary operation");
+    }
+    return DataVal();
+}
+
+DataVal Interpreter::evalUnaryOp(ttype::Kind opType, flat::Ref operand, int line) {
+    DataVal exprResult = eval(operand);
+    if (exprResult.isNumeric()) {
+	if (opType == ttype::minus) {
+	    switch(exprResult.type) {
+	    case DataVal::D_INT: {
+		return DataVal(-exprResult.intVal);
+	    }
+	    case DataVal::D_REAL:
+		return DataVal(-exprResult.realVal);
 	    }
 	}
-	else {
-	    utils::fatalError(opType + " on line " + to_string(unaryNode.line) + " is not a known unary operation for value of type " + to_string(exprResult.type));
-	}
-	break;
     }
-    case NodeType::compound: {
-	Compound compoundNode = dynamic_cast<Compound&>(*node);
-	for (AST* child : compoundNode.children) {
-	    visit(child);
-	}
-	break;
+    else {
+	utils::fatalError(string(ttype::name(opType)) + " on line " + to_string(line) + " is not a known unary operation for value of type " + to_string(exprResult.type));
     }
-    case NodeType::none: {
-	break;
+    return DataVal();
+}
+
+DataVal Interpreter::callBuiltin(uint32_t builtinIdx, uint32_t args, uint32_t numParams) {
+    DataVal finalParamVals[numParams];
+    // Arguments evaluated so far must survive safepoints in later ones.
+    Allocator::TempRoot paramRoots(finalParamVals, numParams);
+    for (unsigned int i = 0; i < numParams; i++) {
+	finalParamVals[i] = eval(flatTree.lists[args + i]);
     }
-    case NodeType::assign: {
-	Assign* assignNode = dynamic_cast<Assign*>(node);
-	Var* varNode = dynamic_cast<Var*>(assignNode->left);
-	string varName = varNode->value.strVal;
-	DataVal rvalue = visit(assignNode->right);
-	stack.assign(varName, rvalue, assignNode->line);
-	break;
+    // Run built-in functions by calling the built-in handler.
+    return flatTree.builtins[builtinIdx].fn->fn(&this->stack, vector<DataVal>(finalParamVals, finalParamVals + numParams));
+}
+
+DataVal Interpreter::call(uint32_t procIdx, uint32_t args, uint32_t numParams) {
+    DataVal finalParamVals[numParams];
+    // Arguments evaluated so far must survive safepoints in later ones.
+    Allocator::TempRoot paramRoots(finalParamVals, numParams);
+    for (unsigned int i = 0; i < numParams; i++) {
+	finalParamVals[i] = eval(flatTree.lists[args + i]);
     }
-    case NodeType::var: {
-	Var varNode = dynamic_cast<Var&>(*node);
-	return stack.lookup(varNode.value.strVal, varNode.line);
-	break;
+
+    ProcedureDecl* procDeclNode = flatTree.procedures[procIdx].decl;
+    if (options::jit && isHot(flatTree.procedures[procIdx].calls)) {
+	DataVal result;
+	if (jit.call(procDeclNode, finalParamVals, numParams, result)) {
+	    return result;
+	}
+	// Try again once it has run as many more times.
+	flatTree.procedures[procIdx].calls = 0;
     }
-    case NodeType::program: {
-	Program progNode = dynamic_cast<Program&>(*node);
-	stack.pushFrame(progNode.table);
-	visit(progNode.block);
-	stack.popFrame();
-	break;
+    if (flatTree.procedures[procIdx].body == flat::NONE) {
+	expand(procDeclNode);
+	flatTree.procedures[procIdx].body = procDeclNode->blockNode->body;
     }
-    case NodeType::block: {
-	Block block = dynamic_cast<Block&>(*node);
-	for (AST* decl : block.declarations) {
-	    visit(decl);
-	}
-	visit(block.compoundStatement);
-	break;
+    // Push a new stack frame; the params fill its first slots.
+    stack.pushFrame(procDeclNode->table, finalParamVals, numParams);
+    // Run procedure body.
+    eval(flatTree.procedures[procIdx].body);
+    // Pop stack frame.
+    stack.popFrame();
+    if (returning) {
+	returning = false;
+	return returnVal;
     }
-	
-    case NodeType::varDecl:
-    case NodeType::recordDecl:
-    case NodeType::varType:
-    case NodeType::procedureDecl: break;
-	
-    case NodeType::procedureCall: {
-	ProcedureCall* procCallNode = dynamic_cast<ProcedureCall*>(node);
-	ProcedureDecl* procDeclNode = dynamic_cast<ProcedureDecl*>(procCallNode->procDeclNode);
-	size_t numParams = procCallNode->paramVals->size();
-	Param* paramNode;
-	Var* varNode;
-	DataVal finalParamVals[numParams];
 
-	// Run built-in functions by calling the built-in handler.
-	auto itr = builtin::FUNCTIONS.find(procCallNode->procName);
-	if (itr != builtin::FUNCTIONS.end()) {
+    if (procDeclNode->returnTypeNode != nullptr) {
+	utils::fatalError("Reached end of non-void procedure " + procDeclNode->procName + " without returning a value");
+    }
+    return DataVal();
+}
 
-	    for (unsigned int i = 0; i < numParams; i++) {
-		finalParamVals[i] = visit(procCallNode->paramVals->at(i));
-	    }	    
-	    return itr->second.fn(&this->stack, vector<DataVal>(finalParamVals, finalParamVals + numParams));
-	}
-	
-	// Make an array for each of the formal and actual params.
-	string paramNames[numParams];
-	for (unsigned int i = 0;i<numParams;i++) {
-	    paramNode = dynamic_cast<Param*>(procDeclNode->params->at(i));
-	    varNode = paramNode->varNode;
-	    finalParamVals[i] = visit(procCallNode->paramVals->at(i));
-	    paramNames[i] = varNode->value.strVal;
-	}
-	
-	// Push a new stack frame and assign params.
-	stack.pushFrame(procDeclNode->table, paramNames, finalParamVals, numParams);
-	try {
-	    // Run procedure body.
-	    visit(procDeclNode->blockNode);
-	} catch (DataVal returnVal) {
-	    // Make sure not to free the value we just returned by passing it to the call stack.
-	    stack.popFrame(returnVal.data);
-	    return returnVal;
-	}
-	// Pop stack frame.
-	stack.popFrame();
+bool Interpreter::enterLoop(flat::Ref node, uint32_t loopIdx) {
+    FlatAST::Loop& loop = flatTree.loops[loopIdx];
+    ScopedSymbolTable* table = loop.owner ? loop.owner->table : globals;
+    bool returned = false;
+    if (!jit.enterLoop(node, loop.owner, table, stack.locals(), returned, returnVal)) {
+	// Try again once it has run as many more iterations.
+	loop.iterations = 0;
+	return false;
+    }
+    returning = returned;
+    return true;
+}
 
-	if (procDeclNode->returnTypeNode != nullptr) {
-	    utils::fatalError("Reached end of non-void procedure " + procDeclNode->procName + " without returning a value");
-	}
-	break;
+void Interpreter::expand(ProcedureDecl* node) {
+    if (!node->blockNode) {
+	parser->parseBody(node);
+	analyzer.analyzeBody(node);
     }
+}
 
-    case NodeType::returnStatement: {
-	ReturnStatement* retStatementNode = dynamic_cast<ReturnStatement*>(node);
-	throw this->visit(retStatementNode->expr);
-	break;
+DataVal Interpreter::interpret() {
+    AST* tree = parser->parse();
+    // Unless --lazy-parse is on, every body is built and checked before
+    // the program runs, though the parser may have skipped them to do it
+    // all at once on several threads. That happens once every procedure
+    // is declared, and before the statements that call them.
+    if (!options::lazyParse) {
+	analyzer.afterDeclarations = [this] {
+	    parser->parseBodies([this](ProcedureDecl* node, FlatAST& bodies, ostream& out) {
+		SemanticAnalyzer bodyAnalyzer(&analyzer, bodies, out);
+		bodyAnalyzer.analyzeBody(node);
+	    });
+	};
     }
-    case NodeType::ifStatement: {
-	IfStatement* ifStatementNode = dynamic_cast<IfStatement*>(node);
-	// Well isn't this code convenient...
-	DataVal condition = visit(ifStatementNode->conditionNode);
-	if (options::showConditions) {
-	    cout << "If Condition result: " << condition.toString() << endl;
-	}
-	if (condition.toBool()) {
-	    visit(ifStatementNode->blockNode);
-	}
-	else if (ifStatementNode->elseBranch) {
-	    visit(ifStatementNode->elseBranch);
+    analyzer.visit(tree);
+    // Translating the program replaces running it.
+    if (!options::emitC.empty() || !options::nativeBinary.empty()) {
+	CTranslator translator(flatTree, [this](ProcedureDecl* node) { expand(node); });
+	string source = !options::emitC.empty() ? options::emitC : options::nativeBinary + ".cpp";
+	translator.write(tree, source);
+	if (!options::nativeBinary.empty()) {
+	    CTranslator::compile(source, options::nativeBinary);
 	}
-	break;
+	return DataVal();
     }
-    case NodeType::whileStatement: {
-	WhileStatement* whileStatementNode = dynamic_cast<WhileStatement*>(node);
-	while (visit(whileStatementNode->conditionNode).toBool()) {
-	    visit(whileStatementNode->blockNode);
+    if (options::engine == options::ENGINE_VM) {
+	Compiler compiler(flatTree, [this](ProcedureDecl* node) { expand(node); });
+	Module* module = compiler.compile(tree);
+	if (cache) {
+	    // The cached program won't have the tree to load bodies from.
+	    compiler.loadAll();
+	    cache->store(*module);
 	}
-	break;
+	VM vm(module);
+	return vm.run();
     }
-    default:
-	utils::fatalError(string("Syntax tree node of type-index ") + to_string(node->type()) + string(" cannot be visited"));
+    if (options::engine == options::ENGINE_CLOSURE) {
+	ClosureEngine engine(flatTree, [this](ProcedureDecl* node) { expand(node); });
+	return engine.run(tree);
     }
+    Program* progNode = static_cast<Program*>(tree);
+    globals = progNode->table;
+    stack.pushFrame(progNode->table);
+    eval(progNode->block->body);
+    stack.popFrame();
     return DataVal();
 }
-
-DataVal Interpreter::interpret() {
-    AST* tree = parser->parse();
-    SemanticAnalyzer analyzer;
-    analyzer.visit(tree);
-    return visit(tree);
-}
@@ -1,21 +1,50 @@
-
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
 #include "DataVal.h"
 #include "CallStack.h"
 #include "Parser.h"
+#include "SemanticAnalyzer.h"
+#include "FlatAST.h"
+#include "Jit.h"
 
+class ProgramCache;
 
 class Interpreter {
 public:
     Parser* parser;
-    Interpreter(Parser* parser);
-    DataVal visit(AST* node);
+    // With a cache, the compiled program is stored there before it runs.
+    Interpreter(Parser* parser, ProgramCache* cache = nullptr);
     DataVal interpret();
 private:
     void error(const std::string& msg, int line=-1);
     CallStack stack;
+    SemanticAnalyzer analyzer;
+    ProgramCache* cache;
+    // Builds and analyzes a procedure body that was skipped by the parser.
+    void expand(ProcedureDecl* node);
+    /*
+     * Set by a return statement. Statements stop running their children
+     * once it is set, until the enclosing procedure call picks up
+     * returnVal and clears it.
+     */
+    bool returning;
+    DataVal returnVal;
+    // The parser's flat tree, which program and procedure bodies run from.
+    FlatAST& flatTree;
+    DataVal eval(flat::Ref node);
+    DataVal evalBinOp(ttype::Kind opType, flat::Ref left, flat::Ref right, int line);
+    DataVal evalUnaryOp(ttype::Kind opType, flat::Ref operand, int line);
+    DataVal call(uint32_t procIdx, uint32_t args, uint32_t numParams);
+    DataVal callBuiltin(uint32_t builtinIdx, uint32_t args, uint32_t numParams);
+    /*
+     * Runs the procedures and loops it can compile, with --jit, once the
+     * interpreter has run them enough times to be worth compiling.
+     */
+    Jit jit;
+    // The frame of the main program's loops.
+    ScopedSymbolTable* globals;
+    bool enterLoop(flat::Ref node, uint32_t loopIdx);
 };
 
 
@@ -0,0 +1,986 @@
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Jit.h"
+#include "builtins.h"
+#include "constants.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define JIT_X86
+#endif
+
+using namespace std;
+
+/****************************************
+ Run-time helpers, called from compiled code
+***************************************/
+
+static void jitStackOverflow() {
+    utils::fatalError("Stack error: call stack max depth exceeded; stack overflow");
+}
+
+static void jitMissingReturn(ProcedureDecl* decl) {
+    utils::fatalError("Reached end of non-void procedure " + decl->procName + " without returning a value");
+}
+
+// Returns the payload of the result, which compiled code reads as its type.
+static uint64_t jitCallBuiltin(const builtin::Fn* fn, CallStack* stack, const DataVal* args, size_t numArgs) {
+    DataVal result = fn->fn(stack, vector<DataVal>(args, args + numArgs));
+    uint64_t raw;
+    memcpy(&raw, &result, sizeof(raw));
+    return raw;
+}
+
+/****************************************
+ Checking
+***************************************/
+
+static bool isComparison(ttype::Kind opType) {
+    switch (opType) {
+    case ttype::equals:
+    case ttype::not_equals:
+    case ttype::less_than:
+    case ttype::greater_than:
+    case ttype::lt_or_equals:
+    case ttype::gt_or_equals:
+	return true;
+    default:
+	return false;
+    }
+}
+
+static bool isArithmetic(ttype::Kind opType) {
+    return opType == ttype::plus || opType == ttype::minus || opType == ttype::mul || opType == ttype::float_div;
+}
+
+static bool isStringConstant(const FlatAST& flatTree, flat::Ref node) {
+    return flatTree.kinds[node] == FlatKind::CONST && flatTree.constants[flatTree.a[node]].type == DataVal::D_STRING;
+}
+
+/*
+ * Decides whether a procedure body can be compiled, and records what its
+ * compiled code needs to know: the type of each frame slot and the
+ * procedures it calls. Types come from declarations, since values of a
+ * declared INTEGER or REAL variable can't have any other type; a
+ * comparison is the one expression whose value has a type other than the
+ * one the semantic analyzer gives it, so its value is never used.
+ */
+class JitChecker {
+public:
+    JitChecker(Jit& jit, Jit::Procedure* proc) : jit(jit), flatTree(jit.flatTree), proc(proc) {}
+    bool run();
+    bool runLoop();
+    static Jit::Kind kindOf(Symbol* type);
+    static Jit::Kind kindOf(Type* typeNode);
+private:
+    Jit& jit;
+    const FlatAST& flatTree;
+    Jit::Procedure* proc;
+    // Which locals are sure to hold a value at this point of the body.
+    vector<bool> assigned;
+    bool statement(flat::Ref node);
+    bool condition(flat::Ref node);
+    Jit::Kind expr(flat::Ref node);
+    bool call(flat::Ref node, Jit::Kind& result);
+    bool callBuiltin(flat::Ref node, Jit::Kind& result);
+};
+
+Jit::Kind JitChecker::kindOf(Symbol* type) {
+    if (!type) {
+	return Jit::NONE;
+    }
+    if (type->id == GET_BUILT_IN_SYMBOL(INT)->id) {
+	return Jit::INT;
+    }
+    if (type->id == GET_BUILT_IN_SYMBOL(REAL)->id) {
+	return Jit::REAL;
+    }
+    return Jit::NONE;
+}
+
+Jit::Kind JitChecker::kindOf(Type* typeNode) {
+    if (typeNode->id == GET_BUILT_IN_SYMBOL(INT)->id) {
+	return Jit::INT;
+    }
+    if (typeNode->id == GET_BUILT_IN_SYMBOL(REAL)->id) {
+	return Jit::REAL;
+    }
+    return Jit::NONE;
+}
+
+bool JitChecker::run() {
+    ProcedureDecl* decl = proc->decl;
+    proc->numParams = decl->params->size();
+    proc->result = Jit::NONE;
+    if (decl->returnTypeNode && (proc->result = kindOf(decl->returnTypeNode)) == Jit::NONE) {
+	return false;
+    }
+    for (VarSymbol* symbol : decl->table->slotSymbols) {
+	Jit::Kind kind = kindOf(symbol->type);
+	if (kind == Jit::NONE) {
+	    return false;
+	}
+	proc->slots.push_back(kind);
+    }
+    assigned.assign(proc->slots.size(), false);
+    fill(assigned.begin(), assigned.begin() + proc->numParams, true);
+    // Declarations have no effect at run time.
+    return statement(decl->blockNode->body);
+}
+
+/*
+ * A loop starts out with whatever its frame held when it was compiled,
+ * and returning from it returns from the procedure it is in.
+ */
+bool JitChecker::runLoop() {
+    ProcedureDecl* decl = proc->decl;
+    proc->numParams = 0;
+    proc->result = decl && decl->returnTypeNode ? kindOf(decl->returnTypeNode) : Jit::NONE;
+    for (VarSymbol* symbol : proc->table->slotSymbols) {
+	proc->slots.push_back(kindOf(symbol->type));
+    }
+    assigned = proc->assigned;
+    return statement(proc->loop);
+}
+
+bool JitChecker::statement(flat::Ref node) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::NOOP:
+	return true;
+    case FlatKind::BLOCK:
+	return statement(flatTree.b[node]);
+    case FlatKind::COMPOUND:
+	for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	    if (!statement(flatTree.lists[flatTree.b[node] + i])) {
+		return false;
+	    }
+	}
+	return true;
+    case FlatKind::ASSIGN: {
+	uint32_t slot = flatTree.b[node];
+	Jit::Kind kind = flatTree.a[node] == 0 ? proc->slots[slot] : Jit::NONE;
+	if (kind == Jit::NONE || expr(flatTree.c[node]) != kind) {
+	    return false;
+	}
+	assigned[slot] = true;
+	return true;
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB: {
+	Jit::Kind result;
+	return call(node, result);
+    }
+    case FlatKind::IF: {
+	if (!condition(flatTree.a[node])) {
+	    return false;
+	}
+	vector<bool> before = assigned;
+	if (!statement(flatTree.b[node])) {
+	    return false;
+	}
+	if (flatTree.c[node] == flat::NONE) {
+	    assigned = before;
+	    return true;
+	}
+	vector<bool> afterThen = assigned;
+	assigned = before;
+	if (!statement(flatTree.c[node])) {
+	    return false;
+	}
+	for (size_t i = 0; i < assigned.size(); i++) {
+	    assigned[i] = assigned[i] && afterThen[i];
+	}
+	return true;
+    }
+    case FlatKind::WHILE: {
+	if (!condition(flatTree.a[node])) {
+	    return false;
+	}
+	// The body may not run at all.
+	vector<bool> before = assigned;
+	if (!statement(flatTree.b[node])) {
+	    return false;
+	}
+	assigned = before;
+	return true;
+    }
+    case FlatKind::RETURN:
+	return proc->result != Jit::NONE && expr(flatTree.a[node]) == proc->result;
+    default:
+	return false;
+    }
+}
+
+bool JitChecker::condition(flat::Ref node) {
+    if (flatTree.kinds[node] == FlatKind::BINOP && isComparison((ttype::Kind) flatTree.a[node])) {
+	Jit::Kind left = expr(flatTree.b[node]);
+	return left != Jit::NONE && expr(flatTree.c[node]) == left;
+    }
+    return expr(node) != Jit::NONE;
+}
+
+Jit::Kind JitChecker::expr(flat::Ref node) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::CONST:
+	return flatTree.constants[flatTree.a[node]].type == DataVal::D_REAL ? Jit::REAL : Jit::NONE;
+    case FlatKind::VAR: {
+	uint32_t slot = flatTree.b[node];
+	if (flatTree.a[node] != 0 || !assigned[slot]) {
+	    return Jit::NONE;
+	}
+	return proc->slots[slot];
+    }
+    case FlatKind::BINOP: {
+	if (!isArithmetic((ttype::Kind) flatTree.a[node])) {
+	    return Jit::NONE;
+	}
+	Jit::Kind left = expr(flatTree.b[node]);
+	if (left == Jit::NONE || expr(flatTree.c[node]) != left) {
+	    return Jit::NONE;
+	}
+	return left;
+    }
+    case FlatKind::UNARY:
+	// Unary plus has no value in the interpreter.
+	return flatTree.a[node] == ttype::minus ? expr(flatTree.b[node]) : Jit::NONE;
+    case FlatKind::CALL:
+    case FlatKind::CALLB: {
+	Jit::Kind result;
+	return call(node, result) ? result : Jit::NONE;
+    }
+    default:
+	return Jit::NONE;
+    }
+}
+
+bool JitChecker::call(flat::Ref node, Jit::Kind& result) {
+    if (flatTree.kinds[node] == FlatKind::CALLB) {
+	return callBuiltin(node, result);
+    }
+    ProcedureDecl* decl = flatTree.procedures[flatTree.a[node]].decl;
+    uint32_t args = flatTree.b[node];
+    for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	Jit::Kind param = kindOf((*decl->params)[i]->typeNode);
+	if (param == Jit::NONE || expr(flatTree.lists[args + i]) != param) {
+	    return false;
+	}
+    }
+    result = decl->returnTypeNode ? kindOf(decl->returnTypeNode) : Jit::NONE;
+    proc->callees.push_back(jit.procedureFor(decl));
+    return true;
+}
+
+bool JitChecker::callBuiltin(flat::Ref node, Jit::Kind& result) {
+    const FlatAST::Builtin& callee = flatTree.builtins[flatTree.a[node]];
+    // These two work on the frames of the call stack, which compiled
+    // code doesn't have.
+    if (callee.id == builtin::PANIC_ID || callee.id == builtin::BIND_ID) {
+	return false;
+    }
+    uint32_t args = flatTree.b[node];
+    for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	flat::Ref arg = flatTree.lists[args + i];
+	if (!isStringConstant(flatTree, arg) && expr(arg) == Jit::NONE) {
+	    return false;
+	}
+    }
+    result = kindOf(callee.fn->returnType);
+    return true;
+}
+
+/****************************************
+ Code generation
+***************************************/
+
+#ifdef JIT_X86
+
+namespace {
+
+    enum Reg { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7 };
+    enum Cond { B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, BE = 0x6, A = 0x7, P = 0xA, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF };
+
+    /*
+     * Just the x86-64 encodings the code generator uses. Memory operands
+     * are always [base + disp32], and only the low eight registers are
+     * used, so nothing needs a REX prefix other than REX.W.
+     */
+    class Assembler {
+    public:
+	vector<uint8_t> code;
+	void byte(uint8_t b) { code.push_back(b); }
+	void bytes(initializer_list<uint8_t> bs) { code.insert(code.end(), bs); }
+	void imm32(int32_t v) { uint8_t b[4]; memcpy(b, &v, 4); code.insert(code.end(), b, b + 4); }
+	void imm64(uint64_t v) { uint8_t b[8]; memcpy(b, &v, 8); code.insert(code.end(), b, b + 8); }
+	void mem(int reg, Reg base, int32_t disp) {
+	    byte(0x80 | (reg << 3) | base);
+	    if (base == RSP) {
+		byte(0x24);
+	    }
+	    imm32(disp);
+	}
+	void regs(int reg, int rm) { byte(0xC0 | (reg << 3) | rm); }
+
+	// movsd, addsd, subsd, mulsd and divsd
+	void sse(uint8_t op, int xmm, Reg base, int32_t disp) { bytes({ 0xF2, 0x0F, op }); mem(xmm, base, disp); }
+	void sseRegs(uint8_t op, int dst, int src) { bytes({ 0xF2, 0x0F, op }); regs(dst, src); }
+	void storeSd(Reg base, int32_t disp, int xmm) { sse(0x11, xmm, base, disp); }
+	void movqToXmm(int xmm, Reg reg) { bytes({ 0x66, 0x48, 0x0F, 0x6E }); regs(xmm, reg); }
+	void movqFromXmm(Reg reg, int xmm) { bytes({ 0x66, 0x48, 0x0F, 0x7E }); regs(xmm, reg); }
+	void movapd(int dst, int src) { bytes({ 0x66, 0x0F, 0x28 }); regs(dst, src); }
+	void ucomisd(int a, int b) { bytes({ 0x66, 0x0F, 0x2E }); regs(a, b); }
+	void xorpd(int dst, int src) { bytes({ 0x66, 0x0F, 0x57 }); regs(dst, src); }
+
+	// 32-bit loads, stores and arithmetic with a memory operand
+	void op32(uint8_t op, Reg reg, Reg base, int32_t disp) { byte(op); mem(reg, base, disp); }
+	void load32(Reg reg, Reg base, int32_t disp) { op32(0x8B, reg, base, disp); }
+	void store32(Reg base, int32_t disp, Reg reg) { op32(0x89, reg, base, disp); }
+	void storeImm32(Reg base, int32_t disp, int32_t v) { byte(0xC7); mem(0, base, disp); imm32(v); }
+	void load64(Reg reg, Reg base, int32_t disp) { byte(0x48); op32(0x8B, reg, base, disp); }
+	void store64(Reg base, int32_t disp, Reg reg) { byte(0x48); op32(0x89, reg, base, disp); }
+	void lea(Reg reg, Reg base, int32_t disp) { byte(0x48); op32(0x8D, reg, base, disp); }
+	void movImm64(Reg reg, uint64_t v) { bytes({ 0x48, (uint8_t) (0xB8 + reg) }); imm64(v); }
+	void movImm32(Reg reg, int32_t v) { byte(0xB8 + reg); imm32(v); }
+	void callAt(const void* target) { movImm64(RAX, (uint64_t) target); bytes({ 0xFF, 0xD0 }); }
+	void callThrough(void* const* cell) { movImm64(RAX, (uint64_t) cell); bytes({ 0xFF, 0x10 }); }
+
+	size_t newLabel() {
+	    labels.push_back(-1);
+	    return labels.size() - 1;
+	}
+	void bind(size_t label) { labels[label] = code.size(); }
+	void jmp(size_t label) { byte(0xE9); fixup(label); }
+	void jcc(Cond cond, size_t label) { bytes({ 0x0F, (uint8_t) (0x80 + cond) }); fixup(label); }
+	// Fills in every jump once all labels are bound.
+	void link() {
+	    for (auto& jump : jumps) {
+		int32_t rel = labels[jump.second] - (jump.first + 4);
+		memcpy(&code[jump.first], &rel, 4);
+	    }
+	    jumps.clear();
+	}
+    private:
+	vector<int64_t> labels;
+	vector<pair<size_t, size_t> > jumps;
+	void fixup(size_t label) {
+	    jumps.push_back({ code.size(), label });
+	    imm32(0);
+	}
+    };
+
+}
+
+/*
+ * Emits one procedure. An expression leaves its value in xmm0 if REAL or
+ * eax if INTEGER. Parameters and locals live at fixed offsets below rbp;
+ * below them are temporaries, addressed from rsp, where pending operands
+ * are held across calls and where the arguments of a call are laid out
+ * in order. Compiled procedures take a pointer to their arguments and
+ * return their result in rax, as the host compiler's calling convention
+ * would, so the interpreter can call them like C functions.
+ *
+ * A compiled loop instead takes a pointer to the DataVal slots of its
+ * frame, keeps it in rbx, and reads and writes the slots there, type and
+ * all. It returns 0 in eax when the loop ends, or 1 when it returns from
+ * its procedure, with the value in the JIT's loopResult.
+ */
+class JitEmitter {
+public:
+    JitEmitter(Jit& jit, Assembler& as) : jit(jit), flatTree(jit.flatTree), as(as) {}
+    void procedure(Jit::Procedure* proc);
+    void loop(Jit::Procedure* proc);
+private:
+    Jit& jit;
+    const FlatAST& flatTree;
+    Assembler& as;
+    Jit::Procedure* proc;
+    // Where the locals are: rbp for a procedure, rbx for a loop.
+    Reg frame;
+    int temps;
+    size_t epilogue;
+    int32_t local(int slot) const { return frame == RBP ? -8 * (slot + 1) : (int32_t) sizeof(DataVal) * slot; }
+    int32_t temp(int idx) {
+	temps = max(temps, idx + 1);
+	return 8 * idx;
+    }
+    void statement(flat::Ref node, int top);
+    void jumpUnless(flat::Ref node, int top, size_t label);
+    Jit::Kind expr(flat::Ref node, int top);
+    Jit::Kind binOp(flat::Ref node, int top);
+    void operand(Jit::Kind kind, flat::Ref node, int top);
+    void constant(Reg reg, int xmm, flat::Ref node);
+    Jit::Kind call(flat::Ref node, int top);
+    Jit::Kind callBuiltin(flat::Ref node, int top);
+};
+
+void JitEmitter::procedure(Jit::Procedure* proc) {
+    this->proc = proc;
+    frame = RBP;
+    temps = 0;
+    epilogue = as.newLabel();
+    size_t overflow = as.newLabel();
+    as.bytes({ 0x55, 0x48, 0x89, 0xE5 });	// push rbp; mov rbp, rsp
+    as.bytes({ 0x48, 0x81, 0xEC });		// sub rsp, frame size
+    size_t frameSize = as.code.size();
+    as.imm32(0);
+    // Count the frame as the call stack would, and overflow where it
+    // would.
+    as.movImm64(RAX, (uint64_t) &jit.depth);
+    as.bytes({ 0x81, 0x38 });			// cmp dword [rax], max depth
+    as.imm32(CALL_STACK_MAX_DEPTH);
+    as.jcc(G, overflow);
+    as.bytes({ 0xFF, 0x00 });			// inc dword [rax]
+    for (size_t i = 0; i < proc->numParams; i++) {
+	as.load64(RAX, RDI, 8 * i);
+	as.store64(RBP, local(i), RAX);
+    }
+    statement(proc->decl->blockNode->body, 0);
+    if (proc->result != Jit::NONE) {
+	as.movImm64(RDI, (uint64_t) proc->decl);
+	as.callAt((void*) &jitMissingReturn);
+    }
+    as.bind(epilogue);
+    as.movImm64(RCX, (uint64_t) &jit.depth);
+    as.bytes({ 0xFF, 0x09 });			// dec dword [rcx]
+    as.bytes({ 0xC9, 0xC3 });			// leave; ret
+    as.bind(overflow);
+    as.callAt((void*) &jitStackOverflow);
+    as.link();
+    // Keeps rsp 16-byte aligned for calls.
+    int32_t bytes = (8 * (proc->slots.size() + temps) + 15) & ~15;
+    memcpy(&as.code[frameSize], &bytes, 4);
+}
+
+void JitEmitter::loop(Jit::Procedure* proc) {
+    this->proc = proc;
+    frame = RBX;
+    temps = 0;
+    epilogue = as.newLabel();
+    as.bytes({ 0x55, 0x48, 0x89, 0xE5 });	// push rbp; mov rbp, rsp
+    as.byte(0x53);				// push rbx
+    as.bytes({ 0x48, 0x81, 0xEC });		// sub rsp, frame size
+    size_t frameSize = as.code.size();
+    as.imm32(0);
+    as.bytes({ 0x48, 0x89, 0xFB });		// mov rbx, rdi
+    statement(proc->loop, 0);
+    as.bytes({ 0x31, 0xC0 });			// xor eax, eax
+    as.bind(epilogue);
+    as.load64(RBX, RBP, -8);
+    as.bytes({ 0xC9, 0xC3 });			// leave; ret
+    as.link();
+    // With rbx pushed as well, keeps rsp 16-byte aligned for calls.
+    int32_t bytes = ((8 * temps + 8 + 15) & ~15) - 8;
+    memcpy(&as.code[frameSize], &bytes, 4);
+}
+
+void JitEmitter::statement(flat::Ref node, int top) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::BLOCK:
+	statement(flatTree.b[node], top);
+	break;
+    case FlatKind::COMPOUND:
+	for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	    statement(flatTree.lists[flatTree.b[node] + i], top);
+	}
+	break;
+    case FlatKind::ASSIGN: {
+	int slot = flatTree.b[node];
+	Jit::Kind kind = expr(flatTree.c[node], top);
+	if (kind == Jit::REAL) {
+	    as.storeSd(frame, local(slot), 0);
+	}
+	else {
+	    as.store32(frame, local(slot), RAX);
+	}
+	if (frame == RBX) {
+	    as.storeImm32(RBX, local(slot) + 8, kind == Jit::REAL ? DataVal::D_REAL : DataVal::D_INT);
+	    as.storeImm32(RBX, local(slot) + 12, 0);
+	}
+	break;
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	call(node, top);
+	break;
+    case FlatKind::IF: {
+	size_t elseLabel = as.newLabel();
+	jumpUnless(flatTree.a[node], top, elseLabel);
+	statement(flatTree.b[node], top);
+	if (flatTree.c[node] != flat::NONE) {
+	    size_t end = as.newLabel();
+	    as.jmp(end);
+	    as.bind(elseLabel);
+	    statement(flatTree.c[node], top);
+	    as.bind(end);
+	}
+	else {
+	    as.bind(elseLabel);
+	}
+	break;
+    }
+    case FlatKind::WHILE: {
+	size_t loop = as.newLabel(), end = as.newLabel();
+	as.bind(loop);
+	jumpUnless(flatTree.a[node], top, end);
+	statement(flatTree.b[node], top);
+	as.jmp(loop);
+	as.bind(end);
+	break;
+    }
+    case FlatKind::RETURN:
+	if (expr(flatTree.a[node], top) == Jit::REAL) {
+	    as.movqFromXmm(RAX, 0);
+	}
+	if (proc->loop != flat::NONE) {
+	    as.movImm64(RCX, (uint64_t) &jit.loopResult);
+	    as.store64(RCX, 0, RAX);
+	    as.movImm32(RAX, 1);
+	}
+	as.jmp(epilogue);
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+ * Comparisons of REALs are unordered when either side is NaN, which must
+ * come out false like the C++ comparison the interpreter makes, so each
+ * is arranged to test the carry and zero flags in the way that sends the
+ * unordered case to the false side.
+ */
+void JitEmitter::jumpUnless(flat::Ref node, int top, size_t label) {
+    ttype::Kind opType = (ttype::Kind) flatTree.a[node];
+    if (flatTree.kinds[node] != FlatKind::BINOP || !isComparison(opType)) {
+	// Anything else is true unless it is zero.
+	if (expr(node, top) == Jit::REAL) {
+	    size_t skip = as.newLabel();
+	    as.xorpd(1, 1);
+	    as.ucomisd(0, 1);
+	    as.jcc(P, skip);
+	    as.jcc(E, label);
+	    as.bind(skip);
+	}
+	else {
+	    as.bytes({ 0x85, 0xC0 });		// test eax, eax
+	    as.jcc(E, label);
+	}
+	return;
+    }
+    Jit::Kind kind = expr(flatTree.b[node], top);
+    operand(kind, flatTree.c[node], top);
+    if (kind == Jit::INT) {
+	as.bytes({ 0x39, 0xC8 });		// cmp eax, ecx
+	switch (opType) {
+	case ttype::equals: as.jcc(NE, label); break;
+	case ttype::not_equals: as.jcc(E, label); break;
+	case ttype::less_than: as.jcc(GE, label); break;
+	case ttype::greater_than: as.jcc(LE, label); break;
+	case ttype::lt_or_equals: as.jcc(G, label); break;
+	default: as.jcc(L, label); break;
+	}
+	return;
+    }
+    switch (opType) {
+    case ttype::equals:
+	as.ucomisd(0, 1);
+	as.jcc(P, label);
+	as.jcc(NE, label);
+	break;
+    case ttype::not_equals: {
+	size_t skip = as.newLabel();
+	as.ucomisd(0, 1);
+	as.jcc(P, skip);
+	as.jcc(E, label);
+	as.bind(skip);
+	break;
+    }
+    case ttype::less_than:
+	as.ucomisd(1, 0);
+	as.jcc(BE, label);
+	break;
+    case ttype::greater_than:
+	as.ucomisd(0, 1);
+	as.jcc(BE, label);
+	break;
+    case ttype::lt_or_equals:
+	as.ucomisd(1, 0);
+	as.jcc(B, label);
+	break;
+    default:
+	as.ucomisd(0, 1);
+	as.jcc(B, label);
+	break;
+    }
+}
+
+// Loads a REAL constant into an xmm register, through reg.
+void JitEmitter::constant(Reg reg, int xmm, flat::Ref node) {
+    uint64_t bits;
+    memcpy(&bits, &flatTree.constants[flatTree.a[node]].realVal, sizeof(bits));
+    as.movImm64(reg, bits);
+    as.movqToXmm(xmm, reg);
+}
+
+Jit::Kind JitEmitter::expr(flat::Ref node, int top) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::CONST:
+	constant(RAX, 0, node);
+	return Jit::REAL;
+    case FlatKind::VAR: {
+	int slot = flatTree.b[node];
+	if (proc->slots[slot] == Jit::REAL) {
+	    as.sse(0x10, 0, frame, local(slot));
+	}
+	else {
+	    as.load32(RAX, frame, local(slot));
+	}
+	return proc->slots[slot];
+    }
+    case FlatKind::BINOP:
+	return binOp(node, top);
+    case FlatKind::UNARY: {
+	Jit::Kind kind = expr(flatTree.b[node], top);
+	if (kind == Jit::REAL) {
+	    as.movImm64(RAX, 0x8000000000000000ull);
+	    as.movqToXmm(1, RAX);
+	    as.xorpd(0, 1);
+	}
+	else {
+	    as.bytes({ 0xF7, 0xD8 });		// neg eax
+	}
+	return kind;
+    }
+    case FlatKind::CALL:
+    case FlatKind::CALLB:
+	return call(node, top);
+    default:
+	return Jit::NONE;
+    }
+}
+
+/*
+ * Puts the right operand of a binary operation in xmm1 or ecx, keeping
+ * the left one in xmm0 or eax. Variables and constants are loaded
+ * straight in; anything else is evaluated with the left operand held in
+ * a temporary.
+ */
+void JitEmitter::operand(Jit::Kind kind, flat::Ref node, int top) {
+    if (flatTree.kinds[node] == FlatKind::VAR) {
+	int32_t offset = local(flatTree.b[node]);
+	if (kind == Jit::REAL) {
+	    as.sse(0x10, 1, frame, offset);
+	}
+	else {
+	    as.load32(RCX, frame, offset);
+	}
+	return;
+    }
+    if (flatTree.kinds[node] == FlatKind::CONST) {
+	constant(RAX, 1, node);
+	return;
+    }
+    int32_t held = temp(top);
+    if (kind == Jit::REAL) {
+	as.storeSd(RSP, held, 0);
+	expr(node, top + 1);
+	as.movapd(1, 0);
+	as.sse(0x10, 0, RSP, held);
+    }
+    else {
+	as.store32(RSP, held, RAX);
+	expr(node, top + 1);
+	as.bytes({ 0x89, 0xC1 });		// mov ecx, eax
+	as.load32(RAX, RSP, held);
+    }
+}
+
+Jit::Kind JitEmitter::binOp(flat::Ref node, int top) {
+    Jit::Kind kind = expr(flatTree.b[node], top);
+    operand(kind, flatTree.c[node], top);
+    ttype::Kind opType = (ttype::Kind) flatTree.a[node];
+    if (kind == Jit::REAL) {
+	uint8_t op = opType == ttype::plus ? 0x58 : opType == ttype::minus ? 0x5C : opType == ttype::mul ? 0x59 : 0x5E;
+	as.sseRegs(op, 0, 1);
+	return kind;
+    }
+    switch (opType) {
+    case ttype::plus:
+	as.bytes({ 0x01, 0xC8 });		// add eax, ecx
+	break;
+    case ttype::minus:
+	as.bytes({ 0x29, 0xC8 });		// sub eax, ecx
+	break;
+    case ttype::mul:
+	as.bytes({ 0x0F, 0xAF, 0xC1 });		// imul eax, ecx
+	break;
+    default:
+	as.bytes({ 0x99, 0xF7, 0xF9 });		// cdq; idiv ecx
+	break;
+    }
+    return kind;
+}
+
+Jit::Kind JitEmitter::call(flat::Ref node, int top) {
+    if (flatTree.kinds[node] == FlatKind::CALLB) {
+	return callBuiltin(node, top);
+    }
+    uint32_t args = flatTree.b[node];
+    for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	int32_t offset = temp(top + i);
+	if (expr(flatTree.lists[args + i], top + i + 1) == Jit::REAL) {
+	    as.storeSd(RSP, offset, 0);
+	}
+	else {
+	    as.store32(RSP, offset, RAX);
+	}
+    }
+    as.lea(RDI, RSP, 8 * top);
+    Jit::Procedure* callee = jit.procedureFor(flatTree.procedures[flatTree.a[node]].decl);
+    as.callThrough(&callee->entry);
+    if (callee->result == Jit::REAL) {
+	as.movqToXmm(0, RAX);
+    }
+    return callee->result;
+}
+
+// Built-ins take their arguments as DataVals, two temporaries each.
+Jit::Kind JitEmitter::callBuiltin(flat::Ref node, int top) {
+    const builtin::Fn* fn = flatTree.builtins[flatTree.a[node]].fn;
+    uint32_t args = flatTree.b[node], numArgs = flatTree.c[node];
+    int rest = top + 2 * numArgs;
+    for (uint32_t i = 0; i < numArgs; i++) {
+	flat::Ref arg = flatTree.lists[args + i];
+	temp(top + 2 * i + 1);
+	int32_t offset = temp(top + 2 * i);
+	if (isStringConstant(flatTree, arg)) {
+	    const DataVal& value = flatTree.constants[flatTree.a[arg]];
+	    as.movImm64(RAX, (uint64_t) value.data);
+	    as.store64(RSP, offset, RAX);
+	    as.storeImm32(RSP, offset + 8, value.type);
+	    as.storeImm32(RSP, offset + 12, value.listIdx);
+	    continue;
+	}
+	if (expr(arg, rest) == Jit::REAL) {
+	    as.storeSd(RSP, offset, 0);
+	    as.storeImm32(RSP, offset + 8, DataVal::D_REAL);
+	}
+	else {
+	    as.store32(RSP, offset, RAX);
+	    as.storeImm32(RSP, offset + 8, DataVal::D_INT);
+	}
+	as.storeImm32(RSP, offset + 12, 0);
+    }
+    as.movImm64(RDI, (uint64_t) fn);
+    as.movImm64(RSI, (uint64_t) &jit.stack);
+    as.lea(RDX, RSP, 8 * top);
+    as.movImm32(RCX, numArgs);
+    as.callAt((void*) &jitCallBuiltin);
+    Jit::Kind kind = JitChecker::kindOf(fn->returnType);
+    if (kind == Jit::REAL) {
+	as.movqToXmm(0, RAX);
+    }
+    return kind;
+}
+
+#endif
+
+/****************************************
+ JIT
+***************************************/
+
+Jit::Jit(FlatAST& flatTree, CallStack& stack, function<void(ProcedureDecl*)> expand) : flatTree(flatTree), stack(stack), expand(expand), depth(0), loopResult(0) {
+}
+
+Jit::~Jit() {
+    for (auto& page : pages) {
+	munmap(page.first, page.second);
+    }
+}
+
+Jit::Procedure* Jit::procedureFor(ProcedureDecl* decl) {
+    auto itr = procIndex.find(decl);
+    if (itr != procIndex.end()) {
+	return itr->second;
+    }
+    procedures.push_back({ decl, flat::NONE, nullptr, Procedure::UNSEEN, nullptr, NONE, {}, 0, {}, {} });
+    procIndex[decl] = &procedures.back();
+    return &procedures.back();
+}
+
+bool Jit::check(Procedure* proc) {
+    JitChecker checker(*this, proc);
+    if (proc->loop != flat::NONE) {
+	return checker.runLoop();
+    }
+    expand(proc->decl);
+    proc->table = proc->decl->table;
+    return checker.run();
+}
+
+/*
+ * Compiles root along with every procedure it may end up calling, since
+ * compiled code only calls compiled code. A procedure that fails the
+ * check fails everything that calls it, which may take a few passes
+ * through recursive calls.
+ */
+bool Jit::compile(Procedure* root) {
+    if (root->state != Procedure::UNSEEN) {
+	return root->state == Procedure::COMPILED;
+    }
+    vector<Procedure*> reached = { root };
+    root->state = check(root) ? Procedure::CHECKED : Procedure::FAILED;
+    for (size_t i = 0; i < reached.size(); i++) {
+	if (reached[i]->state != Procedure::CHECKED) {
+	    continue;
+	}
+	for (Procedure* callee : reached[i]->callees) {
+	    if (callee->state == Procedure::UNSEEN) {
+		callee->state = check(callee) ? Procedure::CHECKED : Procedure::FAILED;
+		reached.push_back(callee);
+	    }
+	}
+    }
+    for (bool changed = true; changed;) {
+	changed = false;
+	for (Procedure* proc : reached) {
+	    if (proc->state != Procedure::CHECKED) {
+		continue;
+	    }
+	    for (Procedure* callee : proc->callees) {
+		if (callee->state == Procedure::FAILED) {
+		    proc->state = Procedure::FAILED;
+		    changed = true;
+		    break;
+		}
+	    }
+	}
+    }
+    vector<Procedure*> batch;
+    for (Procedure* proc : reached) {
+	if (proc->state == Procedure::CHECKED) {
+	    batch.push_back(proc);
+	}
+    }
+    emit(batch);
+    return root->state == Procedure::COMPILED;
+}
+
+void Jit::emit(const vector<Procedure*>& batch) {
+    if (batch.empty()) {
+	return;
+    }
+#ifdef JIT_X86
+    Assembler as;
+    vector<size_t> offsets;
+    JitEmitter emitter(*this, as);
+    for (Procedure* proc : batch) {
+	offsets.push_back(as.code.size());
+	if (proc->loop != flat::NONE) {
+	    emitter.loop(proc);
+	}
+	else {
+	    emitter.procedure(proc);
+	}
+    }
+    // The code is written and then made executable, never both at once.
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t bytes = (as.code.size() + pageSize - 1) / pageSize * pageSize;
+    void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+	memcpy(mem, as.code.data(), as.code.size());
+	if (mprotect(mem, bytes, PROT_READ | PROT_EXEC) == 0) {
+	    pages.push_back({ mem, bytes });
+	    for (size_t i = 0; i < batch.size(); i++) {
+		batch[i]->entry = (char*) mem + offsets[i];
+		batch[i]->state = Procedure::COMPILED;
+	    }
+	    return;
+	}
+	munmap(mem, bytes);
+    }
+#endif
+    // Without a way to run the code, everything stays interpreted.
+    for (Procedure* proc : batch) {
+	proc->state = Procedure::FAILED;
+    }
+}
+
+bool Jit::call(ProcedureDecl* decl, const DataVal* args, size_t numArgs, DataVal& result) {
+    // Both of these print from inside the interpreter's frames.
+    if (options::dumpVars || options::showConditions) {
+	return false;
+    }
+    Procedure* proc = procedureFor(decl);
+    if (!compile(proc)) {
+	return false;
+    }
+    uint64_t params[numArgs + 1];
+    for (size_t i = 0; i < numArgs; i++) {
+	if (proc->slots[i] == REAL) {
+	    if (args[i].type != DataVal::D_REAL) {
+		return false;
+	    }
+	    memcpy(&params[i], &args[i].realVal, sizeof(double));
+	}
+	else {
+	    if (args[i].type != DataVal::D_INT) {
+		return false;
+	    }
+	    params[i] = (uint32_t) args[i].intVal;
+	}
+    }
+    depth = stack.depth();
+    uint64_t raw = ((uint64_t (*)(const uint64_t*)) proc->entry)(params);
+    result = value(proc->result, raw);
+    return true;
+}
+
+bool Jit::enterLoop(flat::Ref loop, ProcedureDecl* owner, ScopedSymbolTable* table, DataVal* slots, bool& returned, DataVal& result) {
+    if (options::dumpVars || options::showConditions) {
+	return false;
+    }
+    auto itr = loopIndex.find(loop);
+    Procedure* proc;
+    if (itr != loopIndex.end()) {
+	proc = itr->second;
+    }
+    else {
+	procedures.push_back({ owner, loop, table, Procedure::UNSEEN, nullptr, NONE, {}, 0, {}, {} });
+	proc = &procedures.back();
+	loopIndex[loop] = proc;
+	// The code is made for what the frame holds now.
+	for (size_t i = 0; i < table->slotSymbols.size(); i++) {
+	    Kind kind = JitChecker::kindOf(table->slotSymbols[i]->type);
+	    proc->assigned.push_back((kind == INT && slots[i].type == DataVal::D_INT) || (kind == REAL && slots[i].type == DataVal::D_REAL));
+	}
+    }
+    if (!compile(proc)) {
+	return false;
+    }
+    // It may be entered again later, from a frame that holds less.
+    for (size_t i = 0; i < proc->assigned.size(); i++) {
+	if (proc->assigned[i] && slots[i].type != (proc->slots[i] == REAL ? DataVal::D_REAL : DataVal::D_INT)) {
+	    return false;
+	}
+    }
+    depth = stack.depth();
+    returned = ((int (*)(DataVal*)) proc->entry)(slots);
+    if (returned) {
+	result = value(proc->result, loopResult);
+    }
+    return true;
+}
+
+DataVal Jit::value(Kind kind, uint64_t raw) {
+    switch (kind) {
+    case REAL: {
+	double val;
+	memcpy(&val, &raw, sizeof(val));
+	return DataVal(val);
+    }
+    case INT:
+	return DataVal((int) (uint32_t) raw);
+    default:
+	return DataVal();
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "ASTNodes.h"
+#include "CallStack.h"
+
+/****************************************
+ JIT
+
+ Compiles numeric procedures to x86-64 machine code for the tree walker.
+ A procedure qualifies when its parameters, locals and result are all
+ INTEGER or REAL, it only reads variables of its own frame once they are
+ surely assigned, comparisons only appear as conditions, and everything
+ it calls qualifies too (or is a built-in that leaves the call stack
+ alone). Compiled code keeps values in registers and in its native stack
+ frame, with no DataVal or CallStack involved, and calls other compiled
+ procedures directly. Anything else is left to the interpreter.
+
+ A while loop can also be compiled on its own, under the same rules, for
+ on-stack replacement: a loop the interpreter has been running for a
+ while continues as compiled code from its next iteration, working on
+ the slots of the interpreter's frame in place. Variables of the frame
+ that the loop doesn't use may have any type.
+***************************************/
+
+class Jit {
+public:
+    /*
+     * expand is called to parse and analyze the body of a procedure that
+     * was declared without one, before it is compiled.
+     */
+    Jit(FlatAST& flatTree, CallStack& stack, std::function<void(ProcedureDecl*)> expand);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+    /*
+     * Runs a call to decl as compiled code, compiling it on its first
+     * call. Returns false, having run nothing, when the procedure can't be
+     * compiled or the arguments aren't of its parameter types.
+     */
+    bool call(ProcedureDecl* decl, const DataVal* args, size_t numArgs, DataVal& result);
+    /*
+     * Runs the rest of a loop of owner (or of the main program, with no
+     * owner) as compiled code, on slots, the frame of the given scope it is
+     * running in. Returns false, having run nothing, when the loop can't be
+     * compiled or the frame doesn't hold what its code expects. Otherwise
+     * the loop has finished, or returned from owner if returned is set.
+     */
+    bool enterLoop(flat::Ref loop, ProcedureDecl* owner, ScopedSymbolTable* table, DataVal* slots, bool& returned, DataVal& result);
+private:
+    enum Kind { NONE, INT, REAL };
+    /*
+     * A unit of compiled code: a procedure, or with a loop, just that
+     * loop of decl's body (or of the main program, with no decl).
+     */
+    struct Procedure {
+	ProcedureDecl* decl;
+	// The WHILE node, or NONE for a procedure.
+	flat::Ref loop;
+	ScopedSymbolTable* table;
+	enum { UNSEEN, CHECKED, FAILED, COMPILED } state;
+	// Where compiled callers find the code, even before it exists.
+	void* entry;
+	Kind result;
+	std::vector<Kind> slots;
+	size_t numParams;
+	std::vector<Procedure*> callees;
+	// For a loop, the slots that held a value of their type when it was
+	// compiled, which its code may read before assigning them.
+	std::vector<bool> assigned;
+    };
+    FlatAST& flatTree;
+    CallStack& stack;
+    std::function<void(ProcedureDecl*)> expand;
+    std::deque<Procedure> procedures;
+    std::unordered_map<ProcedureDecl*, Procedure*> procIndex;
+    std::unordered_map<flat::Ref, Procedure*> loopIndex;
+    // Frames of compiled code, counted as if they were on the call stack.
+    int depth;
+    // Where a compiled loop leaves the value it returns.
+    uint64_t loopResult;
+    // Executable mappings, with their sizes.
+    std::vector<std::pair<void*, size_t> > pages;
+
+    Procedure* procedureFor(ProcedureDecl* decl);
+    static DataVal value(Kind kind, uint64_t raw);
+    bool compile(Procedure* root);
+    bool check(Procedure* proc);
+    void emit(const std::vector<Procedure*>& batch);
+    friend class JitChecker;
+    friend class JitEmitter;
+};
+
+#endif
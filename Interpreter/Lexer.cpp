@@ -1,62 +1,388 @@
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include "utils.h"
 #include "Lexer.h"
+#include "Scan.h"
 
 using namespace std;
 
-Lexer::Lexer(string input) {
-    this->input = input;
-    pos = 0;
-    line = 1;
-    currentChar = input[pos];
+/*
+ * Reserved keywords, looked up through a perfect hash of each word's length
+ * and first and last characters. The table is built at compile time; if a
+ * new keyword collides, the build fails and the hash needs new constants.
+ */
+struct Keyword {
+    const char* word;
+    size_t length;
+    ttype::Kind kind;
+};
+
+static constexpr Keyword KEYWORDS[] = {
+    { "BEGIN", 5, ttype::begin },
+    { "END", 3, ttype::end },
+    { "PROGRAM", 7, ttype::program },
+    { "VAR", 3, ttype::var },
+    { "DIV", 3, ttype::int_div },
+    { "INTEGER", 7, ttype::integer },
+    { "REAL", 4, ttype::real },
+    { "PROCEDURE", 9, ttype::procedure },
+    { "WHILE", 5, ttype::twhile },
+    { "IF", 2, ttype::tif },
+    { "THEN", 4, ttype::then },
+    { "ELSE", 4, ttype::telse },
+    { "DO", 2, ttype::tdo },
+    { "STRING", 6, ttype::string },
+    { "RECORD", 6, ttype::record },
+    { "TYPE", 4, ttype::type },
+    { "RETURN", 6, ttype::ret },
+};
+static constexpr size_t NUM_KEYWORDS = sizeof(KEYWORDS) / sizeof(KEYWORDS[0]);
+static constexpr size_t KEYWORD_SLOTS = 32;
+
+static constexpr unsigned char upper(char c) {
+    return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+}
+
+// Identifiers are case-insensitive, so the hash is too.
+static constexpr size_t keywordHash(const char* word, size_t length) {
+    return (length + 6 * (upper(word[0]) + upper(word[length - 1]))) % KEYWORD_SLOTS;
+}
+
+struct KeywordTable {
+    // Index into KEYWORDS, or -1 for an empty slot.
+    int slots[KEYWORD_SLOTS];
+    bool perfect;
+};
+
+static constexpr KeywordTable buildKeywordTable() {
+    KeywordTable table = {};
+    table.perfect = true;
+    for (size_t i = 0; i < KEYWORD_SLOTS; i++) {
+	table.slots[i] = -1;
+    }
+    for (size_t i = 0; i < NUM_KEYWORDS; i++) {
+	size_t slot = keywordHash(KEYWORDS[i].word, KEYWORDS[i].length);
+	if (table.slots[slot] != -1) {
+	    table.perfect = false;
+	}
+	table.slots[slot] = i;
+    }
+    return table;
+}
+
+static constexpr KeywordTable KEYWORD_TABLE = buildKeywordTable();
+static_assert(KEYWORD_TABLE.perfect, "keyword hash has a collision");
+
+// Index into KEYWORDS, or -1 if the word isn't reserved.
+static int keywordIndex(string_view word) {
+    if (word.empty()) {
+	return -1;
+    }
+    int idx = KEYWORD_TABLE.slots[keywordHash(word.data(), word.size())];
+    if (idx < 0 || KEYWORDS[idx].length != word.size()) {
+	return -1;
+    }
+    for (size_t i = 0; i < word.size(); i++) {
+	if (upper(word[i]) != KEYWORDS[idx].word[i]) {
+	    return -1;
+	}
+    }
+    return idx;
+}
+
+ttype::Kind Lexer::keywordKind(string_view word) {
+    int idx = keywordIndex(word);
+    return idx < 0 ? ttype::id : KEYWORDS[idx].kind;
+}
+
+// Keywords are interned once, globally, the first time any is lexed.
+static intern::Id keywordId(int idx) {
+    static const vector<intern::Id> ids = [] {
+	vector<intern::Id> result;
+	for (const Keyword& keyword : KEYWORDS) {
+	    result.push_back(intern::id(keyword.word));
+	}
+	return result;
+    }();
+    return ids[idx];
+}
+
+SourceFile::SourceFile(const string& fileName, bool mapped) : fd(-1), data(nullptr), size(0) {
+    if (fileName == "-") {
+	fd = STDIN_FILENO;
+	return;
+    }
+    fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+	utils::fatalError("Could not open source file \"" + fileName + "\"");
+    }
+    if (!mapped) {
+	return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+	utils::fatalError("Could not read source file \"" + fileName + "\"");
+    }
+    size = st.st_size;
+    if (size > 0) {
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) {
+	    utils::fatalError("Could not map source file \"" + fileName + "\"");
+	}
+	data = static_cast<const char*>(mapping);
+    }
+    // The mapping stays valid once the descriptor is closed.
+    close(fd);
+    fd = -1;
+}
+
+SourceFile::~SourceFile() {
+    if (data) {
+	munmap(const_cast<char*>(data), size);
+    }
+    if (fd > STDIN_FILENO) {
+	close(fd);
+    }
+}
+
+bool SourceFile::isMapped() const {
+    return fd < 0;
+}
+
+string_view SourceFile::contents() const {
+    return string_view(data, size);
+}
+
+int SourceFile::descriptor() const {
+    return fd;
+}
+
+Lexer::Lexer(string_view input) : input(input), pos(0), line(1), fd(-1), tokenStart(0), textNext(0), lookupOnly(false), deferErrors(false), nextToken(0) {
+    names = &intern::global();
+    currentChar = input.empty() ? 0 : input[pos];
+}
+
+Lexer::Lexer(int fd, size_t windowSize) : pos(0), line(1), fd(fd), window(windowSize), tokenStart(0), textNext(0), lookupOnly(false), deferErrors(false), nextToken(0) {
+    names = &intern::global();
+    refill();
+    currentChar = input.empty() ? 0 : input[pos];
+}
+
+Lexer::Lexer(string_view input, unsigned threads) : Lexer(input) {
+    lexChunks(threads);
+}
+
+Lexer::Lexer(const Lexer& source, const Mark& from, const Mark& to) : Lexer(source.input.substr(0, to.pos)) {
+    names = source.names;
+    lookupOnly = true;
+    if (source.buffered()) {
+	tokens.assign(source.tokens.begin() + from.nextToken, source.tokens.begin() + to.nextToken);
+	tokens.push_back({ ttype::eof, to.line, string_view(), 0 });
+    }
+    seek({ from.pos, from.line, 0 });
 }
 
 void Lexer::error(char ch) {
-    utils::fatalError(string("Invalid character at line " + to_string(line) + ": ") + "\'" + ch + "\'");
+    fail(string("Invalid character at line " + to_string(line) + ": ") + "\'" + ch + "\'");
+}
+
+void Lexer::fail(const string& msg) {
+    if (!deferErrors) {
+	utils::fatalError(msg);
+    }
+    if (deferredError.empty()) {
+	deferredError = msg;
+    }
+    // Stop lexing; the caller sees the end of the chunk next.
+    currentChar = 0;
+}
+
+bool Lexer::buffered() const {
+    return !tokens.empty() || !deferredError.empty();
+}
+
+/*
+ * Reads more of a streamed source into the window, dropping everything
+ * before the current token (or before pos, between tokens). Returns false
+ * at the end of the source, or when the whole source is already in memory.
+ */
+bool Lexer::refill() {
+    if (fd < 0) {
+	return false;
+    }
+    size_t keep = min<size_t>(tokenStart, pos);
+    size_t live = input.length() - keep;
+    memmove(window.data(), window.data() + keep, live);
+    pos -= keep;
+    tokenStart -= keep;
+    // A single token larger than half the window grows it.
+    if (live > window.size() / 2) {
+	window.resize(window.size() * 2);
+    }
+    ssize_t got;
+    do {
+	got = read(fd, window.data() + live, window.size() - live);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) {
+	utils::fatalError(string("Could not read source: ") + strerror(errno));
+    }
+    input = string_view(window.data(), live + got);
+    return got > 0;
+}
+
+/*
+ * Called with pos at the end of the window: refills it and loads
+ * currentChar the way advance() would.
+ */
+bool Lexer::fetch() {
+    if (!refill()) {
+	return false;
+    }
+    currentChar = input[pos];
+    if (currentChar == '\n' || currentChar == '\r') line++;
+    return true;
 }
 
 void Lexer::advance() {
     pos++;
-    if (pos > input.length() - 1) currentChar = 0;
-    else currentChar = input[pos];
+    if (pos >= input.length()) {
+	if (!fetch()) currentChar = 0;
+	return;
+    }
+    currentChar = input[pos];
     if (currentChar == '\n' || currentChar == '\r') line++;
 }
 
+/*
+ * Moves straight to newPos, counting lines the same way a run of
+ * advance() calls would.
+ */
+void Lexer::jumpTo(size_t newPos) {
+    if (newPos <= pos) {
+	return;
+    }
+    const char* base = input.data();
+    size_t countEnd = newPos < input.length() ? newPos + 1 : input.length();
+    line += scan::countNewlines(base + pos + 1, base + countEnd);
+    pos = newPos;
+    currentChar = pos < input.length() ? input[pos] : 0;
+}
+
+/*
+ * Each scan below runs to the end of its run, refilling the window and
+ * carrying on if the run reaches the end of it.
+ */
 void Lexer::skipWhiteSpace() {
-    while (currentChar != 0 &&
-	   (currentChar == ' '
-	    || currentChar == '\n'
-	    || currentChar == '\t'
-	    || currentChar == '\r')) {
-        advance();
+    while (currentChar != 0) {
+	const char* base = input.data();
+	jumpTo(scan::skipSpace(base + pos, base + input.length()) - base);
+	tokenStart = pos;
+	if (pos < input.length() || !fetch()) {
+	    break;
+	}
     }
 }
 
 void Lexer::skipComment() {
-    while (currentChar != '}') {
-        advance();
+    while (true) {
+	const char* base = input.data();
+	jumpTo(scan::find(base + pos, base + input.length(), '}', '}') - base);
+	if (pos < input.length()) {
+	    break;
+	}
+	tokenStart = pos;
+	if (!fetch()) {
+	    fail("Unterminated comment at end of file");
+	    return;
+	}
     }
     advance();
 }
 
-Token* Lexer::number() {
-    string res = "";
+Token Lexer::makeToken(ttype::Kind type, size_t start, size_t length) {
+    string_view text = input.substr(start, length);
+    if (fd >= 0) {
+	// The window will move on; keep a copy the parser can still read.
+	string& copy = textRing[textNext];
+	textNext = (textNext + 1) % TEXT_RING;
+	copy.assign(text.data(), text.size());
+	text = copy;
+    }
+    return { type, line, text, 0 };
+}
+
+/*
+ * Punctuation tokens spell themselves, so their text never points into
+ * the source.
+ */
+static string_view spelling(ttype::Kind type) {
+    switch (type) {
+    case ttype::assign: return ":=";
+    case ttype::colon: return ":";
+    case ttype::semi: return ";";
+    case ttype::dot: return ".";
+    case ttype::comma: return ",";
+    case ttype::plus: return "+";
+    case ttype::arrow: return "->";
+    case ttype::minus: return "-";
+    case ttype::mul: return "*";
+    case ttype::float_div: return "/";
+    case ttype::lparen: return "(";
+    case ttype::rparen: return ")";
+    case ttype::equals: return "=";
+    case ttype::not_equals: return "!=";
+    case ttype::bang: return "!";
+    case ttype::lt_or_equals: return "<=";
+    case ttype::less_than: return "<";
+    case ttype::gt_or_equals: return ">=";
+    case ttype::greater_than: return ">";
+    default: return "";
+    }
+}
+
+Token Lexer::makeToken(ttype::Kind type) {
+    return { type, line, spelling(type), 0 };
+}
+
+Token Lexer::number() {
+    tokenStart = pos;
+    ttype::Kind type = ttype::int_const;
     while (currentChar != 0 && isdigit(currentChar)) {
-        res += currentChar;
         advance();
     }
     if (currentChar == '.') {
-        res += currentChar;
         advance();
         while (currentChar != 0 && isdigit(currentChar)) {
-            res += currentChar;
             advance();
         }
-        return new Token(ttype::real_const, utils::toDouble(res), line);
+        type = ttype::real_const;
+    }
+    Token token = makeToken(type, tokenStart, pos - tokenStart);
+    auto result = from_chars(token.text.data(), token.text.data() + token.text.size(), token.numVal);
+    if (result.ec != errc()) {
+	fail("Invalid number \"" + string(token.text) + "\" on line " + to_string(line));
     }
-    return new Token(ttype::int_const, utils::toDouble(res), line);
+    return token;
 }
 
-Token* Lexer::getNextToken() {
+Token Lexer::getNextToken() {
+    if (buffered()) {
+	if (nextToken == tokens.size()) {
+	    utils::fatalError(deferredError);
+	}
+	const Token& token = tokens[nextToken];
+	if (token.type != ttype::eof) {
+	    nextToken++;
+	}
+	line = token.line;
+	return token;
+    }
     while (currentChar != 0) {
         if (currentChar == ' ' || currentChar == '\n') {
             skipWhiteSpace();
@@ -76,134 +402,353 @@ Token* Lexer::getNextToken() {
         if (isalpha(currentChar)) {
             return id();
         }
-        if (currentChar == ':' && peek() == '=') {
-            advance();
-            advance();
-            return new Token(ttype::assign, ":=", line);
-        }
-        if (currentChar == ':') {
-            advance();
-            return new Token(ttype::colon, ':', line);
-        }
-        if (currentChar == ';') {
-            advance();
-            return new Token(ttype::semi, ';', line);
-        }
-        if (currentChar == '.') {
+        ttype::Kind type;
+        switch (currentChar) {
+        case ':':
+            if (peek() == '=') {
+                advance();
+                type = ttype::assign;
+            }
+            else {
+                type = ttype::colon;
+            }
+            break;
+        case ';':
+            type = ttype::semi;
+            break;
+        case '.': {
 	    char next = peek();
 	    if (next != '\0' && isdigit(next)) {
 		return number();
 	    }
-	    advance();
-            return new Token(ttype::dot, '.', line);
-        }
-        if (currentChar == ',') {
-            advance();
-            return new Token(ttype::comma, ',', line);
-        }
-        if (currentChar == '+') {
-            advance();
-            return new Token(ttype::plus, '+', line);
-        }
-	if (currentChar == '-' && peek() == '>') {
-	    advance();
-	    advance();
-	    return new Token(ttype::arrow, "->", line);
-	}
-        if (currentChar == '-') {
-            advance();
-            return new Token(ttype::minus, '-', line);
-        }
-        if (currentChar == '*') {
-            advance();
-            return new Token(ttype::mul, '*', line);
-        }
-        if (currentChar == '/') {
-            advance();
-            return new Token(ttype::float_div, '/', line);
-        }
-        if (currentChar == '(') {
-            advance();
-            return new Token(ttype::lparen, '(', line);
-        }
-        if (currentChar == ')') {
-            advance();
-            return new Token(ttype::rparen, ')', line);
-        }
-        if (currentChar == '=') {
-            advance();
-            return new Token(ttype::equals, '=', line);
+            type = ttype::dot;
+            break;
         }
-        if (currentChar == '!') {
+        case ',':
+            type = ttype::comma;
+            break;
+        case '+':
+            type = ttype::plus;
+            break;
+        case '-':
+	    if (peek() == '>') {
+		advance();
+		type = ttype::arrow;
+	    }
+	    else {
+		type = ttype::minus;
+	    }
+            break;
+        case '*':
+            type = ttype::mul;
+            break;
+        case '/':
+            type = ttype::float_div;
+            break;
+        case '(':
+            type = ttype::lparen;
+            break;
+        case ')':
+            type = ttype::rparen;
+            break;
+        case '=':
+            type = ttype::equals;
+            break;
+        case '!':
             if (peek() == '=') {
                 advance();
-                advance();
-                return new Token(ttype::not_equals, "!=", line);
+                type = ttype::not_equals;
             }
             else {
-                advance();
-                return new Token(ttype::bang, '!', line);
+                type = ttype::bang;
             }
-        }
-        if (currentChar == '<') {
+            break;
+        case '<':
             if (peek() == '=') {
                 advance();
-                advance();
-                return new Token(ttype::lt_or_equals, "<=", line);
+                type = ttype::lt_or_equals;
             }
             else {
-                advance();
-                return new Token(ttype::less_than, '<', line);
+                type = ttype::less_than;
             }
-        }
-        if (currentChar == '>') {
+            break;
+        case '>':
             if (peek() == '=') {
                 advance();
-                advance();
-                return new Token(ttype::gt_or_equals, ">=", line);
+                type = ttype::gt_or_equals;
             }
             else {
-                advance();
-                return new Token(ttype::greater_than, '>', line);
+                type = ttype::greater_than;
             }
+            break;
+        default:
+            error(currentChar);
+            continue;
         }
-        error(currentChar);
+        advance();
+        return makeToken(type);
+    }
+    return makeToken(ttype::eof);
+}
+
+bool Lexer::lparenFollows() {
+    if (buffered()) {
+	if (nextToken == tokens.size()) {
+	    return false;
+	}
+	line = tokens[nextToken].line;
+	return tokens[nextToken].type == ttype::lparen;
     }
-    return new Token(ttype::eof, '\0', line);
+    skipWhiteSpace();
+    return currentChar == '(';
+}
+
+bool Lexer::canSeek() const {
+    return fd < 0;
+}
+
+Lexer::Mark Lexer::mark() const {
+    return { pos, line, nextToken };
+}
+
+void Lexer::seek(const Mark& mark) {
+    pos = mark.pos;
+    line = mark.line;
+    nextToken = mark.nextToken;
+    currentChar = pos < input.length() ? input[pos] : 0;
 }
 
 char Lexer::peek() {
-    return (pos + 1) > input.length() - 1 ? '\0' : input[pos + 1];
+    if (pos + 1 >= input.length() && !refill()) {
+	return '\0';
+    }
+    return input[pos + 1];
 }
 
-Token* Lexer::id() {
+Token Lexer::id() {
     //handles identifiers and reserved keywords
-    string result = "";
-    while(currentChar != '\0' && (isalnum(currentChar) || currentChar == '_')) {
-        result += toupper(currentChar);
-        advance();
+    tokenStart = pos;
+    while (true) {
+	const char* base = input.data();
+	jumpTo(scan::skipIdent(base + pos, base + input.length()) - base);
+	if (pos < input.length() || !fetch()) {
+	    break;
+	}
     }
-    unordered_map<string, Token*>::const_iterator iter = RESERVED_KEYWORDS.find(result);
-    if (iter != RESERVED_KEYWORDS.end()) {
-        iter->second->line = line;
-        return iter->second;
+    Token token = makeToken(ttype::id, tokenStart, pos - tokenStart);
+    int keyword = keywordIndex(token.text);
+    if (keyword >= 0) {
+	token.type = KEYWORDS[keyword].kind;
+	token.id = keywordId(keyword);
+	return token;
     }
-    else {
-        return new Token(ttype::id, result, line);
+    upperWord.assign(token.text);
+    for (char& c : upperWord) {
+	c = upper(c);
     }
+    token.id = lookupOnly ? names->find(upperWord) : names->id(upperWord);
+    return token;
 }
 
-Token* Lexer::stringLiteral() {
-    //handles identifiers and reserved keywords
+Token Lexer::stringLiteral() {
+    //handles string literals; the token's text excludes the quotes
     advance();
-    string result = "";
-    while(currentChar != '\0') {
-        if (currentChar == '"') {
-            advance();
-            break;
-        }
-        result += currentChar;
-        advance();
+    tokenStart = pos;
+    while (currentChar != '\0') {
+	const char* base = input.data();
+	jumpTo(scan::find(base + pos, base + input.length(), '"', '\0') - base);
+	if (pos < input.length() || !fetch()) {
+	    break;
+	}
+    }
+    Token token = makeToken(ttype::string_literal, tokenStart, pos - tokenStart);
+    if (currentChar == '"') {
+	advance();
+    }
+    token.line = line;
+    return token;
+}
+
+/****************************************
+ Parallel lexing
+***************************************/
+
+/*
+ * What a chunk boundary falls inside. Only a boundary in code, between
+ * tokens, lets the chunk after it be lexed on its own.
+ */
+enum ChunkState { IN_CODE, IN_COMMENT, IN_STRING, AT_END, NUM_CHUNK_STATES };
+
+struct SourceChunk {
+    size_t start;
+    size_t end;
+    // Newlines the lexer counts from just after start up to end inclusive.
+    size_t newlines;
+    // State at the end of the chunk for each state it might start in.
+    ChunkState exits[NUM_CHUNK_STATES];
+    int firstLine;
+    vector<Token> tokens;
+    // Identifiers of this chunk, until they are merged into the global
+    // table.
+    intern::Table names;
+    string error;
+};
+
+/*
+ * Follows only comment and string delimiters from p to end, starting in
+ * the given state. A NUL outside a comment ends the source for the lexer,
+ * so it does here too.
+ */
+static ChunkState scanState(const char* p, const char* end, ChunkState state) {
+    while (p < end) {
+	switch (state) {
+	case IN_CODE: {
+	    const char* open = scan::find(p, end, '{', '"');
+	    if (memchr(p, '\0', open - p)) {
+		return AT_END;
+	    }
+	    if (open == end) {
+		return IN_CODE;
+	    }
+	    state = *open == '{' ? IN_COMMENT : IN_STRING;
+	    p = open + 1;
+	    break;
+	}
+	case IN_COMMENT:
+	    p = scan::find(p, end, '}', '}');
+	    if (p == end) {
+		return IN_COMMENT;
+	    }
+	    state = IN_CODE;
+	    p++;
+	    break;
+	case IN_STRING:
+	    p = scan::find(p, end, '"', '\0');
+	    if (p == end) {
+		return IN_STRING;
+	    }
+	    state = *p == '"' ? IN_CODE : AT_END;
+	    p++;
+	    break;
+	default:
+	    return state;
+	}
+    }
+    return state;
+}
+
+/*
+ * Cuts the source into roughly equal chunks at line starts, works out
+ * speculatively where each chunk would end up for every state it could
+ * start in, and then walks the chunks in order to learn their real start
+ * states. Chunks that start inside a comment or string are folded into
+ * the one before, and the rest are lexed concurrently, each starting from
+ * its true line number. The token streams are then joined in order.
+ */
+void Lexer::lexChunks(unsigned threads) {
+    size_t length = input.length();
+    size_t count = min<size_t>(threads, length / MIN_CHUNK);
+    if (count <= 1) {
+	return;
+    }
+    const char* base = input.data();
+    vector<SourceChunk> chunks(1);
+    chunks[0].start = 0;
+    for (size_t i = 1; i < count; i++) {
+	size_t target = i * length / count;
+	const char* newline = static_cast<const char*>(memchr(base + target, '\n', length - target));
+	if (!newline) {
+	    break;
+	}
+	size_t start = newline - base + 1;
+	if (start >= length || start <= chunks.back().start) {
+	    continue;
+	}
+	chunks.back().end = start;
+	chunks.emplace_back();
+	chunks.back().start = start;
+    }
+    chunks.back().end = length;
+    if (chunks.size() == 1) {
+	return;
+    }
+
+    utils::inParallel(chunks.size(), [&](size_t i) {
+	SourceChunk& chunk = chunks[i];
+	const char* end = base + chunk.end;
+	chunk.newlines = scan::countNewlines(base + chunk.start + 1, min(end + 1, base + length));
+	for (int state = IN_CODE; state < AT_END; state++) {
+	    chunk.exits[state] = scanState(base + chunk.start, end, (ChunkState) state);
+	}
+    });
+
+    vector<SourceChunk*> jobs;
+    ChunkState state = IN_CODE;
+    int firstLine = 1;
+    for (SourceChunk& chunk : chunks) {
+	if (state == AT_END) {
+	    break;
+	}
+	if (state == IN_CODE) {
+	    chunk.firstLine = firstLine;
+	    jobs.push_back(&chunk);
+	}
+	else {
+	    jobs.back()->end = chunk.end;
+	}
+	firstLine += chunk.newlines;
+	state = chunk.exits[state];
+    }
+
+    utils::inParallel(jobs.size(), [&](size_t i) {
+	SourceChunk& chunk = *jobs[i];
+	Lexer lexer(input.substr(chunk.start, chunk.end - chunk.start));
+	lexer.line = chunk.firstLine;
+	lexer.deferErrors = true;
+	lexer.names = &chunk.names;
+	while (true) {
+	    Token token = lexer.getNextToken();
+	    if (!lexer.deferredError.empty()) {
+		chunk.error = lexer.deferredError;
+		break;
+	    }
+	    chunk.tokens.push_back(token);
+	    if (token.type == ttype::eof) {
+		break;
+	    }
+	}
+    });
+
+    // Identifier ids are local to each chunk until they are merged here,
+    // in chunk order.
+    vector<vector<intern::Id>> globalIds(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+	const intern::Table& chunkNames = jobs[i]->names;
+	for (intern::Id id = 0; id < chunkNames.size(); id++) {
+	    globalIds[i].push_back(intern::id(chunkNames.name(id)));
+	}
+    }
+    utils::inParallel(jobs.size(), [&](size_t i) {
+	for (Token& token : jobs[i]->tokens) {
+	    if (token.type == ttype::id) {
+		token.id = globalIds[i][token.id];
+	    }
+	}
+    });
+
+    // Each chunk ends in its own EOF; only the last one's is kept.
+    size_t total = 0;
+    for (SourceChunk* chunk : jobs) {
+	total += chunk->tokens.size();
+    }
+    tokens.reserve(total);
+    for (SourceChunk* chunk : jobs) {
+	bool last = chunk == jobs.back() || !chunk->error.empty();
+	tokens.insert(tokens.end(), chunk->tokens.begin(), chunk->tokens.end() - (last ? 0 : 1));
+	if (!chunk->error.empty()) {
+	    deferredError = chunk->error;
+	    break;
+	}
+	vector<Token>().swap(chunk->tokens);
     }
-    return new Token(ttype::string_literal, result, line);
 }
@@ -1,44 +1,116 @@
-#include <unordered_map>
+#include <string_view>
+#include <vector>
 #include "Token.h"
 
+/*
+ * A source file, either mapped read-only into memory or left open to be
+ * streamed through the lexer. "-" names standard input, which is always
+ * streamed. In mapped mode tokens point into the mapping, so it must
+ * outlive everything built from them.
+ */
+class SourceFile {
+public:
+    SourceFile(const std::string& fileName, bool mapped = true);
+    ~SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+    bool isMapped() const;
+    std::string_view contents() const;
+    int descriptor() const;
+private:
+    int fd;
+    const char* data;
+    size_t size;
+};
+
 /*
  * Lexer class definition
  */
 
 class Lexer {
 public:
-    std::string input;
+    static const size_t DEFAULT_WINDOW = 64 * 1024;
+    // Smallest slice of a source worth handing to its own thread.
+    static const size_t MIN_CHUNK = 64 * 1024;
+    // Bytes of the source currently in memory; the whole source unless
+    // streaming.
+    std::string_view input;
     unsigned int pos;
     int line;
     char currentChar;
-    Lexer(std::string input);
+    Lexer(std::string_view input);
+    // Streams the source from fd through a refillable window.
+    Lexer(int fd, size_t windowSize = DEFAULT_WINDOW);
+    /*
+     * Lexes the whole source up front, split into chunks across up to
+     * `threads` threads, and then hands out the buffered tokens. Sources
+     * too small to split are lexed on demand as usual.
+     */
+    Lexer(std::string_view input, unsigned threads);
     void error(char ch);
     void advance();
     void skipWhiteSpace();
     void skipComment();
-    Token* number();
-    Token* getNextToken();
+    Token number();
+    Token getNextToken();
     char peek();
-    Token* id();
-    Token* stringLiteral();    
-private:
-    const std::unordered_map<std::string, Token*> RESERVED_KEYWORDS = {
-        { "BEGIN" , new Token(ttype::begin, "BEGIN", -1) },
-        { "END", new Token(ttype::end, "END", -1) },
-        { "PROGRAM", new Token(ttype::program, "PROGRAM", -1) },
-        { "VAR", new Token(ttype::var, "VAR", -1) },
-        { "DIV", new Token(ttype::int_div, "DIV", -1) },
-        { "INTEGER", new Token(ttype::integer, "INTEGER", -1) },
-        { "REAL", new Token(ttype::real, "REAL", -1) },
-        { "PROCEDURE", new Token(ttype::procedure, "PROCEDURE", -1) },
-        { "WHILE", new Token(ttype::twhile, "WHILE", -1)},
-        { "IF", new Token(ttype::tif, "IF", -1)},
-        { "THEN", new Token(ttype::then, "THEN", -1)},
-        { "ELSE", new Token(ttype::telse, "ELSE", -1)},
-        { "DO", new Token(ttype::tdo, "DO", -1)},
-        { "STRING", new Token(ttype::string, "STRING", -1)},
-	{ "RECORD", new Token(ttype::record, "RECORD", -1)},
-	{ "TYPE", new Token(ttype::type, "TYPE", -1)},
-	{ "RETURN", new Token(ttype::ret, "RETURN", -1)}
+    Token id();
+    Token stringLiteral();    
+    // Whether the next token is a '(', i.e. the id just read is a call.
+    bool lparenFollows();
+    /*
+     * A point in the token stream to come back to later. Streamed sources
+     * are gone once lexed, so only sources held in memory can seek.
+     */
+    struct Mark {
+	unsigned int pos;
+	int line;
+	size_t nextToken;
     };
+    bool canSeek() const;
+    Mark mark() const;
+    void seek(const Mark& mark);
+    /*
+     * Lexes the part of source's input between two of its marks. It
+     * looks identifiers up without interning new ones, so several of
+     * these can run on different threads at once.
+     */
+    Lexer(const Lexer& source, const Mark& from, const Mark& to);
+    // Kind of a reserved keyword, or ttype::id for any other word.
+    static ttype::Kind keywordKind(std::string_view word);
+    // Where identifiers are interned; the global table unless this lexes
+    // one chunk of a parallel lex.
+    intern::Table* names;
+private:
+    /*
+     * Streaming state. The window only keeps the token being lexed, so
+     * token text is copied into a small ring of buffers; the parser never
+     * needs more than the last few tokens' text.
+     */
+    static const int TEXT_RING = 4;
+    int fd;
+    std::vector<char> window;
+    size_t tokenStart;
+    std::string textRing[TEXT_RING];
+    int textNext;
+    // Scratch space for uppercasing identifiers before interning them.
+    std::string upperWord;
+    bool lookupOnly;
+    bool refill();
+    bool fetch();
+    void jumpTo(size_t newPos);
+    Token makeToken(ttype::Kind type, size_t start, size_t length);
+    Token makeToken(ttype::Kind type);
+    /*
+     * Chunk lexers record their first error instead of exiting, so that
+     * it surfaces only once the parser reaches it.
+     */
+    bool deferErrors;
+    std::string deferredError;
+    void fail(const std::string& msg);
+    // Tokens lexed in advance, and the next one to hand out.
+    std::vector<Token> tokens;
+    size_t nextToken;
+    bool buffered() const;
+    void lexChunks(unsigned threads);
 };
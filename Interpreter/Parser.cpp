@@ -1,11 +1,22 @@
 
+#include <atomic>
+#include <sstream>
 #include "Parser.h"
+#include "builtins.h"
 
 using namespace std;
 
-Parser::Parser(Lexer* lexer) {
+Parser::Parser(Lexer* lexer) : currProc(nullptr) {
     this->lexer = lexer;
     this->currentToken = this->lexer->getNextToken();
+    // Bodies are skipped to parse them lazily, with --lazy-parse, or to
+    // parse them together on several threads. Token and scope dumps should
+    // show a single pass over the program.
+    deferBodies = (options::lazyParse || options::parseThreads > 1) &&
+	!options::printTokens && !options::showST && lexer->canSeek();
+}
+
+Parser::Parser(const unordered_set<intern::Id>& validTypes) : currProc(nullptr), validTypes(validTypes), lexer(nullptr), deferBodies(false) {
 }
 
 int Parser::line() {
@@ -16,104 +27,237 @@ void Parser::error(string errmsg) {
     utils::fatalError("Parse error on line " + to_string(lexer->line) + ": " + errmsg);
 }
 
-void Parser::eat(string tokenType) {
+void Parser::eat(ttype::Kind tokenType) {
     if (options::printTokens) {
-        cout << "Consumed token " << *currentToken << endl;
+        cout << "Consumed token " << currentToken << endl;
     }
-    if (currentToken->type == tokenType) {
+    if (currentToken.type == tokenType) {
         currentToken = lexer->getNextToken();
     }
     else {
-        this->error("Token of type " + tokenType + " expected, " + currentToken->type + " with value \"" + currentToken->value.toString() + "\" found");
+        this->error("Token of type " + string(ttype::name(tokenType)) + " expected, " + ttype::name(currentToken.type) + " with value \"" + string(currentToken.text) + "\" found");
     }
 }
 
 AST* Parser::program() {
     this->eat(ttype::program);
-    Var* varNode = dynamic_cast<Var*>(this->variable());
-    string progName = varNode->value.strVal;
+    Var* varNode = arena.make<Var>(currentToken);
+    this->eat(ttype::id);
+    string progName = varNode->name;
     this->eat(ttype::semi);
     int line = this->line();
-    Block* blockNode = dynamic_cast<Block*>(this->block());
-    Program* programNode = new Program(progName, blockNode);
+    Block* blockNode = this->block();
+    Program* programNode = arena.make<Program>(progName, blockNode);
     this->eat(ttype::dot);
     programNode->line = line;
     return programNode;
 }
 
-AST* Parser::block() {
+Block* Parser::block() {
     int line = this->line();
     vector<AST*>* declarationNodes = this->declarations();
-    AST* compoundStatementNode = this->compoundStatement();
-    Block* block = new Block(*declarationNodes, compoundStatementNode);
+    flat::Ref body = this->compoundStatement();
+    Block* block = arena.make<Block>(*declarationNodes, body);
     block->line = line;
+    flatTree.block(block);
     return block;
 }
 
+flat::Ref Parser::statementBlock() {
+    int line = this->line();
+    Block* block = this->block();
+    if (block->declarations.empty()) {
+	return block->body;
+    }
+    return flatTree.add(FlatKind::BLOCK, flatTree.blocks.size() - 1, block->body, 0, line);
+}
+
 ProcedureDecl* Parser::procedureDecl() {
     this->eat(ttype::procedure);
-    string procName = currentToken->value.strVal;
+    intern::Id procId = currentToken.id;
     this->eat(ttype::id);
     vector<Param*>* params;
-    if (currentToken->type == ttype::lparen) {
+    if (currentToken.type == ttype::lparen) {
 	this->eat(ttype::lparen);
 	params = this->formalParameterList();
 	this->eat(ttype::rparen);
     }
     else {
-	params = new vector<Param*>();
+	params = arena.make<vector<Param*>>();
     }
     Type* returnType = nullptr;
 
     /* The proc returns a value */
-    if (currentToken->type == ttype::arrow) {
+    if (currentToken.type == ttype::arrow) {
 	this->eat(ttype::arrow);
 	returnType = this->typeSpec();
     }
 
-    ProcedureDecl* procDecl = new ProcedureDecl(procName, params, nullptr, returnType);
-    this->currProc = procDecl;
+    ProcedureDecl* procDecl = arena.make<ProcedureDecl>(procId, params, nullptr, returnType);
     this->eat(ttype::semi);
-    AST* blockNode = this->block();   
+    if (deferBodies) {
+	PendingBody& body = pendingBodies[procDecl];
+	body.first = currentToken;
+	body.mark = lexer->mark();
+	this->skipBlock();
+	body.end = lexer->mark();
+	pendingOrder.push_back(procDecl);
+    }
+    else {
+	ProcedureDecl* enclosingProc = this->currProc;
+	this->currProc = procDecl;
+	procDecl->blockNode = this->block();
+	this->currProc = enclosingProc;
+    }
     procDecl->line = this->line();
-    procDecl->blockNode = blockNode;
     this->eat(ttype::semi);
-    this->currProc = nullptr;
     return procDecl;
 }
 
+void Parser::parseBody(ProcedureDecl* procDecl) {
+    auto itr = pendingBodies.find(procDecl);
+    if (itr == pendingBodies.end()) {
+	return;
+    }
+    Token resumeToken = currentToken;
+    Lexer::Mark resumeMark = lexer->mark();
+    ProcedureDecl* enclosingProc = this->currProc;
+    currentToken = itr->second.first;
+    lexer->seek(itr->second.mark);
+    this->currProc = procDecl;
+    procDecl->blockNode = this->block();
+    this->currProc = enclosingProc;
+    currentToken = resumeToken;
+    lexer->seek(resumeMark);
+    pendingBodies.erase(itr);
+}
+
+void Parser::parseBodies(const function<void(ProcedureDecl*, FlatAST&, ostream&)>& check) {
+    struct Job {
+	ProcedureDecl* procDecl;
+	ostringstream out;
+	bool failed = false;
+	string error;
+    };
+    vector<Job> jobs(pendingOrder.size());
+    size_t count = 0;
+    for (ProcedureDecl* procDecl : pendingOrder) {
+	if (pendingBodies.count(procDecl)) {
+	    jobs[count++].procDecl = procDecl;
+	}
+    }
+    jobs.resize(count);
+    pendingOrder.clear();
+    if (count == 0) {
+	return;
+    }
+    size_t threads = min<size_t>(options::parseThreads, count);
+    size_t firstParser = bodyParsers.size();
+    for (size_t i = 0; i < threads; i++) {
+	bodyParsers.emplace_back(new Parser(validTypes));
+    }
+    atomic<size_t> nextJob(0);
+    utils::inParallel(threads, [&](size_t thread) {
+	Parser& parser = *bodyParsers[firstParser + thread];
+	utils::throwFatalErrors = true;
+	for (size_t i = nextJob++; i < count; i = nextJob++) {
+	    Job& job = jobs[i];
+	    const PendingBody& body = pendingBodies.at(job.procDecl);
+	    try {
+		Lexer bodyLexer(*lexer, body.mark, body.end);
+		parser.lexer = &bodyLexer;
+		parser.currentToken = body.first;
+		parser.currProc = job.procDecl;
+		job.procDecl->blockNode = parser.block();
+		parser.lexer = nullptr;
+		check(job.procDecl, parser.flatTree, job.out);
+	    }
+	    catch (const utils::FatalError& err) {
+		job.failed = true;
+		job.error = err.message;
+	    }
+	}
+	utils::throwFatalErrors = false;
+    });
+    pendingBodies.clear();
+    for (Job& job : jobs) {
+	cout << job.out.str();
+	if (job.failed) {
+	    utils::fatalError(job.error);
+	}
+    }
+    for (size_t i = firstParser; i < bodyParsers.size(); i++) {
+	flatTree.append(bodyParsers[i]->flatTree);
+    }
+}
+
+void Parser::skip() {
+    if (currentToken.type == ttype::eof) {
+	this->error("unexpected end of file in procedure body");
+    }
+    currentToken = lexer->getNextToken();
+}
+
+/*
+ * Moves past a block without building it: past its declarations up to its
+ * own begin, then to the matching end. Nested procedure headers are
+ * skipped up to the ';' outside their parameter list, and their blocks
+ * the same way, since those hold begins and ends of their own.
+ */
+void Parser::skipBlock() {
+    while (currentToken.type != ttype::begin) {
+	if (currentToken.type == ttype::procedure) {
+	    int parens = 0;
+	    while (currentToken.type != ttype::semi || parens > 0) {
+		if (currentToken.type == ttype::lparen) parens++;
+		if (currentToken.type == ttype::rparen) parens--;
+		this->skip();
+	    }
+	    this->skip();
+	    this->skipBlock();
+	}
+	this->skip();
+    }
+    int depth = 0;
+    do {
+	if (currentToken.type == ttype::begin) depth++;
+	if (currentToken.type == ttype::end) depth--;
+	this->skip();
+    } while (depth > 0);
+}
+
 vector<AST*>* Parser::declarations() {
-    vector<AST*>* declarations = new vector<AST*>();
+    vector<AST*>* declarations = arena.make<vector<AST*>>();
     while (true) {
-        if (currentToken->type == ttype::var) {
+        if (currentToken.type == ttype::var) {
             this->eat(ttype::var);
-            while (currentToken->type == ttype::id) {
+            while (currentToken.type == ttype::id) {
                 vector<AST*>* varDecl = this->variableDeclarations();
                 utils::combineArrs<AST>(declarations, varDecl);
                 this->eat(ttype::semi);
             }
         }
-        else if (currentToken->type == ttype::procedure) {
+        else if (currentToken.type == ttype::procedure) {
 	    declarations->push_back(this->procedureDecl());
         }
-	else if (currentToken->type == ttype::type) {
+	else if (currentToken.type == ttype::type) {
 	    this->eat(ttype::type);
-	    string recordName = currentToken->value.strVal;
+	    intern::Id recordId = currentToken.id;
 	    this->eat(ttype::id);
 	    this->eat(ttype::equals);
 	    this->eat(ttype::record);	    
-	    vector<AST*>* varDecls = new vector<AST*>();
-	    while (currentToken->type == ttype::id) {
+	    vector<AST*>* varDecls = arena.make<vector<AST*>>();
+	    while (currentToken.type == ttype::id) {
 		vector<AST*>* varDecl = this->variableDeclarations();
 		utils::combineArrs(varDecls, varDecl);
 		this->eat(ttype::semi);
 	    }
-	    RecordDecl* recordDecl = new RecordDecl(recordName, varDecls);
-	    if (validTypes.find(recordName) != validTypes.end()) {
-		utils::fatalError("Illegal redeclaration of record " + recordName + " on line " + to_string(this->line()));
+	    RecordDecl* recordDecl = arena.make<RecordDecl>(recordId, varDecls);
+	    if (validTypes.find(recordId) != validTypes.end()) {
+		utils::fatalError("Illegal redeclaration of record " + recordDecl->recordName + " on line " + to_string(this->line()));
 	    }
 	    // Register the newly declared type as a valid type.
-	    validTypes.insert(recordName);
+	    validTypes.insert(recordId);
 	    recordDecl->line = this->line();
 	    declarations->push_back(recordDecl);
 	    this->eat(ttype::end);
@@ -125,29 +269,29 @@ vector<AST*>* Parser::declarations() {
 }
 
 vector<Param*>* Parser::formalParameters() {
-    vector<Param*>* paramNodes = new vector<Param*>();
-    vector<Token*> paramTokens = { currentToken };
+    vector<Param*>* paramNodes = arena.make<vector<Param*>>();
+    vector<Var*> paramVars = { arena.make<Var>(currentToken) };
     this->eat(ttype::id);
-    while (currentToken->type == ttype::comma) {
+    while (currentToken.type == ttype::comma) {
         this->eat(ttype::comma);
-        paramTokens.push_back(currentToken);
+        paramVars.push_back(arena.make<Var>(currentToken));
         this->eat(ttype::id);
     }
     this->eat(ttype::colon);
     Type* typeNode = this->typeSpec();
-    for (Token* paramToken : paramTokens) {
-        paramNodes->push_back(new Param(new Var(paramToken), typeNode));
+    for (Var* paramVar : paramVars) {
+        paramNodes->push_back(arena.make<Param>(paramVar, typeNode));
     }
     return paramNodes;
 }
 
 vector<Param*>* Parser::formalParameterList() {
-    if (currentToken->type != ttype::id) {
-        return new vector<Param*>();
+    if (currentToken.type != ttype::id) {
+        return arena.make<vector<Param*>>();
     }
     vector<Param*>* paramNodes = this->formalParameters();
     vector<Param*>* formalParams;
-    while (currentToken->type == ttype::semi) {
+    while (currentToken.type == ttype::semi) {
         this->eat(ttype::semi);
         formalParams = this->formalParameters();
         utils::combineArrs<Param>(paramNodes, formalParams);
@@ -156,24 +300,24 @@ vector<Param*>* Parser::formalParameterList() {
 }
 
 vector<AST*>* Parser::variableDeclarations() {
-    vector<AST*> varNodes = { new Var(currentToken) };
+    vector<AST*> varNodes = { arena.make<Var>(currentToken) };
     this->eat(ttype::id);
     Var* var;
-    while (currentToken->type == ttype::comma) {
+    while (currentToken.type == ttype::comma) {
         this->eat(ttype::comma);
-        var = new Var(currentToken);
+        var = arena.make<Var>(currentToken);
         var->line = this->line();
         varNodes.push_back(var);
         this->eat(ttype::id);
     }
     this->eat(ttype::colon);
     Type* typeNode = this->typeSpec();
-    vector<AST*>* varDeclarations = new vector<AST*>();
+    vector<AST*>* varDeclarations = arena.make<vector<AST*>>();
     VarDecl* varDecl;
     Var* varNode;
     for (AST* _varNode : varNodes) {
 	varNode = dynamic_cast<Var*>(_varNode);
-        varDecl = new VarDecl(varNode, typeNode);
+        varDecl = arena.make<VarDecl>(varNode, typeNode);
         varDecl->line = this->line();
         varDeclarations->push_back(varDecl);
     }
@@ -181,258 +325,235 @@ vector<AST*>* Parser::variableDeclarations() {
 }
 
 Type* Parser::typeSpec() {
-    Token* token = currentToken;
-    if (this->validTypes.find(currentToken->value.strVal) == validTypes.end()) {
-        this->error(currentToken->value.strVal + " is not a valid type");
+    Token token = currentToken;
+    if (currentToken.id == intern::NONE || this->validTypes.find(currentToken.id) == validTypes.end()) {
+        this->error(currentToken.name() + " is not a valid type");
     }
-    eat(token->type);
-    Type* type = new Type(token);
+    eat(token.type);
+    Type* type = arena.make<Type>(token);
     type->line = this->line();
     return type;
 }
 
-AST* Parser::ifStatement(bool isElseIf) {
+flat::Ref Parser::ifStatement(bool isElseIf) {
     int line = this->line();
     this->eat(ttype::tif);
     this->eat(ttype::lparen);
-    AST* conditionExpr = expr();
+    flat::Ref conditionExpr = expr();
     this->eat(ttype::rparen);
     // There's no then
     if (!isElseIf) {
         this->eat(ttype::then);
     }
-    AST* blockNode = block();
-    AST* elseNode = nullptr;
+    flat::Ref blockNode = statementBlock();
+    flat::Ref elseNode = flat::NONE;
     // If there's no semicolon, there's an else branch.
-    if (currentToken->type != ttype::semi) {
+    if (currentToken.type != ttype::semi) {
         this->eat(ttype::telse);
         // This means it's an else-if
-        if (currentToken->type == ttype::tif) {
+        if (currentToken.type == ttype::tif) {
             elseNode = this->ifStatement(true);
         }
         // This means it's not.
-        else if (currentToken->type == ttype::begin) {
-            elseNode = this->block();
+        else if (currentToken.type == ttype::begin) {
+            elseNode = this->statementBlock();
         }
         else error("Semicolon expected after if-statement block on line " + to_string(this->line()));
     }
-    IfStatement* ifStatement = new IfStatement(conditionExpr, blockNode, elseNode);
-    ifStatement->line = line;
-    return ifStatement;
+    return flatTree.add(FlatKind::IF, conditionExpr, blockNode, elseNode, line);
 }
 
-AST* Parser::whileStatement() {
+flat::Ref Parser::whileStatement() {
     int line = this->line();
     this->eat(ttype::twhile);
     this->eat(ttype::lparen);
-    AST* conditionExpr = expr();
+    flat::Ref conditionExpr = expr();
     this->eat(ttype::rparen);
     this->eat(ttype::tdo);
-    AST* blockNode = block();
-    if (currentToken->type != ttype::semi) {
+    flat::Ref blockNode = statementBlock();
+    if (currentToken.type != ttype::semi) {
         error("Semicolon expected after while-statement block on line " + to_string(this->line()));
     }
-    WhileStatement* whileStatement = new WhileStatement(conditionExpr, blockNode);
-    whileStatement->line = line;
-    return whileStatement;
+    return flatTree.add(FlatKind::WHILE, conditionExpr, blockNode, flatTree.loop(currProc), line);
 }
 
-AST* Parser::compoundStatement() {
+flat::Ref Parser::compoundStatement() {
     this->eat(ttype::begin);
-    vector<AST*>* nodes = this->statementList();
+    vector<flat::Ref> nodes = this->statementList();
     this->eat(ttype::end);    
-    Compound* root = new Compound();
-    root->line = this->line();
-    for (AST* node : *nodes) {
-        root->children.push_back(node);
-    }
-
-    return root;
+    return flatTree.add(FlatKind::COMPOUND, 0, flatTree.list(nodes), nodes.size(), this->line());
 }
 
-vector<AST*>* Parser::statementList() {
-    AST* node = this->statement();
-    vector<AST*>* results = new vector<AST*>();
-    results->push_back(node);
-    while (currentToken->type == ttype::semi) {
+vector<flat::Ref> Parser::statementList() {
+    vector<flat::Ref> results = { this->statement() };
+    while (currentToken.type == ttype::semi) {
         this->eat(ttype::semi);
-        results->push_back(this->statement());
+        results.push_back(this->statement());
     }
     return results;
 }
 
-AST* Parser::statement() {
-    if (currentToken->type == ttype::begin) {
+flat::Ref Parser::statement() {
+    if (currentToken.type == ttype::begin) {
         return this->compoundStatement();
     }
-    else if (currentToken->type == ttype::tif) {
+    else if (currentToken.type == ttype::tif) {
         return this->ifStatement();
     }
-    else if (currentToken->type == ttype::twhile) {
+    else if (currentToken.type == ttype::twhile) {
         return this->whileStatement();
     }
-    else if (currentToken->type == ttype::id) {
-	/* Because we're being naughty and poking around in the lexer internals, we have to
-	   make sure to skip whitespace. */
-	lexer->skipWhiteSpace();
-        if (lexer->currentChar == '(') {
+    else if (currentToken.type == ttype::id) {
+        if (lexer->lparenFollows()) {
             return this->procedureCall();
         }
         else {
             return this->assignmentStatement();
         }
     }
-    else if (currentToken->type == ttype::ret) {
+    else if (currentToken.type == ttype::ret) {
 	return this->returnStatement();
     }
     return this->empty();
 }
 
-AST* Parser::procedureCall() {
+/*
+ * Built-ins are known by name alone and take precedence over procedures,
+ * so calls to them are told apart here; a call to a procedure keeps its
+ * name until it is resolved.
+ */
+flat::Ref Parser::procedureCall() {
     int line = this->line();
-    string procName = currentToken->value.strVal;
-    vector<AST*>* actualParams = new vector<AST*>();
+    intern::Id procId = currentToken.id;
+    vector<flat::Ref> actualParams;
     eat(ttype::id);
     eat(ttype::lparen);
-    while (currentToken->type != ttype::rparen){
-        actualParams->push_back(this->expr());
-        if (currentToken->type == ttype::comma) {
+    while (currentToken.type != ttype::rparen){
+        actualParams.push_back(this->expr());
+        if (currentToken.type == ttype::comma) {
             eat(ttype::comma);
             continue;
         }
     }
     eat(ttype::rparen);
-    ProcedureCall* procedureCall = new ProcedureCall(procName, actualParams);
-    procedureCall->line = line;
-    return procedureCall;
+    uint32_t args = flatTree.list(actualParams);
+    if (builtin::FUNCTIONS.count(procId)) {
+	return flatTree.add(FlatKind::CALLB, flatTree.builtinIndex(procId), args, actualParams.size(), line);
+    }
+    return flatTree.add(FlatKind::CALL, procId, args, actualParams.size(), line);
 }
 
-AST* Parser::assignmentStatement() {
+flat::Ref Parser::assignmentStatement() {
     int line = this->line();
-    AST* left = this->variable();
-    Token* token = currentToken;
+    intern::Id varId = currentToken.id;
+    this->eat(ttype::id);
     this->eat(ttype::assign);
-    AST* right = this->expr();
-    Assign* assignmentStatement = new Assign(left, token, right);
-    assignmentStatement->line = line;
-    return assignmentStatement;
+    flat::Ref right = this->expr();
+    return flatTree.add(FlatKind::ASSIGN, flat::NONE, varId, right, line);
 }
 
-AST* Parser::returnStatement() {
+flat::Ref Parser::returnStatement() {
 
     if (!this->currProc) {
 	this->error("return statement found outside of procedure declaration");
-	return nullptr;
+	return flat::NONE;
     }
 
     if (this->currProc->returnTypeNode == nullptr) {
 	this->error("cannot have return statement in void procedure");
-	return nullptr;
+	return flat::NONE;
     };
     
     int line = this->line();    
     this->eat(ttype::ret);
-    auto expr = this->expr();
-    ReturnStatement* retStatement = new ReturnStatement(expr, this->currProc);
-    retStatement->line = line;
-    return retStatement;
+    flat::Ref expr = this->expr();
+    return flatTree.add(FlatKind::RETURN, expr, 0, 0, line);
 }
 
-AST* Parser::variable() {
-    AST* node = new Var(currentToken);
-    node->line = this->line();
+flat::Ref Parser::variable() {
+    intern::Id varId = currentToken.id;
+    int line = this->line();
     this->eat(ttype::id);
-    return node;
+    return flatTree.add(FlatKind::VAR, flat::NONE, flat::NONE, varId, line);
 }
 
-AST* Parser::empty() {
-    return new NoOp();
+flat::Ref Parser::empty() {
+    return flatTree.add(FlatKind::NOOP, 0, 0, 0, this->line());
 }
 
-AST* Parser::expr() {    
-    AST* node = this->term();
-    unordered_set<string> types = {ttype::plus, ttype::minus};
-    while (types.find(currentToken->type) != types.end()) {
-        Token* token = currentToken;
-        if (token->type == ttype::plus) {
-            this->eat(ttype::plus);
-        }
-        else if (token->type == ttype::minus) {
-            this->eat(ttype::minus);
-        }
-        node = new BinOp(node, token, this->term());
-        node->line = this->line();
-    }
-    return node;
+/*
+ * Binding power of every binary operator, indexed by token kind. Tokens
+ * that can't continue an expression have none. Comparisons bind loosest,
+ * then the additive operators, then the multiplicative ones; unary signs
+ * are part of a factor and bind tightest of all.
+ */
+struct Precedence {
+    uint8_t of[256];
+};
+
+static constexpr Precedence buildPrecedence() {
+    Precedence table = {};
+    table.of[ttype::equals] = 1;
+    table.of[ttype::not_equals] = 1;
+    table.of[ttype::less_than] = 1;
+    table.of[ttype::greater_than] = 1;
+    table.of[ttype::lt_or_equals] = 1;
+    table.of[ttype::gt_or_equals] = 1;
+    table.of[ttype::plus] = 2;
+    table.of[ttype::minus] = 2;
+    table.of[ttype::mul] = 3;
+    table.of[ttype::float_div] = 3;
+    table.of[ttype::int_div] = 3;
+    return table;
 }
 
-AST* Parser::term() {
-    AST* node = this->factor();
-    unordered_set<string> types = {ttype::mul, ttype::int_div, ttype::float_div,
-				   ttype::equals, ttype::not_equals, ttype::less_than, ttype::greater_than};
-    while (types.find(currentToken->type) != types.end()) {
-        Token* token = currentToken;
-        if (token->type == ttype::mul) {
-            this->eat(ttype::mul);
-        }
-        else if (token->type == ttype::int_div) {
-            this->eat(ttype::int_div);
-        }
-        else if (token->type == ttype::float_div) {
-            this->eat(ttype::float_div);
-        }
-        else if (token->type == ttype::equals) {
-            this->eat(ttype::equals);
-        }
-        else if (token->type == ttype::not_equals) {
-            this->eat(ttype::not_equals);
-        }
-        else if (token->type == ttype::greater_than) {
-            this->eat(ttype::greater_than);
-        }
-	else if (token->type == ttype::less_than) {
-	    this->eat(ttype::less_than);
-	}
-        node = new BinOp(node, token, this->factor());
-        node->line = this->line();
+static constexpr Precedence PRECEDENCE = buildPrecedence();
+
+/*
+ * Parses an expression whose operators all bind at least as tightly as
+ * minPrecedence. Every binary operator is left-associative, so its right
+ * operand may only contain operators that bind more tightly.
+ */
+flat::Ref Parser::expr(int minPrecedence) {
+    flat::Ref node = this->factor();
+    int precedence;
+    while ((precedence = PRECEDENCE.of[currentToken.type]) >= minPrecedence) {
+        ttype::Kind op = currentToken.type;
+        this->eat(op);
+        flat::Ref right = this->expr(precedence + 1);
+        node = flatTree.add(FlatKind::BINOP, op, node, right, this->line());
     }
     return node;
 }
 
-AST* Parser::factor() {
-    Token* token = currentToken;
-    if (token->type == ttype::plus) {
-        this->eat(ttype::plus);
-        return new UnaryOp(token, this->factor());
-    }
-    else if (token->type == ttype::minus) {
-        this->eat(ttype::minus);
-        return new UnaryOp(token, this->factor());
+flat::Ref Parser::factor() {
+    Token token = currentToken;
+    if (token.type == ttype::plus || token.type == ttype::minus) {
+        this->eat(token.type);
+        flat::Ref operand = this->factor();
+        return flatTree.add(FlatKind::UNARY, token.type, operand, 0, token.line);
     }
-    else if (token->type == ttype::int_const) {
+    else if (token.type == ttype::int_const) {
         this->eat(ttype::int_const);
-        return new Num(token);
+        return flatTree.constant(DataVal(token.numVal), token.line);
     }
-    else if (token->type == ttype::real_const) {
+    else if (token.type == ttype::real_const) {
         this->eat(ttype::real_const);
-        return new Num(token);
+        return flatTree.constant(DataVal(token.numVal), token.line);
     }
-    else if (token->type == ttype::string_literal) {
+    else if (token.type == ttype::string_literal) {
 	this->eat(ttype::string_literal);
-	return new StringLiteral(token);
+	return flatTree.stringConstant(token.text, token.line);
     }
-    else if (token->type == ttype::lparen) {
-        AST* node;
+    else if (token.type == ttype::lparen) {
+        flat::Ref node;
         this->eat(ttype::lparen);
         node = this->expr();
         this->eat(ttype::rparen);
         return node;
     }
-    else if (token->type == ttype::id) {
-	/* Because we're being naughty and poking around in the lexer internals, we have to
-	   make sure to skip whitespace. */
-	lexer->skipWhiteSpace();
-        if (lexer->currentChar == '(') {
+    else if (token.type == ttype::id) {
+        if (lexer->lparenFollows()) {
             return this->procedureCall();
         }
     }
@@ -441,8 +562,8 @@ AST* Parser::factor() {
 
 AST* Parser::parse() {
     AST* node = this->program();
-    if (currentToken->type != ttype::eof) {
-	cout << *currentToken << endl;
+    if (currentToken.type != ttype::eof) {
+	cout << currentToken << endl;
         this->error("parsing terminated before end of file");	
     }
     return node;
@@ -2,10 +2,16 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <functional>
+#include <memory>
+#include <ostream>
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 #include "ASTNodes.h"
+#include "Arena.h"
+#include "FlatAST.h"
 #include "Lexer.h"
 
 /****************************************
@@ -15,36 +21,72 @@
 class Parser {
 public:
     Parser(Lexer* lexer);
+    // Every statement and expression parsed, in flat form.
+    FlatAST flatTree;
     int line();
     void error(std::string errmsg);
-    void eat(std::string tokenType);
+    void eat(ttype::Kind tokenType);
     AST* program();
-    AST* block();
+    Block* block();
+    // A block in a statement, which only needs a node of its own if it
+    // declares anything.
+    flat::Ref statementBlock();
     ProcedureDecl* procedureDecl();
     std::vector<AST*>* declarations();
     std::vector<Param*>* formalParameters();
     std::vector<Param*>* formalParameterList();
     std::vector<AST*>* variableDeclarations();
     Type* typeSpec();
-    AST* compoundStatement();
-    std::vector<AST*>* statementList();
-    AST* statement();
-    AST* assignmentStatement();
-    AST* variable();
-    AST* empty();
-    AST* expr();
-    AST* term();
-    AST* factor();
+    flat::Ref compoundStatement();
+    std::vector<flat::Ref> statementList();
+    flat::Ref statement();
+    flat::Ref assignmentStatement();
+    flat::Ref variable();
+    flat::Ref empty();
+    flat::Ref expr(int minPrecedence = 1);
+    flat::Ref factor();
     AST* parse();
-    AST* procedureCall();    
-    AST* ifStatement(bool isElseIf = false);
-    AST* whileStatement();
-    AST* returnStatement();
+    flat::Ref procedureCall();
+    flat::Ref ifStatement(bool isElseIf = false);
+    flat::Ref whileStatement();
+    flat::Ref returnStatement();
+    // Builds the block of a procedure whose body was skipped.
+    void parseBody(ProcedureDecl* procDecl);
+    /*
+     * Builds every skipped body at once, spread over the parse threads.
+     * check runs on each body just after it is built, on the same thread,
+     * with the flat tree it was built into; those join flatTree once all
+     * are checked. What check writes is printed in declaration order, and
+     * the error reported is the first in declaration order.
+     */
+    void parseBodies(const std::function<void(ProcedureDecl*, FlatAST&, std::ostream&)>& check);
 private:
+    // A parser for bodies built on another thread.
+    Parser(const std::unordered_set<intern::Id>& validTypes);
+    // Every declaration node and node list, released with the parser.
+    Arena arena;
     ProcedureDecl* currProc;
-    std::unordered_set<std::string> validTypes = {ttype::integer, ttype::real, ttype::string, ttype::any};
+    std::unordered_set<intern::Id> validTypes = {intern::id(ttype::name(ttype::integer)), intern::id(ttype::name(ttype::real)), intern::id(ttype::name(ttype::string)), intern::id(ttype::name(ttype::any))};
     Lexer* lexer;
-    Token* currentToken;
+    Token currentToken;
+    /*
+     * Procedure bodies may only be skipped over at first, to be built
+     * either on the procedure's first call or all together on several
+     * threads. The first token of each is kept along with where the body
+     * starts and ends.
+     */
+    struct PendingBody {
+	Token first;
+	Lexer::Mark mark;
+	Lexer::Mark end;
+    };
+    bool deferBodies;
+    std::unordered_map<ProcedureDecl*, PendingBody> pendingBodies;
+    std::vector<ProcedureDecl*> pendingOrder;
+    // Parsers that built bodies on other threads, kept for their arenas.
+    std::vector<std::unique_ptr<Parser>> bodyParsers;
+    void skip();
+    void skipBlock();
 };
 
 #endif
@@ -0,0 +1,380 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ProgramCache.h"
+#include "builtins.h"
+#include "options.h"
+
+using namespace std;
+
+/*
+ * Bump VERSION whenever the layout below, or the meaning of any opcode,
+ * changes. Entries also record what they were built with, so that a
+ * build with a different instruction set never reads them.
+ */
+static const char MAGIC[4] = { 'P', 'A', 'S', 'C' };
+static const uint32_t VERSION = 1;
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t numOps;
+    uint32_t instrSize;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    // Of everything after the header.
+    uint64_t checksum;
+    uint32_t numChunks;
+    uint32_t numBuiltins;
+};
+
+// 64-bit FNV-1a.
+static const uint64_t FNV_BASIS = 0xcbf29ce484222325ull;
+
+static uint64_t hashBytes(uint64_t hash, const char* bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+	hash ^= (unsigned char) bytes[i];
+	hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+ProgramCache::ProgramCache(const string& dir, string_view source) : dir(dir), size(source.size()) {
+    hash = hashBytes(FNV_BASIS, source.data(), source.size());
+    // These change the bytecode, or whether the program compiles at all.
+    const char flags[] = { options::showConditions, options::staticTypeChecking };
+    hash = hashBytes(hash, flags, sizeof(flags));
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.pbc", (unsigned long long) hash);
+    path = dir + "/" + name;
+}
+
+string ProgramCache::defaultDir() {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+	return string(xdg) + "/pas";
+    }
+    const char* home = getenv("HOME");
+    return string(home && *home ? home : ".") + "/.cache/pas";
+}
+
+namespace {
+
+    class CacheWriter {
+    public:
+	string bytes;
+	void raw(const void* data, size_t size) { bytes.append((const char*) data, size); }
+	template <class T> void value(T val) { raw(&val, sizeof(val)); }
+	void str(const string& s) {
+	    value<uint32_t>(s.size());
+	    raw(s.data(), s.size());
+	}
+    };
+
+    /*
+     * Reads an entry out of its mapping. Running past the end, or finding
+     * anything out of range, marks the entry as unusable.
+     */
+    class CacheReader {
+    public:
+	CacheReader(const char* data, size_t size) : pos(data), end(data + size), ok(true) {}
+	bool good() const { return ok; }
+	bool raw(void* out, size_t size) {
+	    if (!ok || (size_t) (end - pos) < size) {
+		return ok = false;
+	    }
+	    memcpy(out, pos, size);
+	    pos += size;
+	    return true;
+	}
+	template <class T> T value() {
+	    T val{};
+	    raw(&val, sizeof(val));
+	    return val;
+	}
+	string str() {
+	    uint32_t size = value<uint32_t>();
+	    if (!ok || (size_t) (end - pos) < size) {
+		ok = false;
+		return "";
+	    }
+	    string s(pos, size);
+	    pos += size;
+	    return s;
+	}
+	// Reads count elements straight into out.
+	template <class T> void array(vector<T>& out, size_t count) {
+	    if (!ok || (size_t) (end - pos) / sizeof(T) < count) {
+		ok = false;
+		return;
+	    }
+	    out.resize(count);
+	    raw(out.data(), count * sizeof(T));
+	}
+	void fail() { ok = false; }
+    private:
+	const char* pos;
+	const char* end;
+	bool ok;
+    };
+
+}
+
+/****************************************
+ Writing
+***************************************/
+
+void ProgramCache::store(const Module& module) const {
+    CacheWriter out;
+    CacheHeader header = {};
+    out.value(header);
+    // Built-ins go by name, since their addresses change between runs.
+    for (const builtin::Fn* fn : module.builtins) {
+	out.str(fn->name);
+    }
+    for (const Chunk& chunk : module.chunks) {
+	out.str(chunk.name);
+	out.value<uint32_t>(chunk.code.size());
+	out.raw(chunk.code.data(), chunk.code.size() * sizeof(Instr));
+	out.raw(chunk.lines.data(), chunk.lines.size() * sizeof(int));
+	out.value<uint32_t>(chunk.constants.size());
+	for (const DataVal& constant : chunk.constants) {
+	    out.value<uint32_t>(constant.type);
+	    if (constant.type == DataVal::D_STRING) {
+		out.str(constant.toString());
+	    }
+	    else {
+		out.raw(&constant, sizeof(uint64_t));
+	    }
+	}
+	out.value<uint32_t>(chunk.slotNames.size());
+	for (const string& slotName : chunk.slotNames) {
+	    out.str(slotName);
+	}
+	out.value(chunk.numParams);
+	out.value(chunk.numRegs);
+	out.value<int32_t>(chunk.level);
+	out.value<uint8_t>(chunk.returnsValue);
+    }
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.numOps = (uint32_t) Op::NUM_OPS;
+    header.instrSize = sizeof(Instr);
+    header.sourceHash = hash;
+    header.sourceSize = size;
+    header.checksum = hashBytes(FNV_BASIS, out.bytes.data() + sizeof(header), out.bytes.size() - sizeof(header));
+    header.numChunks = module.chunks.size();
+    header.numBuiltins = module.builtins.size();
+    memcpy(&out.bytes[0], &header, sizeof(header));
+
+    // Written aside and renamed into place, so no run ever maps half an
+    // entry. A cache that can't be written is simply not used.
+    for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+	mkdir(dir.substr(0, slash).c_str(), 0755);
+	if (slash == string::npos) {
+	    break;
+	}
+    }
+    string temp = path + "." + to_string(getpid());
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+	return;
+    }
+    bool written = fwrite(out.bytes.data(), 1, out.bytes.size(), file) == out.bytes.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+	remove(temp.c_str());
+    }
+}
+
+/****************************************
+ Reading
+***************************************/
+
+/*
+ * Checks everything the VM takes on trust: every register an instruction
+ * names lies in its frame, every index in its table, calls leave their
+ * arguments and the callee's frame inside the register file, static links
+ * never run out, and the code can't run off its end.
+ */
+static bool validChunk(const Chunk& chunk, size_t chunkIdx, const Module& module) {
+    size_t numRegs = chunk.numRegs;
+    // The register file has room for this many registers past any frame.
+    size_t maxRegs = module.maxRegs();
+    if (chunk.numParams > numRegs || chunk.slotNames.size() > numRegs) {
+	return false;
+    }
+    // Only the program body is at level 1, and static links run down
+    // from a procedure's level to it.
+    if (chunkIdx == 0 ? chunk.level != 1 : chunk.level < 2) {
+	return false;
+    }
+    if (chunk.code.empty()) {
+	return false;
+    }
+    switch (chunk.code.back().op) {
+    case Op::JMP:
+    case Op::RET:
+    case Op::RETNONE:
+    case Op::NORET:
+	break;
+    default:
+	return false;
+    }
+    for (const Instr& instr : chunk.code) {
+	switch (instr.op) {
+	case Op::MOVE:
+	case Op::NEG:
+	    if (instr.a >= numRegs || instr.b >= numRegs) return false;
+	    break;
+	case Op::LOADK:
+	    if (instr.a >= numRegs || instr.b >= chunk.constants.size()) return false;
+	    break;
+	case Op::GETOUTER:
+	case Op::SETOUTER:
+	    if (instr.a >= numRegs || instr.b >= chunk.level || instr.c >= maxRegs) return false;
+	    break;
+	case Op::ADD:
+	case Op::SUB:
+	case Op::MUL:
+	case Op::DIV:
+	case Op::EQ:
+	case Op::NE:
+	case Op::LT:
+	case Op::GT:
+	case Op::LE:
+	case Op::GE:
+	    if (instr.a >= numRegs || instr.b >= numRegs || instr.c >= numRegs) return false;
+	    break;
+	case Op::JMP:
+	    if (instr.b >= chunk.code.size()) return false;
+	    break;
+	case Op::JMPF:
+	    if (instr.a >= numRegs || instr.b >= chunk.code.size()) return false;
+	    break;
+	case Op::CALL:
+	    // The program body can't be called, and a callee is at most one
+	    // level deeper than its caller, so the VM finds its static link
+	    // one level down and every frame's links reach the program body.
+	    if (instr.a >= numRegs || instr.b == 0 || instr.b >= module.chunks.size()
+		|| module.chunks[instr.b].level > chunk.level + 1
+		|| (size_t) instr.c + module.chunks[instr.b].numParams > numRegs) return false;
+	    break;
+	case Op::CALLB:
+	    if (instr.a >= numRegs || instr.b >= module.builtins.size()
+		|| (size_t) instr.c + module.builtins[instr.b]->paramTypes.size() > numRegs) return false;
+	    break;
+	case Op::RET:
+	case Op::TRACECOND:
+	    if (instr.a >= numRegs) return false;
+	    break;
+	case Op::TRACECMP:
+	    if (instr.b >= numRegs || instr.c >= numRegs) return false;
+	    break;
+	case Op::RETNONE:
+	case Op::NORET:
+	case Op::PANIC:
+	    break;
+	default:
+	    // Every body is compiled before a program is cached, so there is
+	    // no LOAD.
+	    return false;
+	}
+    }
+    return true;
+}
+
+static Module* readModule(CacheReader& in, const CacheHeader& header) {
+    Module* module = new Module();
+    for (uint32_t i = 0; i < header.numBuiltins && in.good(); i++) {
+	string name = in.str();
+	intern::Id id = intern::find(name);
+	auto itr = id == intern::NONE ? builtin::FUNCTIONS.end() : builtin::FUNCTIONS.find(id);
+	if (itr == builtin::FUNCTIONS.end()) {
+	    in.fail();
+	    break;
+	}
+	module->builtins.push_back(&itr->second);
+    }
+    for (uint32_t i = 0; i < header.numChunks && in.good(); i++) {
+	module->chunks.emplace_back();
+	Chunk& chunk = module->chunks.back();
+	chunk.name = in.str();
+	uint32_t numInstrs = in.value<uint32_t>();
+	in.array(chunk.code, numInstrs);
+	in.array(chunk.lines, numInstrs);
+	uint32_t numConstants = in.value<uint32_t>();
+	for (uint32_t k = 0; k < numConstants && in.good(); k++) {
+	    uint32_t type = in.value<uint32_t>();
+	    if (type == DataVal::D_STRING) {
+		chunk.constants.push_back(DataVal::allocator.allocate(in.str()));
+	    }
+	    else if (type == DataVal::D_INT || type == DataVal::D_REAL) {
+		DataVal constant;
+		in.raw(&constant, sizeof(uint64_t));
+		constant.type = (DataVal::Type) type;
+		chunk.constants.push_back(constant);
+	    }
+	    else {
+		in.fail();
+	    }
+	}
+	uint32_t numSlotNames = in.value<uint32_t>();
+	for (uint32_t k = 0; k < numSlotNames && in.good(); k++) {
+	    chunk.slotNames.push_back(in.str());
+	}
+	chunk.numParams = in.value<uint16_t>();
+	chunk.numRegs = in.value<uint16_t>();
+	chunk.level = in.value<int32_t>();
+	chunk.returnsValue = in.value<uint8_t>();
+    }
+    if (in.good()) {
+	for (size_t i = 0; i < module->chunks.size(); i++) {
+	    if (!validChunk(module->chunks[i], i, *module)) {
+		in.fail();
+		break;
+	    }
+	}
+    }
+    if (!in.good() || module->chunks.empty()) {
+	delete module;
+	return nullptr;
+    }
+    return module;
+}
+
+Module* ProgramCache::load() const {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+	return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CacheHeader)) {
+	close(fd);
+	return nullptr;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+	return nullptr;
+    }
+    CacheReader in((const char*) data, st.st_size);
+    CacheHeader header = in.value<CacheHeader>();
+    Module* module = nullptr;
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION
+	&& header.numOps == (uint32_t) Op::NUM_OPS && header.instrSize == sizeof(Instr)
+	&& header.sourceHash == hash && header.sourceSize == size
+	&& header.checksum == hashBytes(FNV_BASIS, (const char*) data + sizeof(header), st.st_size - sizeof(header))) {
+	module = readModule(in, header);
+    }
+    munmap(data, st.st_size);
+    if (module && options::dumpBytecode) {
+	cout << module->toString();
+    }
+    return module;
+}
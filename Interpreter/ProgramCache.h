@@ -0,0 +1,37 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Bytecode.h"
+
+/****************************************
+ Program Cache
+
+ Keeps compiled programs on disk, for --cache, so that running a program
+ again skips lexing, parsing, analysis and compiling. An entry is the
+ program's bytecode module written out in a versioned binary format, in
+ a file named for a hash of the source and of the options that change how
+ it compiles. Loading one maps the file and copies its arrays out in bulk.
+ Entries from another version of the format, or that don't match the
+ source, are ignored and replaced.
+***************************************/
+
+class ProgramCache {
+public:
+    ProgramCache(const std::string& dir, std::string_view source);
+    // The cached module, or nullptr if there is no usable entry.
+    Module* load() const;
+    // Writes module as the entry, if the cache directory can be written.
+    void store(const Module& module) const;
+    // $XDG_CACHE_HOME/pas, or ~/.cache/pas.
+    static std::string defaultDir();
+private:
+    std::string dir;
+    std::string path;
+    uint64_t hash;
+    uint64_t size;
+};
+
+#endif
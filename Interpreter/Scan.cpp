@@ -0,0 +1,149 @@
+#include "Scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Scalar versions. These also finish off the tail of every vector scan.
+ */
+
+static inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+static inline bool isIdent(char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+static const char* skipSpaceScalar(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) p++;
+    return p;
+}
+
+static const char* skipIdentScalar(const char* p, const char* end) {
+    while (p < end && isIdent(*p)) p++;
+    return p;
+}
+
+static const char* findScalar(const char* p, const char* end, char a, char b) {
+    while (p < end && *p != a && *p != b) p++;
+    return p;
+}
+
+static size_t countNewlinesScalar(const char* p, const char* end) {
+    size_t count = 0;
+    for (; p < end; p++) {
+	count += *p == '\n' || *p == '\r';
+    }
+    return count;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Vector versions, stamped out once per instruction set. Each classifies a
+ * block of WIDTH bytes into a bitmask of matching bytes; the first zero or
+ * set bit is the end of the run. Identifier bytes are checked as signed
+ * ranges, which also rejects every byte >= 0x80.
+ */
+#define SCAN_IMPL(SUFFIX, TARGET, VEC, WIDTH, LOAD, SET1, CMPEQ, CMPGT, OR, AND, MOVEMASK) \
+    TARGET static const char* skipSpace##SUFFIX(const char* p, const char* end) { \
+	const VEC space = SET1(' '), nl = SET1('\n'), tab = SET1('\t'), cr = SET1('\r'); \
+	for (; end - p >= WIDTH; p += WIDTH) {				\
+	    VEC v = LOAD((const VEC*) p);				\
+	    unsigned mask = MOVEMASK(OR(OR(CMPEQ(v, space), CMPEQ(v, nl)), OR(CMPEQ(v, tab), CMPEQ(v, cr)))); \
+	    if (mask != (unsigned) ((1ull << WIDTH) - 1)) return p + __builtin_ctz(~mask); \
+	}								\
+	return skipSpaceScalar(p, end);					\
+    }									\
+    TARGET static const char* skipIdent##SUFFIX(const char* p, const char* end) { \
+	const VEC digitLo = SET1('0' - 1), digitHi = SET1('9' + 1);	\
+	const VEC alphaLo = SET1('a' - 1), alphaHi = SET1('z' + 1);	\
+	const VEC caseBit = SET1(0x20), underscore = SET1('_');		\
+	for (; end - p >= WIDTH; p += WIDTH) {				\
+	    VEC v = LOAD((const VEC*) p);				\
+	    VEC lower = OR(v, caseBit);					\
+	    VEC digit = AND(CMPGT(v, digitLo), CMPGT(digitHi, v));	\
+	    VEC alpha = AND(CMPGT(lower, alphaLo), CMPGT(alphaHi, lower)); \
+	    unsigned mask = MOVEMASK(OR(OR(digit, alpha), CMPEQ(v, underscore))); \
+	    if (mask != (unsigned) ((1ull << WIDTH) - 1)) return p + __builtin_ctz(~mask); \
+	}								\
+	return skipIdentScalar(p, end);					\
+    }									\
+    TARGET static const char* find##SUFFIX(const char* p, const char* end, char a, char b) { \
+	const VEC va = SET1(a), vb = SET1(b);				\
+	for (; end - p >= WIDTH; p += WIDTH) {				\
+	    VEC v = LOAD((const VEC*) p);				\
+	    unsigned mask = MOVEMASK(OR(CMPEQ(v, va), CMPEQ(v, vb)));	\
+	    if (mask) return p + __builtin_ctz(mask);			\
+	}								\
+	return findScalar(p, end, a, b);				\
+    }									\
+    TARGET static size_t countNewlines##SUFFIX(const char* p, const char* end) { \
+	const VEC nl = SET1('\n'), cr = SET1('\r');			\
+	size_t count = 0;						\
+	for (; end - p >= WIDTH; p += WIDTH) {				\
+	    VEC v = LOAD((const VEC*) p);				\
+	    count += __builtin_popcount(MOVEMASK(OR(CMPEQ(v, nl), CMPEQ(v, cr)))); \
+	}								\
+	return count + countNewlinesScalar(p, end);			\
+    }
+
+SCAN_IMPL(SSE2, , __m128i, 16, _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8,
+	  _mm_cmpgt_epi8, _mm_or_si128, _mm_and_si128, (unsigned) _mm_movemask_epi8)
+SCAN_IMPL(AVX2, __attribute__((target("avx2"))), __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi8,
+	  _mm256_cmpeq_epi8, _mm256_cmpgt_epi8, _mm256_or_si256, _mm256_and_si256, (unsigned) _mm256_movemask_epi8)
+
+#undef SCAN_IMPL
+
+#endif
+
+/*
+ * The implementation is picked the first time this is used.
+ */
+struct ScanImpl {
+    const char* name;
+    const char* (*skipSpace)(const char*, const char*);
+    const char* (*skipIdent)(const char*, const char*);
+    const char* (*find)(const char*, const char*, char, char);
+    size_t (*countNewlines)(const char*, const char*);
+};
+
+static ScanImpl chooseImpl() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	return { "avx2", skipSpaceAVX2, skipIdentAVX2, findAVX2, countNewlinesAVX2 };
+    }
+    return { "sse2", skipSpaceSSE2, skipIdentSSE2, findSSE2, countNewlinesSSE2 };
+#else
+    return { "scalar", skipSpaceScalar, skipIdentScalar, findScalar, countNewlinesScalar };
+#endif
+}
+
+static const ScanImpl& impl() {
+    static const ScanImpl chosen = chooseImpl();
+    return chosen;
+}
+
+const char* scan::skipSpace(const char* p, const char* end) {
+    return impl().skipSpace(p, end);
+}
+
+const char* scan::skipIdent(const char* p, const char* end) {
+    return impl().skipIdent(p, end);
+}
+
+const char* scan::find(const char* p, const char* end, char a, char b) {
+    return impl().find(p, end, a, b);
+}
+
+size_t scan::countNewlines(const char* p, const char* end) {
+    return impl().countNewlines(p, end);
+}
+
+const char* scan::implName() {
+    return impl().name;
+}
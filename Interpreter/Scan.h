@@ -0,0 +1,29 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+
+/****************************************
+ Scan
+
+ Bulk character-class scans for the lexer. Each one runs over [p, end)
+ and returns a pointer to the first byte that ends the run, or end. On
+ x86-64 they work 16 (SSE2) or 32 (AVX2) bytes at a time, chosen once at
+ startup from what the CPU supports; elsewhere they fall back to plain
+ loops.
+***************************************/
+
+namespace scan {
+    // First byte that isn't ' ', '\n', '\t' or '\r'.
+    const char* skipSpace(const char* p, const char* end);
+    // First byte that isn't a letter, digit or '_'.
+    const char* skipIdent(const char* p, const char* end);
+    // First occurrence of a or b.
+    const char* find(const char* p, const char* end, char a, char b);
+    // Number of '\n' and '\r' bytes.
+    size_t countNewlines(const char* p, const char* end);
+    // Name of the implementation in use, for diagnostics.
+    const char* implName();
+}
+
+#endif
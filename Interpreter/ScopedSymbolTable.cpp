@@ -13,6 +13,7 @@ string ScopedSymbolTable::name() {
 
 ScopedSymbolTable::ScopedSymbolTable(string scopeName, int scopeLevel, ScopedSymbolTable* enclosingScope = nullptr) : scopeLevel(scopeLevel), scopeName(scopeName) {
     this->enclosingScope = enclosingScope;
+    enclosingDefined = enclosingScope ? enclosingScope->definedAt.size() : 0;
     this->initBuiltIns();
     
     define(builtInsMap[builtInSymbols::INT]);
@@ -26,23 +27,43 @@ ScopedSymbolTable::ScopedSymbolTable(string scopeName, int scopeLevel, ScopedSym
 
 void ScopedSymbolTable::define(Symbol* symbol) {
     if (options::showST) cout << "Define: " + symbol->toString() << endl;
-    symbols.add(symbol->name, symbol);
+    symbols.add(symbol->id, symbol);
+    definedAt.emplace(symbol->id, definedAt.size());
+    // Variables get the next slot of this scope's stack frame.
+    if (symbol->stype() == Symbol::S_VAR) {
+	VarSymbol* varSymbol = static_cast<VarSymbol*>(symbol);
+	varSymbol->slot = slotSymbols.size();
+	varSymbol->scopeLevel = scopeLevel;
+	slotSymbols.push_back(varSymbol);
+    }
+}
+
+int ScopedSymbolTable::numSlots() const {
+    return slotSymbols.size();
 }
 
-Symbol* ScopedSymbolTable::lookup(string name, bool currScope) {
-    if (options::showST) cout << "Lookup: " + name << endl;
-    Symbol* res = symbols.get(name);
+Symbol* ScopedSymbolTable::lookup(intern::Id id, bool currScope) {
+    if (options::showST) cout << "Lookup: " + intern::name(id) << endl;
+    Symbol* res = symbols.get(id);
     if (res) return res;
     if (currScope) return nullptr;
-    else if (enclosingScope) return enclosingScope->lookup(name);
+    else if (enclosingScope) return enclosingScope->lookup(id);
+    return nullptr;
+}
+
+Symbol* ScopedSymbolTable::lookupDeclared(intern::Id id, size_t visible) {
+    if (options::showST) cout << "Lookup: " + intern::name(id) << endl;
+    Symbol* res = symbols.get(id);
+    if (res && definedAt.at(id) < visible) return res;
+    if (enclosingScope) return enclosingScope->lookupDeclared(id, enclosingDefined);
     return nullptr;
 }
 
 bool ScopedSymbolTable::initBuiltIns() {
-    builtInsMap[builtInSymbols::INT] = new BuiltInTypeSymbol("INTEGER");
-    builtInsMap[builtInSymbols::REAL] = new BuiltInTypeSymbol("REAL");
-    builtInsMap[builtInSymbols::STRING] = new BuiltInTypeSymbol("STRING");    
-    builtInsMap[builtInSymbols::ANY] = new BuiltInTypeSymbol("ANY");
+    builtInsMap[builtInSymbols::INT] = new BuiltInTypeSymbol(intern::id("INTEGER"));
+    builtInsMap[builtInSymbols::REAL] = new BuiltInTypeSymbol(intern::id("REAL"));
+    builtInsMap[builtInSymbols::STRING] = new BuiltInTypeSymbol(intern::id("STRING"));    
+    builtInsMap[builtInSymbols::ANY] = new BuiltInTypeSymbol(intern::id("ANY"));
     return false;
 }
 
@@ -51,8 +72,8 @@ string ScopedSymbolTable::toString() const {
     result += "Enclosing scope: ";
     result += !enclosingScope ? "none" : enclosingScope->scopeName;
     result += "\n";
-    for (string key : symbols.order) {
-        result += key + " : " + this->symbols.get(key)->toString() + ", \n";
+    for (intern::Id key : symbols.order) {
+        result += intern::name(key) + " : " + this->symbols.get(key)->toString() + ", \n";
     }
     return result;
 }
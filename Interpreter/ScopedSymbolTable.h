@@ -5,19 +5,31 @@
 #ifndef SCOPEDSYMBOLTABLE_H
 #define SCOPEDSYMBOLTABLE_H
 
+#include <cstdint>
+#include <unordered_map>
 #include "utils.h"
 #include "Symbol.h"
 
 class ScopedSymbolTable {
 public:
-    utils::OrderedMap<std::string, Symbol> symbols;
+    utils::OrderedMap<intern::Id, Symbol> symbols;
     ScopedSymbolTable(std::string scopeName, int scopeLevel, ScopedSymbolTable* enclosingScope);
     void define(Symbol* symbol);
-    Symbol* lookup(std::string name, bool currScope = false);
+    Symbol* lookup(intern::Id id, bool currScope = false);
+    /*
+     * Looks id up as a single pass over the program would at this scope:
+     * enclosing scopes only show the symbols they had defined when this
+     * scope was opened. Bodies analyzed after the declarations that follow
+     * them, lazily or on other threads, see no more than that.
+     */
+    Symbol* lookupDeclared(intern::Id id, size_t visible = SIZE_MAX);
     static bool initBuiltIns();
     std::string toString() const;
     ScopedSymbolTable* enclosingScope;
     int scopeLevel;
+    // Variables defined in this scope, indexed by frame slot.
+    std::vector<VarSymbol*> slotSymbols;
+    int numSlots() const;
     std::string name();
     static const int NUM_BUILTINS = 4;
     enum builtInSymbols {
@@ -29,6 +41,10 @@ public:
     static BuiltInTypeSymbol* builtInsMap[NUM_BUILTINS];
 private:
     std::string scopeName;
+    // Where each symbol comes in the order this scope defined them.
+    std::unordered_map<intern::Id, size_t> definedAt;
+    // Symbols the enclosing scope had defined when this one was opened.
+    size_t enclosingDefined;
 };
 
 #define GET_BUILT_IN_SYMBOL(type) \
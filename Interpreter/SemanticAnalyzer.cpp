@@ -3,7 +3,18 @@
 
 using namespace std;
 
-SemanticAnalyzer::SemanticAnalyzer() : currentScope(nullptr) {
+SemanticAnalyzer::SemanticAnalyzer(FlatAST& flatTree) : currentScope(nullptr), currentProc(nullptr), flatTree(flatTree), enclosing(nullptr), out(&cout) {
+}
+
+SemanticAnalyzer::SemanticAnalyzer(const SemanticAnalyzer* enclosing, FlatAST& flatTree, ostream& out) : currentScope(nullptr), currentProc(nullptr), flatTree(flatTree), enclosing(enclosing), out(&out) {
+}
+
+AST* SemanticAnalyzer::declarationOf(ProcedureSymbol* procSymbol) const {
+    auto iter = procedureTable.find(procSymbol);
+    if (iter != procedureTable.end()) {
+	return iter->second;
+    }
+    return enclosing ? enclosing->declarationOf(procSymbol) : nullptr;
 }
 
 void SemanticAnalyzer::error(const string& err, int line) {
@@ -12,54 +23,39 @@ void SemanticAnalyzer::error(const string& err, int line) {
 
 bool SemanticAnalyzer::resolveTypes(Symbol* lhs, Symbol* rhs, int line) {
 
-    if (lhs->name == ttype::any) {
+    if (lhs->id == GET_BUILT_IN_SYMBOL(ANY)->id) {
 	return true;
     }
     
-    bool res = lhs->name == rhs->name;
+    bool res = lhs->id == rhs->id;
     if (!res) {
 	this->error("type mismatch between value of type " + lhs->name + " and value of type " + rhs->name, line);
     }
     return res;
 }
 
-Symbol* SemanticAnalyzer::visit(AST* node) {
-    if (node == nullptr) utils::fatalError(string("Parse tree is null"));
-
-    if (node->type() == none) {
-	return nullptr;
-    }
-
-    auto itr = this->visitorTable.find(node->type());
-    if (itr != this->visitorTable.end()) {
-	/*
-	  "this" is an implied first argument for non-static methods
-	*/
-	return itr->second(this, node);
-    } else {
-	this->error("No visitor for node of type index " + to_string(node->type()), node->line);
-    }
-
-    return nullptr;
-}
-
-Symbol* SemanticAnalyzer::visitBlock(AST* node) {
-    Block* blockNode = dynamic_cast<Block*>(node);
+Symbol* SemanticAnalyzer::visitBlock(Block* blockNode) {
     for (AST* declaration : blockNode->declarations) {
 	this->visit(declaration);
     }
-    this->visit(blockNode->compoundStatement);
+    this->check(blockNode->body);
     return nullptr;
 }
 
-Symbol* SemanticAnalyzer::visitProgram(AST* node) {
+Symbol* SemanticAnalyzer::visitProgram(Program* progNode) {
     if (options::showST) {
 	cout << "ENTER scope: global" << endl;
     }
     ScopedSymbolTable* globalScope = new ScopedSymbolTable("global", 1, currentScope);
     currentScope = globalScope;
-    Program* progNode = dynamic_cast<Program*>(node);
-    this->visit(progNode->block);
+    Block* blockNode = progNode->block;
+    for (AST* declaration : blockNode->declarations) {
+	this->visit(declaration);
+    }
+    if (afterDeclarations) {
+	afterDeclarations();
+    }
+    this->check(blockNode->body);
     if (options::showST) {
 	cout << globalScope->toString() << endl;
 	cout << "LEAVE scope: global" << endl;
@@ -69,107 +65,31 @@ Symbol* SemanticAnalyzer::visitProgram(AST* node) {
     return nullptr;
 }
 
-Symbol* SemanticAnalyzer::visitCompound(AST* node) {
-    Compound* compNode = dynamic_cast<Compound*>(node);
-    for (AST* child : compNode->children) {
-	this->visit(child);
-    }
-    return nullptr;
-}
-
-Symbol* SemanticAnalyzer::visitBinOp(AST* node) {
-    BinOp* binOpNode = dynamic_cast<BinOp*>(node);
-    Symbol* lhs = this->visit(binOpNode->left);
-    Symbol* rhs = this->visit(binOpNode->right);
-    this->resolveTypes(lhs, rhs, binOpNode->line);
-    // For now, assume a binary operation's result is the same as its operands.
-    return lhs;
-}
-
-Symbol* SemanticAnalyzer::visitVarDecl(AST* node) {
-    VarDecl* varDeclNode = dynamic_cast<VarDecl*>(node);
+Symbol* SemanticAnalyzer::visitVarDecl(VarDecl* varDeclNode) {
     Var* varNode = varDeclNode->varNode;
     Type* typeNode = varDeclNode->typeNode;
-    string typeName = typeNode->value.strVal;
     Symbol* typeSymbol;
-    if (!(typeSymbol = currentScope->lookup(typeName))) {
-	this->error("no type symbol found for type name " + typeName, varNode->token->line);
+    if (!(typeSymbol = currentScope->lookupDeclared(typeNode->id))) {
+	this->error("no type symbol found for type name " + typeNode->name, varNode->token.line);
     }
-    string varName = varNode->value.strVal;
     Symbol* varSymbol;
-    if ((varSymbol = currentScope->lookup(varName)) && varSymbol->type != nullptr) {
-	this->error("duplicate identifier " + varName, varNode->token->line);
-    }
-    currentScope->define(new VarSymbol(varName, typeSymbol));
-    return nullptr;
-}
-
-Symbol* SemanticAnalyzer::visitRecordDecl(AST* node) {
-    RecordDecl* recordDeclNode = dynamic_cast<RecordDecl*>(node);
-    currentScope->define(new UserDefinedTypeSymbol(recordDeclNode->recordName));
-    return nullptr;
-}
-
-Symbol* SemanticAnalyzer::visitAssign(AST* node) {
-    Assign* assignNode = dynamic_cast<Assign*>(node);
-    // Make sure we're not assigning to a literal value.
-    if (assignNode->left->isLiteral()) {
-	this->error("Cannot assign to literal", assignNode->line);
+    if ((varSymbol = currentScope->lookupDeclared(varNode->id)) && varSymbol->type != nullptr) {
+	this->error("duplicate identifier " + varNode->name, varNode->token.line);
     }
-    auto lhs = this->visit(assignNode->left);
-    auto rhs = this->visit(assignNode->right);
-    if (!rhs) {
-	this->error("The right hand side does not return a value", assignNode->line);
-    }
-    this->resolveTypes(lhs,
-		       rhs,
-		       assignNode->line);
+    currentScope->define(new VarSymbol(varNode->id, typeSymbol));
     return nullptr;
 }
 
-Symbol* SemanticAnalyzer::visitVar(AST* node) {
-    Var* varNode = dynamic_cast<Var*>(node);
-    Symbol* _varSymbol;
-    if (!( _varSymbol = currentScope->lookup(varNode->value.strVal))) {
-	this->error("symbol not found for variable " + varNode->value.strVal, varNode->token->line);
-    }
-    VarSymbol* varSymbol = dynamic_cast<VarSymbol*>(_varSymbol);
-    if (!varSymbol) {
-	this->error("Cannot use symbol \"" + _varSymbol->name + "\" of type \"" + string(Symbol::TYPE_TO_NAME[_varSymbol->stype()]) + "\" as a variable name", node->line);
-    }
-    return varSymbol->type;    
-}
-
-Symbol* SemanticAnalyzer::visitNum(__attribute__((unused)) AST* node) {
-    return GET_BUILT_IN_SYMBOL(REAL);
-}
-
-Symbol* SemanticAnalyzer::visitUnaryOp(AST* node) {
-    UnaryOp* unaryOp = dynamic_cast<UnaryOp*>(node);
-    auto numType = this->visit(unaryOp->expr);
-
-    if (numType == GET_BUILT_IN_SYMBOL(REAL) ||
-	numType == GET_BUILT_IN_SYMBOL(INT)) {
-	return numType;
-    }
-
-    string chStr;
-    chStr += unaryOp->op->value.charVal;
-
-    this->error("Unary operator \"" + chStr + "\" can only be used on numeric types", node->line);
+Symbol* SemanticAnalyzer::visitRecordDecl(RecordDecl* recordDeclNode) {
+    currentScope->define(new UserDefinedTypeSymbol(recordDeclNode->recordId));
     return nullptr;
 }
 
-Symbol* SemanticAnalyzer::visitStringLiteral(__attribute__((unused)) AST* node) {
-    return GET_BUILT_IN_SYMBOL(STRING);
-}
-
-Symbol* SemanticAnalyzer::visitProcedureDecl(AST* node) {
-    ProcedureDecl* procDecNode = dynamic_cast<ProcedureDecl*>(node);
-    string procName = procDecNode->procName;
-    ProcedureSymbol* procSymbol = new ProcedureSymbol(procName);
+Symbol* SemanticAnalyzer::visitProcedureDecl(ProcedureDecl* procDecNode) {
+    const string& procName = procDecNode->procName;
+    ProcedureSymbol* procSymbol = new ProcedureSymbol(procDecNode->procId);
 
-    if (currentScope->lookup(procName)) {
+    if (currentScope->lookupDeclared(procDecNode->procId)) {
 	this->error("redefinition of procedure " + procName, procDecNode->line);
     }
 	
@@ -184,14 +104,23 @@ Symbol* SemanticAnalyzer::visitProcedureDecl(AST* node) {
     for (AST* param : *(procDecNode->params)) {
 	Param* paramNode = dynamic_cast<Param*>(param);
 	Type* paramType = paramNode->typeNode;
-	Symbol* paramTypeSymbol = currentScope->lookup(paramType->value.strVal);
 	Var* paramVarNode = paramNode->varNode;
-	VarSymbol* varSymbol = new VarSymbol(paramVarNode->value.strVal, paramTypeSymbol);
+	Symbol* paramTypeSymbol;
+	if (!(paramTypeSymbol = currentScope->lookupDeclared(paramType->id))) {
+	    this->error("no type symbol found for type name " + paramType->name, paramVarNode->token.line);
+	}
+	VarSymbol* varSymbol = new VarSymbol(paramVarNode->id, paramTypeSymbol);
 	currentScope->define(varSymbol);
 	procSymbol->params->push_back(varSymbol);
     }
     procDecNode->table = currentScope;
-    this->visit(procDecNode->blockNode);
+    // A lazily parsed body is analyzed by analyzeBody once it is built.
+    if (procDecNode->blockNode) {
+	ProcedureDecl* enclosingProc = currentProc;
+	currentProc = procDecNode;
+	this->visit(procDecNode->blockNode);
+	currentProc = enclosingProc;
+    }
     currentScope = currentScope->enclosingScope;
     if (options::showST) {
 	cout << procedureScope->toString() << endl;
@@ -200,106 +129,198 @@ Symbol* SemanticAnalyzer::visitProcedureDecl(AST* node) {
     return nullptr;
 }
 
-Symbol* SemanticAnalyzer::visitProcedureCall(AST* node) {
-    ProcedureCall* procCallNode = dynamic_cast<ProcedureCall*>(node);
-    string procName = procCallNode->procName;
+void SemanticAnalyzer::analyzeBody(ProcedureDecl* procDecNode) {
+    ScopedSymbolTable* enclosingScope = currentScope;
+    ProcedureDecl* enclosingProc = currentProc;
+    currentScope = procDecNode->table;
+    currentProc = procDecNode;
+    this->visit(procDecNode->blockNode);
+    currentScope = enclosingScope;
+    currentProc = enclosingProc;
+}
 
-    /*
-      Handle built-in functions
-    */
-    auto itr = builtin::FUNCTIONS.find(procName);
-    if (itr != builtin::FUNCTIONS.end()) {
-	unsigned int nFormalParams = itr->second.paramTypes.size();
-	unsigned int nActualParams = procCallNode->paramVals->size();
-	if (nFormalParams != nActualParams) {
-	    this->error("expected " + to_string(nFormalParams) + " arguments, got " + to_string(nActualParams) + " in call to built-in " + procName, procCallNode->line); 
+Symbol* SemanticAnalyzer::visitUnhandled(AST* node) {
+    this->error("No visitor for node of type index " + to_string(node->type()), node->line);
+    return nullptr;
+}
+
+Symbol* SemanticAnalyzer::check(flat::Ref node) {
+    switch (flatTree.kinds[node]) {
+    case FlatKind::NOOP:
+	return nullptr;
+    case FlatKind::CONST:
+	if (flatTree.constants[flatTree.a[node]].type == DataVal::D_STRING) {
+	    return GET_BUILT_IN_SYMBOL(STRING);
 	}
-	auto fiter = itr->second.paramTypes.begin();
-	auto aiter = procCallNode->paramVals->begin();
-	for (;fiter != itr->second.paramTypes.end(); fiter++, aiter++) {
-	    Symbol* typeSymbol = this->visit(*aiter);
-	    string argTypeName = ScopedSymbolTable::builtInsMap[*fiter]->name;
-	    if (!options::staticTypeChecking && argTypeName == ttype::any) {
-		// If dynamic types are allowed, ignore assignments to "any" type.
-		continue;
-	    }
-	    if (argTypeName != typeSymbol->name) {
-		this->error("type mismatch between value of type " + argTypeName + " and " \
-			    "value of type " + typeSymbol->name + " in call to built-in " + procName,
-			    procCallNode->line);
-	    }	    
+	return GET_BUILT_IN_SYMBOL(REAL);
+    case FlatKind::VAR:
+	return checkVar(node);
+    case FlatKind::ASSIGN:
+	return checkAssign(node);
+    case FlatKind::BINOP: {
+	Symbol* lhs = this->check(flatTree.b[node]);
+	Symbol* rhs = this->check(flatTree.c[node]);
+	this->resolveTypes(lhs, rhs, flatTree.lines[node]);
+	// For now, assume a binary operation's result is the same as its operands.
+	return lhs;
+    }
+    case FlatKind::UNARY: {
+	auto numType = this->check(flatTree.b[node]);
+	if (numType == GET_BUILT_IN_SYMBOL(REAL) ||
+	    numType == GET_BUILT_IN_SYMBOL(INT)) {
+	    return numType;
 	}
-	return itr->second.returnType;
+	string chStr = flatTree.a[node] == ttype::minus ? "-" : "+";
+	this->error("Unary operator \"" + chStr + "\" can only be used on numeric types", flatTree.lines[node]);
+	return nullptr;
     }
-    
+    case FlatKind::COMPOUND:
+	for (uint32_t i = 0; i < flatTree.c[node]; i++) {
+	    this->check(flatTree.lists[flatTree.b[node] + i]);
+	}
+	return nullptr;
+    case FlatKind::BLOCK:
+	return visitBlock(flatTree.blocks[flatTree.a[node]]);
+    case FlatKind::IF:
+	this->check(flatTree.a[node]);
+	this->check(flatTree.b[node]);
+	if (flatTree.c[node] != flat::NONE) {
+	    this->check(flatTree.c[node]);
+	}
+	return nullptr;
+    case FlatKind::WHILE:
+	this->check(flatTree.a[node]);
+	this->check(flatTree.b[node]);
+	return nullptr;
+    case FlatKind::CALL:
+	return checkCall(node);
+    case FlatKind::CALLB:
+	return checkBuiltinCall(node);
+    case FlatKind::RETURN:
+	return checkReturn(node);
+    }
+    this->error("No check for flat node of kind " + to_string((int) flatTree.kinds[node]), flatTree.lines[node]);
+    return nullptr;
+}
+
+VarSymbol* SemanticAnalyzer::variable(intern::Id id, int line) {
+    Symbol* _varSymbol;
+    if (!( _varSymbol = currentScope->lookupDeclared(id))) {
+	this->error("symbol not found for variable " + intern::name(id), line);
+    }
+    VarSymbol* varSymbol = dynamic_cast<VarSymbol*>(_varSymbol);
+    if (!varSymbol) {
+	this->error("Cannot use symbol \"" + _varSymbol->name + "\" of type \"" + string(Symbol::TYPE_TO_NAME[_varSymbol->stype()]) + "\" as a variable name", line);
+    }
+    return varSymbol;
+}
+
+Symbol* SemanticAnalyzer::checkVar(flat::Ref node) {
+    VarSymbol* varSymbol = variable(flatTree.c[node], flatTree.lines[node]);
+    flatTree.a[node] = currentScope->scopeLevel - varSymbol->scopeLevel;
+    flatTree.b[node] = varSymbol->slot;
+    return varSymbol->type;
+}
+
+Symbol* SemanticAnalyzer::checkAssign(flat::Ref node) {
+    int line = flatTree.lines[node];
+    VarSymbol* varSymbol = variable(flatTree.b[node], line);
+    auto lhs = varSymbol->type;
+    auto rhs = this->check(flatTree.c[node]);
+    if (!rhs) {
+	this->error("The right hand side does not return a value", line);
+    }
+    this->resolveTypes(lhs,
+		       rhs,
+		       line);
+    flatTree.a[node] = currentScope->scopeLevel - varSymbol->scopeLevel;
+    flatTree.b[node] = varSymbol->slot;
+    return nullptr;
+}
+
+Symbol* SemanticAnalyzer::checkBuiltinCall(flat::Ref node) {
+    const FlatAST::Builtin& callee = flatTree.builtins[flatTree.a[node]];
+    const string& procName = intern::name(callee.id);
+    uint32_t args = flatTree.b[node], nActualParams = flatTree.c[node];
+    int line = flatTree.lines[node];
+    unsigned int nFormalParams = callee.fn->paramTypes.size();
+    if (nFormalParams != nActualParams) {
+	this->error("expected " + to_string(nFormalParams) + " arguments, got " + to_string(nActualParams) + " in call to built-in " + procName, line); 
+    }
+    for (uint32_t i = 0; i < nFormalParams; i++) {
+	auto formal = callee.fn->paramTypes[i];
+	Symbol* typeSymbol = this->check(flatTree.lists[args + i]);
+	Symbol* argType = ScopedSymbolTable::builtInsMap[formal];
+	if (!options::staticTypeChecking && formal == BUILT_IN_TYPE(ANY)) {
+	    // If dynamic types are allowed, ignore assignments to "any" type.
+	    continue;
+	}
+	if (argType->id != typeSymbol->id) {
+	    this->error("type mismatch between value of type " + argType->name + " and " \
+			"value of type " + typeSymbol->name + " in call to built-in " + procName,
+			line);
+	}	    
+    }
+    return callee.fn->returnType;
+}
+
+Symbol* SemanticAnalyzer::checkCall(flat::Ref node) {
+    intern::Id procId = flatTree.a[node];
+    const string& procName = intern::name(procId);
+    uint32_t args = flatTree.b[node], nActualParams = flatTree.c[node];
+    int line = flatTree.lines[node];
     Symbol* result;
-    if (!(result = currentScope->lookup(procName))) {
-	this->error("no procedure found with name " + procName, procCallNode->line);
+    if (!(result = currentScope->lookupDeclared(procId))) {
+	this->error("no procedure found with name " + procName, line);
     }
     ProcedureSymbol* procSymbol = dynamic_cast<ProcedureSymbol*>(result);
-    map<ProcedureSymbol*, AST*>::iterator iter;
-    if ((iter = procedureTable.find(procSymbol)) == procedureTable.end()) {
-	this->error("procedure declaration node could not be found in program tree", procCallNode->line);
+    AST* declaration;
+    if (!(declaration = declarationOf(procSymbol))) {
+	this->error("procedure declaration procCallNode could not be found in program tree", line);
     }
-    ProcedureDecl* procDeclNode = dynamic_cast<ProcedureDecl*>(iter->second);
+    ProcedureDecl* procDeclNode = dynamic_cast<ProcedureDecl*>(declaration);
     // Check for matching number of formal and actual params.
-    if (procCallNode->paramVals->size() != procDeclNode->params->size()) {
-	this->error("wrong number of parameters in call to " + procDeclNode->procName, procCallNode->line);
+    if (nActualParams != procDeclNode->params->size()) {
+	this->error("wrong number of parameters in call to " + procDeclNode->procName, line);
     }
-    auto fiter = procDeclNode->params->begin(); // Vector of Param*
-    auto aiter = procCallNode->paramVals->begin();
-    for (;fiter != procDeclNode->params->end(); fiter++, aiter++) {
-	Symbol* typeSymbol = this->visit(*aiter);
-	if (!options::staticTypeChecking && (*fiter)->typeNode->value.strVal == ttype::any) {
+    for (uint32_t i = 0; i < nActualParams; i++) {
+	Param* formal = procDeclNode->params->at(i);
+	Symbol* typeSymbol = this->check(flatTree.lists[args + i]);
+	if (!options::staticTypeChecking && formal->typeNode->id == GET_BUILT_IN_SYMBOL(ANY)->id) {
 	    // If dynamic types are allowed, ignore assignments to "any" type.
 	    continue;
 	}	
-	if ((*fiter)->typeNode->value.strVal != typeSymbol->name) {
-	    this->error("type mismatch between value of type " + (*fiter)->typeNode->value.strVal + " and " \
-			"value of type " + typeSymbol->name + " in call to " + procName, procCallNode->line);
+	if (formal->typeNode->id != typeSymbol->id) {
+	    this->error("type mismatch between value of type " + formal->typeNode->name + " and " \
+			"value of type " + typeSymbol->name + " in call to " + procName, line);
 	}
 	    
     }
     VarSymbol* paramSymbol;	
     for (Symbol* param : *(procSymbol->params)) {
 	paramSymbol = dynamic_cast<VarSymbol*>(param);
-	cout << paramSymbol->name << endl;
+	*out << paramSymbol->name << endl;
 	    
     }
-    procCallNode->procDeclNode = iter->second;
+    flatTree.a[node] = flatTree.procedureIndex(procDeclNode);
 
-    ProcedureDecl* pdNode = dynamic_cast<ProcedureDecl*>(procCallNode->procDeclNode);
-    if (!pdNode->returnTypeNode) {
+    if (!procDeclNode->returnTypeNode) {
 	return nullptr;
     }    
-    auto retSymbol = currentScope->lookup(pdNode->returnTypeNode->value.strVal);
+    auto retSymbol = currentScope->lookupDeclared(procDeclNode->returnTypeNode->id);
     if (!retSymbol) {
-	this->error("procedure \"" + procName + "\" does not have a valid return type", pdNode->line);
+	this->error("procedure \"" + procName + "\" does not have a valid return type", procDeclNode->line);
     }
     return retSymbol;
 }
 
-Symbol* SemanticAnalyzer::visitIfStatement(AST* node) {
-    IfStatement* ifStatementNode = dynamic_cast<IfStatement*>(node);
-    this->visit(ifStatementNode->conditionNode);
-    this->visit(ifStatementNode->blockNode);
-    if (ifStatementNode->elseBranch) {
-	this->visit(ifStatementNode->elseBranch);
+Symbol* SemanticAnalyzer::checkReturn(flat::Ref node) {
+    Symbol* retStatementType = this->check(flatTree.a[node]);
+    Type* returnType = currentProc->returnTypeNode;
+    Symbol* procType;
+    if (!(procType = currentScope->lookupDeclared(returnType->id))) {
+	this->error("no type symbol found for type name " + returnType->name, returnType->line);
     }
-    return nullptr;
-}
-
-Symbol* SemanticAnalyzer::visitWhileStatement(AST* node) {
-    WhileStatement* whileStatementNode = dynamic_cast<WhileStatement*>(node);
-    this->visit(whileStatementNode->conditionNode);
-    this->visit(whileStatementNode->blockNode);
-    return nullptr;
-}
-
-Symbol* SemanticAnalyzer::visitReturnStatement(AST* node) {
-    ReturnStatement* returnStatementNode = dynamic_cast<ReturnStatement*>(node);
-    Symbol* retStatementType = this->visit(returnStatementNode->expr);
-    Symbol* procType = currentScope->lookup(returnStatementNode->procDecl->returnTypeNode->value.strVal);
-    this->resolveTypes(procType, retStatementType, returnStatementNode->line);
+    this->resolveTypes(procType, retStatementType, flatTree.lines[node]);
     return nullptr;
 }
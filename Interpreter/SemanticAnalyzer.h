@@ -1,57 +1,59 @@
 #ifndef SEMANTIC_ANALYZER_H
 #define SEMANTIC_ANALYZER_H
 
-#include <map>
 #include <functional>
+#include <map>
+#include <ostream>
 #include <string>
 #include "Symbol.h"
 #include "ASTNodes.h"
 #include "ScopedSymbolTable.h"
+#include "ASTVisitor.h"
+#include "FlatAST.h"
 
-class SemanticAnalyzer {
+class SemanticAnalyzer : public ASTVisitor<SemanticAnalyzer, Symbol*> {
+    friend class ASTVisitor<SemanticAnalyzer, Symbol*>;
 public:
-    SemanticAnalyzer();
-    Symbol* visit(AST* node);
+    // Bodies are checked in flatTree, where their names are resolved.
+    SemanticAnalyzer(FlatAST& flatTree);
+    /*
+     * An analyzer for procedure bodies that runs alongside others, under
+     * the one that analyzed the procedures' declarations. Its output goes
+     * to out.
+     */
+    SemanticAnalyzer(const SemanticAnalyzer* enclosing, FlatAST& flatTree, std::ostream& out);
+    // Analyzes the block of a procedure that was declared without one.
+    void analyzeBody(ProcedureDecl* node);
+    // Run between the program's declarations and its statements.
+    std::function<void()> afterDeclarations;
 private:
     ScopedSymbolTable* currentScope;
+    // The procedure whose body is being checked, if any.
+    ProcedureDecl* currentProc;
+    FlatAST& flatTree;
     std::map<ProcedureSymbol*, AST*> procedureTable;
+    const SemanticAnalyzer* enclosing;
+    std::ostream* out;
+    AST* declarationOf(ProcedureSymbol* procSymbol) const;
     void error(const std::string& err, int line);
-    Symbol* visitBlock(AST* node);
-    Symbol* visitProgram(AST* node);
-    Symbol* visitCompound(AST* node);
-    Symbol* visitBinOp(AST* node); 
-    Symbol* visitUnaryOp(AST* node);   
-    Symbol* visitVarDecl(AST* node);
-    Symbol* visitRecordDecl(AST* node);
-    Symbol* visitAssign(AST* node);
-    Symbol* visitVar(AST* node);
-    Symbol* visitNum(AST* node);
-    Symbol* visitStringLiteral(AST* node);
-    Symbol* visitProcedureDecl(AST* node);
-    Symbol* visitProcedureCall(AST* node);
-    Symbol* visitIfStatement(AST* node);
-    Symbol* visitWhileStatement(AST* node);
-    Symbol* visitReturnStatement(AST* node);
+    Symbol* visitBlock(Block* node);
+    Symbol* visitProgram(Program* node);
+    Symbol* visitVarDecl(VarDecl* node);
+    Symbol* visitRecordDecl(RecordDecl* node);
+    Symbol* visitProcedureDecl(ProcedureDecl* node);
+    Symbol* visitUnhandled(AST* node);
+    /*
+     * Checks a statement or expression of the flat tree, resolving the
+     * names it uses, and returns its type if it has one.
+     */
+    Symbol* check(flat::Ref node);
+    Symbol* checkVar(flat::Ref node);
+    Symbol* checkAssign(flat::Ref node);
+    Symbol* checkCall(flat::Ref node);
+    Symbol* checkBuiltinCall(flat::Ref node);
+    Symbol* checkReturn(flat::Ref node);
+    VarSymbol* variable(intern::Id id, int line);
     bool resolveTypes(Symbol* lhs, Symbol* rhs, int line);
-
-    const std::map<int, std::function<Symbol*(SemanticAnalyzer*, AST*)> > visitorTable = {
-		    { block, &SemanticAnalyzer::visitBlock },
-		    { program, &SemanticAnalyzer::visitProgram },
-		    { compound, &SemanticAnalyzer::visitCompound },
-		    { binOp, &SemanticAnalyzer::visitBinOp },
-		    { unaryOp, &SemanticAnalyzer::visitUnaryOp },
-		    { varDecl, &SemanticAnalyzer::visitVarDecl },
-		    { recordDecl, &SemanticAnalyzer::visitRecordDecl },
-		    { assign, &SemanticAnalyzer::visitAssign },
-		    { var, &SemanticAnalyzer::visitVar },
-		    { num, &SemanticAnalyzer::visitNum },		    
-		    { stringLiteral, &SemanticAnalyzer::visitStringLiteral },
-		    { procedureDecl, &SemanticAnalyzer::visitProcedureDecl },
-		    { procedureCall, &SemanticAnalyzer::visitProcedureCall, },
-		    { ifStatement, &SemanticAnalyzer::visitIfStatement },
-		    { whileStatement, &SemanticAnalyzer::visitWhileStatement },
-		    { returnStatement, &SemanticAnalyzer::visitReturnStatement }
-    };    
 };
 
 #endif
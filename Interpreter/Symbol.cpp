@@ -1,13 +1,11 @@
 #include "Symbol.h"
 using namespace std;
 
-Symbol::Symbol(string name) {
-    this->name = name;
+Symbol::Symbol(intern::Id id) : id(id), name(intern::name(id)) {
     type = nullptr;
 }
 
-Symbol::Symbol(string name, Symbol* type) {
-    this->name = name;
+Symbol::Symbol(intern::Id id, Symbol* type) : id(id), name(intern::name(id)) {
     this->type = type;
 }
 
@@ -19,7 +17,7 @@ std::ostream &operator<< (std::ostream &os, Symbol const &symbol) {
 
 
 
-BuiltInTypeSymbol::BuiltInTypeSymbol(string name): Symbol(name) {
+BuiltInTypeSymbol::BuiltInTypeSymbol(intern::Id id): Symbol(id) {
     
 }
 
@@ -32,11 +30,11 @@ Symbol::SymbolType BuiltInTypeSymbol::stype() const {
 }
 
 bool operator==(const BuiltInTypeSymbol& lhs, const BuiltInTypeSymbol& rhs) {
-    return lhs.name == rhs.name;
+    return lhs.id == rhs.id;
 }
 
 
-UserDefinedTypeSymbol::UserDefinedTypeSymbol(string name): Symbol(name) {
+UserDefinedTypeSymbol::UserDefinedTypeSymbol(intern::Id id): Symbol(id) {
     
 }
 
@@ -49,11 +47,11 @@ Symbol::SymbolType UserDefinedTypeSymbol::stype() const {
 }
 
 bool operator==(const UserDefinedTypeSymbol& lhs, const UserDefinedTypeSymbol& rhs) {
-    return lhs.name == rhs.name;
+    return lhs.id == rhs.id;
 }
 
 
-VarSymbol::VarSymbol(string name, Symbol* type) : Symbol(name, type) {
+VarSymbol::VarSymbol(intern::Id id, Symbol* type) : Symbol(id, type) {
     
 }
 
@@ -68,10 +66,10 @@ string VarSymbol::toString() const {
 
 
 
-ProcedureSymbol::ProcedureSymbol(string name, vector<Symbol*>* params) : Symbol(name), params(params) {
+ProcedureSymbol::ProcedureSymbol(intern::Id id, vector<Symbol*>* params) : Symbol(id), params(params) {
 }
 
-ProcedureSymbol::ProcedureSymbol(string name) : Symbol(name) {
+ProcedureSymbol::ProcedureSymbol(intern::Id id) : Symbol(id) {
     params = new vector<Symbol*>();
 }
 
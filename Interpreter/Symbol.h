@@ -6,15 +6,17 @@
  */
 
 #include "utils.h"
+#include "Intern.h"
 #include <string_view>
 
 class Symbol {
 public:
-    std::string name;
+    intern::Id id;
+    const std::string& name;
     Symbol* type;
     std::string category;
-    Symbol(std::string name);
-    Symbol(std::string name, Symbol* type);
+    Symbol(intern::Id id);
+    Symbol(intern::Id id, Symbol* type);
     enum SymbolType {
 	       S_BUILTIN,
 	       S_USERDEF,
@@ -40,7 +42,7 @@ public:
 
 class BuiltInTypeSymbol: public Symbol {
 public:
-    BuiltInTypeSymbol(std::string name);
+    BuiltInTypeSymbol(intern::Id id);
     virtual SymbolType stype() const;
     virtual std::string toString() const;
     friend bool operator==(const BuiltInTypeSymbol& lhs,
@@ -49,7 +51,7 @@ public:
 
 class UserDefinedTypeSymbol: public Symbol {
  public:
-    UserDefinedTypeSymbol(std::string name);
+    UserDefinedTypeSymbol(intern::Id id);
     virtual SymbolType stype() const;
     virtual std::string toString() const;
     friend bool operator==(const UserDefinedTypeSymbol& lhs,
@@ -63,7 +65,10 @@ class UserDefinedTypeSymbol: public Symbol {
 
 class VarSymbol: public Symbol {
 public:
-    VarSymbol(std::string name, Symbol* type);
+    VarSymbol(intern::Id id, Symbol* type);
+    // Frame slot and scope level, assigned when the symbol is defined.
+    int slot = -1;
+    int scopeLevel = -1;
     virtual SymbolType stype() const;
     virtual std::string toString() const;
 };
@@ -74,8 +79,8 @@ public:
 
 class ProcedureSymbol: public Symbol {
 public:
-    ProcedureSymbol(std::string name, std::vector<Symbol*>* params);
-    ProcedureSymbol(std::string name);
+    ProcedureSymbol(intern::Id id, std::vector<Symbol*>* params);
+    ProcedureSymbol(intern::Id id);
     virtual SymbolType stype() const;
     virtual std::string toString() const;
     std::vector<Symbol*>* params;
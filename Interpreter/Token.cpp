@@ -1,26 +1,28 @@
 #include "Token.h"
+#include "utils.h"
 using namespace std;
 
-Token::Token(string type, char value, int line) : value(TokenVal(TokenValType::Char)){
-    this->type = type;
-    this->value.charVal = value;
-    this->line = line;
+const char* ttype::name(Kind kind) {
+    static const char* const NAMES[] = {
+#define TOKEN_KIND_NAME(KIND, NAME) NAME,
+	TOKEN_KINDS(TOKEN_KIND_NAME)
+#undef TOKEN_KIND_NAME
+    };
+    return NAMES[kind];
 }
 
-Token::Token(string type, double value, int line) : value(TokenVal(TokenValType::Double)){
-    this->type = type;
-    this->value.numVal = value;
-    this->line = line;
-}
-
-Token::Token(string type, string value, int line) : value(TokenVal(TokenValType::String)){
-    this->type = type;
-    this->value.strVal = value;
-    this->line = line;
+string Token::name() const {
+    if (id != intern::NONE) {
+	return intern::name(id);
+    }
+    string res(text);
+    utils::toUpper(res);
+    return res;
 }
 
 string Token::toString() const {
-    return "Line " + to_string(line) + " " + "Token({" + type + "}, {" + value.toString() + "})";
+    string value = type == ttype::int_const || type == ttype::real_const ? to_string(numVal) : string(text);
+    return "Line " + to_string(line) + " " + "Token({" + ttype::name(type) + "}, {" + value + "})";
 };
 
 std::ostream &operator<< (std::ostream &os, Token const &token) {
@@ -1,110 +1,84 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <iostream>
+#include "Intern.h"
 
 /*
- * Token types grouped into type namespace
+ * Token kinds and their printable names
  */
-namespace ttype {
-    const std::string eof = "EOF";
-    const std::string integer = "INTEGER";
-    const std::string plus = "PLUS";
-    const std::string minus = "MINUS";
-    const std::string mul = "MUL";
-    const std::string float_div = "FLOAT_DIV";
-    const std::string lparen = "(";
-    const std::string rparen = ")";
-    const std::string begin = "BEGIN";
-    const std::string end = "END";
-    const std::string assign = "ASSIGN";
-    const std::string semi = "SEMI";
-    const std::string dot = "DOT";
-    const std::string id = "ID";
-    const std::string program = "PROGRAM";
-    const std::string var = "VAR";
-    const std::string int_div = "INTEGER_DIV";
-    const std::string real = "REAL";
-    const std::string int_const = "INTEGER_CONST";
-    const std::string real_const = "REAL_CONST";
-    const std::string colon = "COLON";
-    const std::string comma = "COMMA";
-    const std::string procedure = "PROCEDURE";
-    const std::string twhile = "WHILE";
-    const std::string tdo = "DO";
-    const std::string tif = "IF";
-    const std::string then = "THEN";
-    const std::string telse = "ELSE";
-    const std::string equals = "EQUALS";
-    const std::string not_equals = "NOT_EQUALS";
-    const std::string less_than = "LESS_THAN";
-    const std::string greater_than = "GREATER_THAN";
-    const std::string lt_or_equals = "LT_OR_EQUALS";
-    const std::string gt_or_equals = "GT_OR_EQUALS";
-    const std::string bang = "BANG";
-    const std::string string_literal = "STRING_LITERAL";
-    const std::string string = "STRING";
-    const std::string any = "ANY";
-    const std::string record = "RECORD";
-    const std::string type = "TYPE";
-    const std::string ret = "RETURN";
-    const std::string arrow = "ARROW";
-}
-
-/*
- * Enum to determine the type of data in TokenVal
- */
-enum TokenValType {
-    Char,
-    Double,
-    String,
-};
+#define TOKEN_KINDS(X)				\
+    X(eof, "EOF")                      \
+    X(integer, "INTEGER")              \
+    X(plus, "PLUS")                    \
+    X(minus, "MINUS")                  \
+    X(mul, "MUL")                      \
+    X(float_div, "FLOAT_DIV")          \
+    X(lparen, "(")                     \
+    X(rparen, ")")                     \
+    X(begin, "BEGIN")                  \
+    X(end, "END")                      \
+    X(assign, "ASSIGN")                \
+    X(semi, "SEMI")                    \
+    X(dot, "DOT")                      \
+    X(id, "ID")                        \
+    X(program, "PROGRAM")              \
+    X(var, "VAR")                      \
+    X(int_div, "INTEGER_DIV")          \
+    X(real, "REAL")                    \
+    X(int_const, "INTEGER_CONST")      \
+    X(real_const, "REAL_CONST")        \
+    X(colon, "COLON")                  \
+    X(comma, "COMMA")                  \
+    X(procedure, "PROCEDURE")          \
+    X(twhile, "WHILE")                 \
+    X(tdo, "DO")                       \
+    X(tif, "IF")                       \
+    X(then, "THEN")                    \
+    X(telse, "ELSE")                   \
+    X(equals, "EQUALS")                \
+    X(not_equals, "NOT_EQUALS")        \
+    X(less_than, "LESS_THAN")          \
+    X(greater_than, "GREATER_THAN")    \
+    X(lt_or_equals, "LT_OR_EQUALS")    \
+    X(gt_or_equals, "GT_OR_EQUALS")    \
+    X(bang, "BANG")                    \
+    X(string_literal, "STRING_LITERAL") \
+    X(string, "STRING")                \
+    X(any, "ANY")                      \
+    X(record, "RECORD")                \
+    X(type, "TYPE")                    \
+    X(ret, "RETURN")                   \
+    X(arrow, "ARROW")
 
 /*
- * Struct to hold the value of a token
+ * Token kinds grouped into type namespace
  */
-
-struct TokenVal {
-    double numVal;
-    char charVal;
-    std::string strVal;
-    int intVal;
-    TokenValType type;
-    TokenVal(TokenValType type) {
-        this->type = type;
-    }
-    ~TokenVal() {
-        strVal.clear();
-    }
-    std::string toString() const {
-        switch(type) {
-	case TokenValType::String: {
-	    return strVal;
-	}
-	case TokenValType::Double: {
-	    return std::to_string(numVal);
-	}
-	case TokenValType::Char: {
-	    std::string res = " ";
-	    res[0] = charVal;
-	    return res;
-	}
-        }
-    }
-};
+namespace ttype {
+    enum Kind : uint8_t {
+#define TOKEN_KIND_ENUM(KIND, NAME) KIND,
+	TOKEN_KINDS(TOKEN_KIND_ENUM)
+#undef TOKEN_KIND_ENUM
+    };
+    const char* name(Kind kind);
+}
 
 /*
- * Token class definition
+ * Token record. Tokens are plain values: `text` points into the source
+ * buffer, which outlives the parse, `numVal` is only meaningful for
+ * numeric constants and `id` only for identifiers and keywords.
  */
-class Token {
-public:
-    std::string type;
+struct Token {
+    ttype::Kind type;
     int line;
-    TokenVal value;
-    Token(std::string type, char value, int line);
-    Token(std::string type, double value, int line);
-    Token(std::string type, std::string value, int line);
+    std::string_view text;
+    double numVal;
+    intern::Id id = intern::NONE;
+    // Identifier or keyword text, uppercased.
+    std::string name() const;
     std::string toString() const;
     friend std::ostream &operator<< (std::ostream& os, Token const& token);
 };
@@ -0,0 +1,302 @@
+#include "VM.h"
+#include "builtins.h"
+#include "constants.h"
+
+using namespace std;
+
+/*
+ * GCC and clang can dispatch through a table of label addresses, which gives
+ * every opcode its own indirect branch. Anything else uses a plain switch.
+ */
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#endif
+
+/*
+ * REAL operands take an inline fast path; everything else goes through the
+ * DataVal operators for their type checks and string handling.
+ */
+#define VM_ARITH(OPERATOR) {						\
+	const DataVal& lhs = R[ins->b];					\
+	const DataVal& rhs = R[ins->c];					\
+	if (lhs.type == DataVal::D_REAL && rhs.type == DataVal::D_REAL)	\
+	    R[ins->a] = DataVal(lhs.realVal OPERATOR rhs.realVal);	\
+	else								\
+	    R[ins->a] = lhs OPERATOR rhs;				\
+    }
+
+#define VM_COMPARE(OPERATOR) {						\
+	const DataVal& lhs = R[ins->b];					\
+	const DataVal& rhs = R[ins->c];					\
+	if (lhs.type == DataVal::D_REAL && rhs.type == DataVal::D_REAL)	\
+	    R[ins->a] = DataVal((int) (lhs.realVal OPERATOR rhs.realVal)); \
+	else								\
+	    R[ins->a] = DataVal((int) (lhs OPERATOR rhs));		\
+    }
+
+VM::VM(Module* module) : module(module), sizedChunks(module->chunks.size()) {
+    // Every frame starts below the top of its caller's frame, so this many
+    // registers can never overflow before the depth check fires.
+    registers.resize((CALL_STACK_MAX_DEPTH + 2) * std::max<size_t>(module->maxRegs(), 1));
+    frames.reserve(CALL_STACK_MAX_DEPTH + 2);
+    DataVal::allocator.addRootSet(this);
+}
+
+VM::~VM() {
+    DataVal::allocator.removeRootSet(this);
+}
+
+/*
+ * Every register below the top of the innermost frame is treated as live,
+ * along with every chunk's constants.
+ */
+void VM::markRoots(Allocator* allocator) const {
+    for (const Chunk& chunk : module->chunks) {
+	for (const DataVal& constant : chunk.constants) {
+	    allocator->mark(constant);
+	}
+    }
+    if (frames.empty()) {
+	return;
+    }
+    const Frame& top = frames.back();
+    for (const DataVal* reg = registers.data(); reg < top.base + top.chunk->numRegs; reg++) {
+	allocator->mark(*reg);
+    }
+}
+
+/*
+ * Grows the register file after a chunk was loaded, if it or a chunk
+ * compiled along with it needs more registers than the file was sized
+ * for. Frames are moved along with it.
+ */
+void VM::reserveRegisters(uint16_t loaded) {
+    size_t maxRegs = std::max<size_t>(registers.size() / (CALL_STACK_MAX_DEPTH + 2), module->chunks[loaded].numRegs);
+    for (size_t i = sizedChunks; i < module->chunks.size(); i++) {
+	maxRegs = std::max<size_t>(maxRegs, module->chunks[i].numRegs);
+    }
+    sizedChunks = module->chunks.size();
+    size_t size = (CALL_STACK_MAX_DEPTH + 2) * maxRegs;
+    if (size <= registers.size()) {
+	return;
+    }
+    DataVal* old = registers.data();
+    registers.resize(size);
+    for (Frame& frame : frames) {
+	frame.base = registers.data() + (frame.base - old);
+    }
+}
+
+void VM::panic() const {
+    cout << "Panicking! Stack trace:" << endl;
+    for (auto frame = frames.rbegin(); frame != frames.rend(); frame++) {
+	cout << "______________________________" << endl;
+	cout << "Frame: " << frame->chunk->name << endl;
+	for (size_t i = 0; i < frame->chunk->slotNames.size(); i++) {
+	    if (frame->base[i].type != DataVal::D_NONE) {
+		cout << frame->chunk->slotNames[i] << " : " << frame->base[i] << endl;
+	    }
+	}
+	cout << "______________________________" << endl;
+    }
+    exit(1);
+}
+
+DataVal VM::run() {
+    frames.push_back({ &module->chunks[0], registers.data(), nullptr, nullptr, 0 });
+    Frame* frame = &frames.back();
+    DataVal* R = frame->base;
+    const Instr* code = frame->chunk->code.data();
+    const Instr* pc = code;
+    const Instr* ins;
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_LABEL(name) &&op_ ## name,
+    static void* dispatchTable[] = { BYTECODE_OPS(VM_LABEL) };
+#undef VM_LABEL
+#define CASE(name) op_ ## name:
+#define DISPATCH() ins = pc++; goto *dispatchTable[(int) ins->op]
+    DISPATCH();
+#else
+#define CASE(name) case Op::name:
+#define DISPATCH() break
+    for (;;) {
+    ins = pc++;
+    switch (ins->op) {
+#endif
+
+    CASE(MOVE) {
+	R[ins->a] = R[ins->b];
+	DISPATCH();
+    }
+    CASE(LOADK) {
+	R[ins->a] = frame->chunk->constants[ins->b];
+	DISPATCH();
+    }
+    CASE(GETOUTER) {
+	Frame* outer = frame;
+	for (int depth = ins->b; depth; depth--) outer = outer->link;
+	R[ins->a] = outer->base[ins->c];
+	DISPATCH();
+    }
+    CASE(SETOUTER) {
+	Frame* outer = frame;
+	for (int depth = ins->b; depth; depth--) outer = outer->link;
+	outer->base[ins->c] = R[ins->a];
+	DISPATCH();
+    }
+    CASE(ADD) {
+	VM_ARITH(+)
+	DISPATCH();
+    }
+    CASE(SUB) {
+	VM_ARITH(-)
+	DISPATCH();
+    }
+    CASE(MUL) {
+	VM_ARITH(*)
+	DISPATCH();
+    }
+    CASE(DIV) {
+	VM_ARITH(/)
+	DISPATCH();
+    }
+    CASE(EQ) {
+	VM_COMPARE(==)
+	DISPATCH();
+    }
+    CASE(NE) {
+	VM_COMPARE(!=)
+	DISPATCH();
+    }
+    CASE(LT) {
+	VM_COMPARE(<)
+	DISPATCH();
+    }
+    CASE(GT) {
+	VM_COMPARE(>)
+	DISPATCH();
+    }
+    CASE(LE) {
+	VM_COMPARE(<=)
+	DISPATCH();
+    }
+    CASE(GE) {
+	VM_COMPARE(>=)
+	DISPATCH();
+    }
+    CASE(NEG) {
+	const DataVal& operand = R[ins->b];
+	switch (operand.type) {
+	case DataVal::D_INT:
+	    R[ins->a] = DataVal(-operand.intVal);
+	    break;
+	case DataVal::D_REAL:
+	    R[ins->a] = DataVal(-operand.realVal);
+	    break;
+	default:
+	    utils::fatalError("- on line " + to_string(frame->chunk->lines[ins - code]) + " is not a known unary operation for value of type " + to_string(operand.type));
+	}
+	DISPATCH();
+    }
+    CASE(JMP) {
+	// Loops only jump backwards, so this is the loop safepoint.
+	pc = code + ins->b;
+	DataVal::allocator.safepoint();
+	DISPATCH();
+    }
+    CASE(JMPF) {
+	if (!R[ins->a].toBool()) pc = code + ins->b;
+	DISPATCH();
+    }
+    CASE(CALL) {
+	const Chunk* callee = &module->chunks[ins->b];
+	if (frames.size() > (size_t) CALL_STACK_MAX_DEPTH) {
+	    utils::fatalError("Stack error: call stack max depth exceeded; stack overflow");
+	}
+	Frame* link = frame;
+	while (link->chunk->level >= callee->level) link = link->link;
+	frame->pc = pc;
+	DataVal* base = R + ins->c;
+	for (uint16_t i = callee->numParams; i < callee->numRegs; i++) {
+	    base[i] = DataVal();
+	}
+	frames.push_back({ callee, base, nullptr, link, ins->a });
+	frame = &frames.back();
+	R = base;
+	code = pc = callee->code.data();
+	DataVal::allocator.safepoint();
+	DISPATCH();
+    }
+    CASE(CALLB) {
+	const builtin::Fn* fn = module->builtins[ins->b];
+	DataVal* args = R + ins->c;
+	R[ins->a] = fn->fn(nullptr, vector<DataVal>(args, args + fn->paramTypes.size()));
+	DISPATCH();
+    }
+    CASE(RET) {
+	DataVal result = R[ins->a];
+	if (frames.size() == 1) {
+	    return result;
+	}
+	uint16_t retReg = frame->retReg;
+	frames.pop_back();
+	frame = &frames.back();
+	R = frame->base;
+	code = frame->chunk->code.data();
+	pc = frame->pc;
+	R[retReg] = result;
+	DISPATCH();
+    }
+    CASE(RETNONE) {
+	if (frames.size() == 1) {
+	    return DataVal();
+	}
+	uint16_t retReg = frame->retReg;
+	frames.pop_back();
+	frame = &frames.back();
+	R = frame->base;
+	code = frame->chunk->code.data();
+	pc = frame->pc;
+	R[retReg] = DataVal();
+	DISPATCH();
+    }
+    CASE(NORET) {
+	utils::fatalError("Reached end of non-void procedure " + frame->chunk->name + " without returning a value");
+	DISPATCH();
+    }
+    CASE(PANIC) {
+	this->panic();
+	DISPATCH();
+    }
+    CASE(TRACECMP) {
+	cout << "left: " << R[ins->b].toString() << " right: " << R[ins->c].toString() << endl;
+	DISPATCH();
+    }
+    CASE(TRACECOND) {
+	cout << "If Condition result: " << R[ins->a].toString() << endl;
+	DISPATCH();
+    }
+    CASE(LOAD) {
+	// Loading replaces the code this instruction lives in.
+	uint16_t chunkIdx = ins->b;
+	module->loader->load(chunkIdx);
+	reserveRegisters(chunkIdx);
+	R = frame->base;
+	for (uint16_t i = frame->chunk->numParams; i < frame->chunk->numRegs; i++) {
+	    R[i] = DataVal();
+	}
+	code = pc = frame->chunk->code.data();
+	DISPATCH();
+    }
+
+#ifndef VM_COMPUTED_GOTO
+    default:
+	utils::fatalError("Invalid opcode " + to_string((int) ins->op));
+    }
+    }
+#endif
+#undef CASE
+#undef DISPATCH
+    return DataVal();
+}
@@ -0,0 +1,40 @@
+#ifndef VM_H
+#define VM_H
+
+#include <vector>
+#include "Bytecode.h"
+
+/****************************************
+ Register VM
+
+ Runs a compiled Module. All frames live in one preallocated register file;
+ a callee's frame starts at the caller's argument registers.
+***************************************/
+
+class VM : public RootSet {
+public:
+    VM(Module* module);
+    ~VM();
+    DataVal run();
+    void markRoots(Allocator* allocator) const;
+private:
+    struct Frame {
+	const Chunk* chunk;
+	DataVal* base;
+	// Where to resume this frame once its callee returns.
+	const Instr* pc;
+	// Frame of the lexically enclosing procedure.
+	Frame* link;
+	// Caller register receiving this frame's return value.
+	uint16_t retReg;
+    };
+    Module* module;
+    std::vector<DataVal> registers;
+    std::vector<Frame> frames;
+    // Chunks already accounted for in the size of the register file.
+    size_t sizedChunks;
+    void panic() const;
+    void reserveRegisters(uint16_t loaded);
+};
+
+#endif
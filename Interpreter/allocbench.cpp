@@ -0,0 +1,49 @@
+/*
+ * Allocator microbenchmark: fills a pool to a given number of live slots,
+ * then times steady-state free/alloc pairs against it. Both operations
+ * should cost the same whether 10 or 1M slots are live.
+ *
+ *   make allocbench && ./allocbench
+ */
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include "Allocator.h"
+
+using namespace std;
+
+typedef pool<uint64_t> BenchPool;
+
+static double nsPerPair(size_t live, size_t iterations) {
+    unique_ptr<BenchPool> p(new BenchPool());
+    vector<size_t> slots;
+    slots.reserve(live);
+    for (size_t i = 0; i < live; i++) {
+	slots.push_back(p->alloc().first);
+    }
+    // Free slots in a scattered order so the benchmark doesn't just replay
+    // the most recently freed slot.
+    uint64_t rng = 88172645463325252ull;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	size_t victim = rng % live;
+	p->free(slots[victim]);
+	auto slot = p->alloc();
+	*slot.second = i;
+	slots[victim] = slot.first;
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / iterations;
+}
+
+int main() {
+    const size_t iterations = 2000000;
+    printf("%10s  %s\n", "live", "ns per free+alloc");
+    for (size_t live = 10; live <= 1000000; live *= 10) {
+	printf("%10zu  %.1f\n", live, nsPerPair(live, iterations));
+    }
+    return 0;
+}
@@ -26,14 +26,14 @@ BUILTIN(PRINTLN) {
 }
 
 BUILTIN(SLEEP) {
-    this_thread::sleep_for(chrono::milliseconds((int) DATAVAL_GET_VAL(double, args[0].data)));
+    this_thread::sleep_for(chrono::milliseconds((int) args[0].realVal));
     return DataVal();
 }
 
 BUILTIN(STRMODIFY) {
     string* str = DATAVAL_GET_PTR(string, args[0]);
     string other_str = DATAVAL_GET_VAL(string, args[1].data);
-    int index = (int) DATAVAL_GET_VAL(double, args[2].data);
+    int index = (int) args[2].realVal;
 
     cout << *str << " " << other_str << " " << index << endl;
     
@@ -67,7 +67,7 @@ BUILTIN(BIND) {
 BUILTIN(PARSEINT) {
     const string& intstr = DATAVAL_GET_VAL(string, args[0].data);
     int res = std::stoi(intstr);
-    return DataVal::allocator.allocate(res);
+    return DataVal(res);
 }
 
 BUILTIN(INPUT) {
@@ -77,11 +77,9 @@ BUILTIN(INPUT) {
 }
 
 BUILTIN(INT_TO_REAL) {
-    int val = DATAVAL_GET_VAL(int, args[0].data);
-    return DataVal::allocator.allocate((double) val);
+    return DataVal((double) args[0].intVal);
 }
 
 BUILTIN(REAL_TO_INT) {
-    double val = DATAVAL_GET_VAL(double, args[0].data);
-    return DataVal::allocator.allocate((int) val);
+    return DataVal((int) args[0].realVal);
 }
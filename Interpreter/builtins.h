@@ -15,7 +15,7 @@
     DataVal builtIn_ ## name (CallStack* stack, std::vector<DataVal> args )
 
 #define BUILTIN_ENTRY(name, returnType, ...) \
-    { #name, { #name, &builtIn_ ## name, returnType, { __VA_ARGS__ }} }
+    { intern::id(#name), { #name, &builtIn_ ## name, returnType, { __VA_ARGS__ }} }
 
 
 BUILTIN(DUMP);
@@ -41,7 +41,7 @@ namespace builtin {
 	std::vector<ScopedSymbolTable::builtInSymbols> paramTypes;
     };
 
-    const std::unordered_map<std::string, Fn> FUNCTIONS =
+    const std::unordered_map<intern::Id, Fn> FUNCTIONS =
 	{
 	 BUILTIN_ENTRY(PARSEINT, GET_BUILT_IN_SYMBOL(INT), BUILT_IN_TYPE(STRING)),
 	 BUILTIN_ENTRY(DUMP, nullptr, BUILT_IN_TYPE(ANY)),
@@ -56,6 +56,10 @@ namespace builtin {
 	 BUILTIN_ENTRY(REAL_TO_INT, GET_BUILT_IN_SYMBOL(INT), BUILT_IN_TYPE(REAL))
 	};
 
+    // Built-ins that engines without a call stack implement themselves.
+    const intern::Id BIND_ID = intern::id("BIND");
+    const intern::Id PANIC_ID = intern::id("PANIC");
+
     void error(const std::string& err, const std::string& name);
 }
 
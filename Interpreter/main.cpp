@@ -1,9 +1,12 @@
 
-#include <iostream>
-#include <fstream>
+#include <climits>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include "Interpreter.h"
 #include "Parser.h"
+#include "ProgramCache.h"
+#include "VM.h"
 #include "options.h"
 
 using namespace std;
@@ -26,6 +29,16 @@ public:
         }
         return empty;
     }
+    // Returns the value of an option given as "--option=value".
+    const std::string getCmdOptionValue(const std::string &option) const{
+        const std::string prefix = option + "=";
+        for (const std::string& token : this->tokens) {
+            if (token.compare(0, prefix.size(), prefix) == 0) {
+                return token.substr(prefix.size());
+            }
+        }
+        return empty;
+    }
     bool cmdOptionExists(const std::string &option) const{
         return std::find(this->tokens.begin(), this->tokens.end(), option)
 	    != this->tokens.end();
@@ -35,6 +48,61 @@ private:
     std::vector <std::string> tokens;
 };
 
+/*
+ * Parses a byte count with an optional K, M or G suffix, e.g. "64M".
+ */
+size_t parseByteSize(const std::string& str) {
+    size_t pos = 0;
+    unsigned long long size = 0;
+    try {
+        size = std::stoull(str, &pos);
+    } catch (const std::exception&) {
+        utils::fatalError("Invalid size \"" + str + "\"");
+    }
+    std::string suffix = str.substr(pos);
+    utils::toUpper(suffix);
+    if (suffix == "K") size <<= 10;
+    else if (suffix == "M") size <<= 20;
+    else if (suffix == "G") size <<= 30;
+    else if (!suffix.empty()) utils::fatalError("Invalid size suffix \"" + suffix + "\"");
+    return size;
+}
+
+/*
+ * Parses a count, such as a --jit-threshold.
+ */
+unsigned parseCount(const std::string& str) {
+    size_t pos = 0;
+    unsigned long count = 0;
+    try {
+        count = std::stoul(str, &pos);
+    } catch (const std::exception&) {
+        utils::fatalError("Invalid count \"" + str + "\"");
+    }
+    if (pos != str.size() || count > UINT_MAX) {
+        utils::fatalError("Invalid count \"" + str + "\"");
+    }
+    return count;
+}
+
+/*
+ * Parses a thread count, where 0 means one thread per core.
+ */
+unsigned parseThreadCount(const std::string& str) {
+    unsigned long count = 0;
+    if (!str.empty()) {
+        try {
+            count = std::stoul(str);
+        } catch (const std::exception&) {
+            utils::fatalError("Invalid thread count \"" + str + "\"");
+        }
+    }
+    if (count == 0) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return count;
+}
+
 int main(int argc, char *argv[]) {
     InputParser input(argc, argv);
     const string fileName = input.getCmdOption("-f");
@@ -45,16 +113,79 @@ int main(int argc, char *argv[]) {
     DEFINE_CMD_LINE_OPT(input, showConditions, "-sc", "--show-conditions");
     DEFINE_CMD_LINE_OPT(input, staticTypeChecking, "-stc", "--static-type-checking");
     DEFINE_CMD_LINE_OPT(input, showAllocations, "-sa", "--show-allocations");
+    DEFINE_CMD_LINE_OPT(input, dumpBytecode, "-db", "--dump-bytecode");
+    DEFINE_CMD_LINE_OPT(input, gcStats, "-gs", "--gc-stats");
+    DEFINE_CMD_LINE_OPT(input, streamSource, "-s", "--stream");
+    DEFINE_CMD_LINE_OPT(input, lazyParse, "-lp", "--lazy-parse");
+    DEFINE_CMD_LINE_OPT(input, jit, "-jit", "--jit");
+    DEFINE_CMD_LINE_OPT(input, cache, "-cache", "--cache");
+
+    const string maxHeap = input.getCmdOptionValue("--max-heap");
+    if (!maxHeap.empty()) {
+        options::maxHeapBytes = parseByteSize(maxHeap);
+    }
+
+    options::lexThreads = parseThreadCount(input.getCmdOptionValue("--lex-threads"));
+    options::parseThreads = parseThreadCount(input.getCmdOptionValue("--parse-threads"));
+    const string jitThreshold = input.getCmdOptionValue("--jit-threshold");
+    if (!jitThreshold.empty()) {
+        options::jitThreshold = parseCount(jitThreshold);
+    }
+    options::emitC = input.getCmdOptionValue("--emit-c");
+    options::nativeBinary = input.getCmdOptionValue("--native");
+    options::cacheDir = input.getCmdOptionValue("--cache-dir");
+    if (!options::cacheDir.empty()) {
+        options::cache = true;
+    }
+    else if (options::cache) {
+        options::cacheDir = ProgramCache::defaultDir();
+    }
+
+    const string engine = input.getCmdOptionValue("--engine");
+    if (engine == "vm") {
+        options::engine = options::ENGINE_VM;
+    }
+    else if (engine == "closure") {
+        options::engine = options::ENGINE_CLOSURE;
+    }
+    else if (!engine.empty() && engine != "tree") {
+        utils::fatalError("Unknown engine \"" + engine + "\", expected tree, vm or closure");
+    }
+    // The cache holds bytecode, so cached programs run on the VM.
+    if (options::cache) {
+        if (!engine.empty() && engine != "vm") {
+            utils::fatalError("--cache runs programs on the vm engine, not " + engine);
+        }
+        if (options::jit) {
+            utils::fatalError("--cache runs programs on the vm engine, which --jit doesn't compile for");
+        }
+        options::engine = options::ENGINE_VM;
+    }
     
     if (!fileName.empty()) {
-        ifstream file(fileName);
-        stringstream buffer;
-        buffer << file.rdbuf();
-        string str = buffer.str();
-        Lexer lexer = Lexer(str);
-        Parser parser = Parser(&lexer);
-        Interpreter interpreter = Interpreter(&parser);
-	interpreter.interpret();
+        // Streaming reads the source through a fixed-size window instead
+        // of mapping all of it.
+        SourceFile source(fileName, !options::streamSource);
+        // A translation needs the syntax tree, and a streamed source is
+        // never all in memory to be hashed.
+        unique_ptr<ProgramCache> cache;
+        if (options::cache && source.isMapped() && options::emitC.empty() && options::nativeBinary.empty()) {
+            cache.reset(new ProgramCache(options::cacheDir, source.contents()));
+        }
+        unique_ptr<Module> module(cache ? cache->load() : nullptr);
+        if (module) {
+            VM vm(module.get());
+            vm.run();
+        }
+        else {
+            Lexer lexer = source.isMapped() ? Lexer(source.contents(), options::lexThreads) : Lexer(source.descriptor());
+            Parser parser = Parser(&lexer);
+            Interpreter interpreter = Interpreter(&parser, cache.get());
+            interpreter.interpret();
+        }
+        if (options::gcStats) {
+            DataVal::allocator.printStats();
+        }
     }
     return 0;
 }
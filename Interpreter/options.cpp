@@ -2,10 +2,24 @@
 #include "options.h"
 
 namespace options {
+    Engine engine = ENGINE_TREE;
     bool printTokens = false;
     bool dumpVars = false;
     bool showST = false;
     bool showConditions = false;
     bool staticTypeChecking = false;
     bool showAllocations = false;
+    bool dumpBytecode = false;
+    bool jit = false;
+    unsigned jitThreshold = 1000;
+    size_t maxHeapBytes = 0;
+    bool gcStats = false;
+    bool streamSource = false;
+    unsigned lexThreads = 0;
+    bool lazyParse = false;
+    unsigned parseThreads = 0;
+    std::string emitC;
+    std::string nativeBinary;
+    bool cache = false;
+    std::string cacheDir;
 }
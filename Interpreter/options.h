@@ -1,16 +1,50 @@
 #ifndef OPTIONS_H
 #define OPTIONS_H
 
+#include <cstddef>
+#include <string>
+
 #define DEFINE_CMD_LINE_OPT(input, optionName, shortStr, longStr)	\
     options::optionName = (input.cmdOptionExists(shortStr) || input.cmdOptionExists(longStr))
 
 namespace options {
+    enum Engine {
+	ENGINE_TREE,
+	ENGINE_VM,
+	ENGINE_CLOSURE,
+    };
+    extern Engine engine;
     extern bool printTokens;
     extern bool dumpVars;
     extern bool showST;
     extern bool showConditions;
     extern bool staticTypeChecking;
     extern bool showAllocations;
+    extern bool dumpBytecode;
+    // Compile numeric procedures to machine code in the tree walker.
+    extern bool jit;
+    // Calls of a procedure, or iterations of a loop, that the tree walker
+    // runs before --jit compiles them; 0 compiles them on first use.
+    extern unsigned jitThreshold;
+    extern size_t maxHeapBytes;
+    extern bool gcStats;
+    extern bool streamSource;
+    // Threads used to lex a mapped source; 0 means one per core.
+    extern unsigned lexThreads;
+    // Parse and check each procedure body on its first call, rather than
+    // all of them before the program runs.
+    extern bool lazyParse;
+    // Threads used to build procedure bodies before the program runs; 0
+    // means one per core.
+    extern unsigned parseThreads;
+    // Where --emit-c writes the program translated to C++, and where
+    // --native builds it into an executable.
+    extern std::string emitC;
+    extern std::string nativeBinary;
+    // Keep compiled programs in cacheDir, and run them from there when
+    // their source hasn't changed.
+    extern bool cache;
+    extern std::string cacheDir;
 }
 
 #endif
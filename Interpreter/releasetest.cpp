@@ -0,0 +1,68 @@
+/*
+ * Arena release test: parses programs full of string literals, then
+ * collects with the parser alive and again once it is gone. Live literals
+ * must survive the first collection; once their parser and its arenas
+ * are released, the second must reclaim every one of them without
+ * touching the freed nodes. Bodies are built both in the first pass and
+ * on worker parsers, which have arenas and flat trees of their own.
+ *
+ *   make releasetest && ./releasetest
+ */
+#include <cstdio>
+#include <string>
+#include "Parser.h"
+#include "options.h"
+
+using namespace std;
+
+static const int LITERALS = 4;
+static const char* SOURCE =
+    "program Release;\n"
+    "procedure first();\n"
+    "begin\n"
+    "   println(\"one\");\n"
+    "end;\n"
+    "procedure second();\n"
+    "begin\n"
+    "   println(\"two\");\n"
+    "   println(\"three\");\n"
+    "end;\n"
+    "begin\n"
+    "   println(\"four\");\n"
+    "end.\n";
+
+static bool check(bool ok, const string& what) {
+    if (!ok) {
+	printf("FAIL: %s (%zu live strings)\n", what.c_str(), DataVal::allocator.liveObjects());
+    }
+    return ok;
+}
+
+static bool parseAndRelease(unsigned threads) {
+    options::parseThreads = threads;
+    size_t before = DataVal::allocator.liveObjects();
+    bool ok = true;
+    {
+	Lexer lexer(SOURCE);
+	Parser parser(&lexer);
+	parser.parse();
+	parser.parseBodies([](ProcedureDecl*, FlatAST&, ostream&) {});
+	DataVal::allocator.gc();
+	ok &= check(DataVal::allocator.liveObjects() == before + LITERALS,
+		    to_string(threads) + " threads: literals collected while their parser is alive");
+    }
+    DataVal::allocator.gc();
+    ok &= check(DataVal::allocator.liveObjects() == before,
+		to_string(threads) + " threads: literals kept after their parser was released");
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    for (int round = 0; round < 3; round++) {
+	ok &= parseAndRelease(1);
+	ok &= parseAndRelease(4);
+    }
+    printf("%s\n", ok ? "ok" : "failed");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+program Precedence;
+
+{ Operator precedence and associativity. Check with
+  ./pas -f test5.pas | diff - test5.out }
+
+var a, b, r : real;
+
+begin
+   a := 3;
+   b := 4;
+
+   { Comparisons bind looser than arithmetic. }
+   if (a + 1 = b) then begin
+      println("a + 1 = b");
+   end
+   else begin
+      println("not a + 1 = b");
+   end;
+   if (a * 2 > b + 1) then begin
+      println("a * 2 > b + 1");
+   end
+   else begin
+      println("not a * 2 > b + 1");
+   end;
+   if (b - a < a - 1) then begin
+      println("b - a < a - 1");
+   end
+   else begin
+      println("not b - a < a - 1");
+   end;
+   if (a + 1 != b) then begin
+      println("a + 1 != b");
+   end
+   else begin
+      println("not a + 1 != b");
+   end;
+
+   { <= and >= }
+   if (a <= 3) then begin
+      println("a <= 3");
+   end
+   else begin
+      println("not a <= 3");
+   end;
+   if (a <= 2) then begin
+      println("a <= 2");
+   end
+   else begin
+      println("not a <= 2");
+   end;
+   if (a >= 3) then begin
+      println("a >= 3");
+   end
+   else begin
+      println("not a >= 3");
+   end;
+   if (b >= 5) then begin
+      println("b >= 5");
+   end
+   else begin
+      println("not b >= 5");
+   end;
+   if (a + 1 <= b) then begin
+      println("a + 1 <= b");
+   end
+   else begin
+      println("not a + 1 <= b");
+   end;
+   if (b * 2 >= a * 3) then begin
+      println("b * 2 >= a * 3");
+   end
+   else begin
+      println("not b * 2 >= a * 3");
+   end;
+
+   { * and / bind tighter than + and - }
+   r := 2 * 3 + 4 * 5;
+   dump(r);
+   println("");
+   r := 2 + 3 * 4 - 6 / 2;
+   dump(r);
+   println("");
+   r := (2 + 3) * 4;
+   dump(r);
+   println("");
+
+   { Chains of - and / group from the left. }
+   r := 10 - 4 - 3;
+   dump(r);
+   println("");
+   r := 100 / 10 / 5;
+   dump(r);
+   println("");
+   r := 100 - 10 / 5 - 2 * 3;
+   dump(r);
+   println("");
+
+   { Unary minus }
+   r := -2 * 3 - -1;
+   dump(r);
+   println("");
+   r := -2 + 3 * -1;
+   dump(r);
+   println("");
+end.
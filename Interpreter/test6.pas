@@ -0,0 +1,22 @@
+program Later;
+
+{ A body only sees what was declared before it, however it is parsed:
+  with one parse thread or several, or with --lazy-parse. Check with
+  ./pas -f test6.pas 2>&1 | diff - test6.out }
+
+procedure first() -> real;
+begin
+   return second() + later;
+end;
+
+var later : real;
+
+procedure second() -> real;
+begin
+   return 2;
+end;
+
+begin
+   later := 40;
+   dump(first());
+end.
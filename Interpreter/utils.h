@@ -2,6 +2,8 @@
 #define UTILS_H
 
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 #include <cmath>
 #include <map>
@@ -13,8 +15,23 @@
 class AST;
 
 namespace utils {
+
+    // What fatalError throws on a thread that catches its own errors.
+    struct FatalError {
+	std::string message;
+    };
+
+    /*
+     * Set on worker threads whose errors must be reported in a fixed
+     * order: fatalError then throws a FatalError for the thread to
+     * catch, rather than exiting on the spot.
+     */
+    inline thread_local bool throwFatalErrors = false;
     
     inline void fatalError(const std::string err) {
+	if (throwFatalErrors) {
+	    throw FatalError{ err };
+	}
         std::cerr << "FATAL: " << err << std::endl;
         exit(1);
     }
@@ -41,6 +58,19 @@ namespace utils {
         return std::find(array.begin(), array.end(), value) != array.end();
     }
 
+    // Runs work(0) .. work(count - 1), each on its own thread.
+    template <typename Work>
+    inline void inParallel(size_t count, Work work) {
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < count; i++) {
+	    workers.emplace_back(work, i);
+	}
+	work(0);
+	for (std::thread& worker : workers) {
+	    worker.join();
+	}
+    }
+
     template <typename T>
     inline void combineArrs(std::vector<T*>* a, std::vector<T*>* b) {
         move(b->begin(), b->end(), back_inserter(*a));